@@ -0,0 +1,252 @@
+#!/usr/bin/python3
+
+# regression benchmark of all configurations of the firmware: every smoothing
+# mode x MCU x F_CPU (1, 8 and 16MHz) x variant (the square wave, SYNTH_DDS from
+# 8MHz on, a second sensor, PARAMETERS, PROFILING and the TIMING_MODEs that
+# TIMING_AUTO doesn't pick, see variants()) is built with avr-g++ (flash, RAM
+# and the size of every function and variable) and run in the host simulation
+# (sim/, cycles of the ISRs and the main loop). the results go to
+# DIR/report.json and are compared with a baseline report:
+#   ./bench.py [--dir DIR] [--baseline FILE] [--save-baseline] [--cflags FLAGS] [--stack BYTES] [--sizes-optional]
+# (make bench, make benchbaseline). it fails if a configuration doesn't fit
+# into its part any more (text + data into the flash, data + bss + the stack
+# reserve into the RAM) or doesn't build any more, unless the baseline says
+# it never did. --save-baseline makes the report the new baseline, the
+# configurations that don't fit are accepted then. it fails without avr-g++,
+# with --sizes-optional only the simulation runs then (not for a baseline).
+
+
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+
+SMOOTHING = ["SMOOTH_NONE", "SMOOTH_AVR", "SMOOTH_MOVING_AVR", "SMOOTH_MEDIAN", "SMOOTH_TRACKER", "SMOOTH_CMI"]
+MCUS = {   # flash, RAM in bytes
+	"attiny25": (2048, 128),
+	"attiny45": (4096, 256),
+	"attiny85": (8192, 512),
+}
+F_CPUS = [1000000, 8000000, 16000000]   # internal RC oscillator with and without CKDIV8, the PLL
+DDS_F_CPU = 8000000           # SYNTH_DDS needs at least this
+STACK = 48                    # bytes of RAM left for the stack, at least
+SIMARGS = ["--seconds", "5", "--profile", "steps"]
+CFLAGS = "-std=c++14 -funsigned-char -funsigned-bitfields -fpack-struct -fshort-enums -Wall -Wextra -fno-threadsafe-statics"
+
+
+# name suffix and the options of make sim (Makefile) of each variant
+VARIANTS = {
+	"SYNTH_SQUARE":  ("",        {"SYNTH": "SYNTH_SQUARE"}),
+	"SYNTH_DDS":     (" DDS",    {"SYNTH": "SYNTH_DDS"}),
+	"SENSORS2":      (" 2SENS",  {"SYNTH": "SYNTH_SQUARE", "SENSORS": "2"}),
+	"PARAMETERS":    (" PARAM",  {"PARAMETERS": "1"}),
+	"PROFILING":     (" PROF",   {"PROFILING": "PROBE_PCINT"}),
+	"TIMING_FINE":   (" FINE",   {"TIMING": "TIMING_FINE"}),
+	"TIMING_COARSE": (" COARSE", {"TIMING": "TIMING_COARSE"}),
+}
+DEFINES = { "SYNTH": "SYNTH_MODE", "TIMING": "TIMING_MODE", "SENSORS": "SENSORS", "PROFILING": "PROFILING" }   # -D of the options
+
+def config_name(mcu, f_cpu, smooth, variant):
+	return "%s %uMHz %s%s" % (mcu, f_cpu // 1000000, smooth, VARIANTS[variant][0])
+
+def sim_name(f_cpu, smooth, variant):
+	return "%uMHz %s%s" % (f_cpu // 1000000, smooth, VARIANTS[variant][0])
+
+def variants(f_cpu, smooth):
+	# sound, the square wave with the volume sensor (SENSORS=2), the options, and the timings
+	# where they build: TIMING_FINE at 1MHz (at 8MHz the send ISR wouldn't come once per
+	# Timer0 round), TIMING_COARSE at 16MHz but not with the 12 bit readouts of the CMI
+	r = ["SYNTH_SQUARE", "SYNTH_DDS"] if f_cpu >= DDS_F_CPU else ["SYNTH_SQUARE"]
+	r += ["SENSORS2", "PARAMETERS", "PROFILING"]
+	if f_cpu == 1000000:
+		r.append("TIMING_FINE")
+	if f_cpu == 16000000 and smooth != "SMOOTH_CMI":
+		r.append("TIMING_COARSE")
+	return r
+
+def defines(variant):
+	options = VARIANTS[variant][1]
+	return [DEFINES[k] + "=" + v if k in DEFINES else k for k, v in options.items()]
+
+def make_options(variant):
+	return ["%s=%s" % o for o in VARIANTS[variant][1].items()]
+
+
+def sizes(elf):
+	# .text/.data/.bss and the symbols in them (avr-size -A, avr-nm)
+	out = subprocess.run(["avr-size", "-A", elf], capture_output=True, text=True, check=True).stdout
+	r = { "text": 0, "data": 0, "bss": 0 }
+	for line in out.splitlines():
+		m = re.match(r"\.(text|data|bss)\s+(\d+)", line)
+		if m:
+			r[m.group(1)] = int(m.group(2))
+	out = subprocess.run(["avr-nm", "-S", "-C", "--size-sort", elf], capture_output=True, text=True, check=True).stdout
+	r["functions"] = {}
+	r["variables"] = {}
+	for line in out.splitlines():
+		m = re.match(r"[0-9a-f]+ ([0-9a-f]+) (\w) (.+)", line)
+		if not m:
+			continue
+		kind = m.group(2).lower()
+		if kind in "tw":
+			r["functions"][m.group(3)] = int(m.group(1), 16)
+		elif kind in "bdv":
+			r["variables"][m.group(3)] = int(m.group(1), 16)
+	return r
+
+def build(dir, mcu, f_cpu, smooth, variant, cflags, stack):
+	elf = os.path.join(dir, "%s_%u_%s_%s.elf" % (mcu, f_cpu, smooth, variant))
+	p = subprocess.run(["avr-g++", "-mmcu=" + mcu, "-Os"] + cflags.split() + ["-DF_CPU=%uUL" % f_cpu, "-D" + smooth]
+		+ ["-D" + d for d in defines(variant)] + ["main.cpp", "-o", elf],
+		capture_output=True, text=True)
+	if p.returncode:
+		return { "error": (p.stderr.strip().splitlines() or ["failed"])[-1] }
+	r = sizes(elf)
+	flash, ram = MCUS[mcu]
+	r["flash"] = r["text"] + r["data"]
+	r["ram"] = r["data"] + r["bss"]
+	r["fits"] = r["flash"] <= flash and r["ram"] + stack <= ram
+	return r
+
+
+def simulate(dir, f_cpu, smooth, variant):
+	# the numbers of sim/theremin_sim for one configuration, see its output
+	binary = os.path.join(dir, "sim_%u_%s_%s" % (f_cpu, smooth, variant))
+	p = subprocess.run(["make", "-s", "simbuild", "SMOOTH=" + smooth, "F_CPU=%uUL" % f_cpu, "SIMBIN=" + binary]
+		+ make_options(variant), capture_output=True, text=True)
+	if p.returncode:
+		return { "error": (p.stderr.strip().splitlines() or ["failed"])[-1] }
+	out = subprocess.run([binary] + SIMARGS, capture_output=True, text=True, check=True).stdout
+
+	def number(pattern):
+		m = re.search(pattern, out)
+		return float(m.group(1)) if m else None
+
+	r = {
+		"pings_per_s": number(r"pings\s+\d+\s+([\d.]+) /s"),
+		"asleep_percent": number(r"main loop asleep\s+([\d.]+) %"),
+		"busy_percent": number(r"main loop busy\s+([\d.]+) %"),
+		"framing_errors": number(r"\((\d+) framing errors\)"),
+		"jitter_us": number(r"jitter ([\d.]+) us rms"),
+		"isr": {},
+	}
+	for m in re.finditer(r"^  (\w+)\s+(\d+)\s+(\d+)\s+([\d.]+)\s+(\d+)\s+([\d.]+)\s+(\d+)\s+(\d+)$", out, re.M):
+		r["isr"][m.group(1)] = { "mean": float(m.group(4)), "max": int(m.group(5)), "cpu_percent": float(m.group(6)),
+			"max_latency": int(m.group(7)) }
+	# the main loop itself, per ping. the cpu% of the ISRs can't be subtracted from the rest:
+	# a nested ISR counts for the one it interrupted as well
+	r["main_cycles_per_ping"] = round(r["busy_percent"] / 100 * f_cpu / r["pings_per_s"]) if r["pings_per_s"] else None
+	os.remove(binary)
+	return r
+
+
+def delta(new, old, key):
+	if old is None or new.get(key) is None or old.get(key) is None:
+		return ""
+	d = new[key] - old[key]
+	return ("%+g" % round(d, 1)) if d else ""
+
+def show_sizes(report, baseline):
+	print("%-40s %6s %5s %5s %6s %5s  %-5s %7s %6s %6s" % ("configuration", "text", "data", "bss", "flash", "ram", "fits",
+		"d text", "d data", "d bss"))
+	for name, r in report["configs"].items():
+		old = baseline.get("configs", {}).get(name)
+		if "error" in r:
+			print("%-40s  build failed: %s" % (name, r["error"]))
+			continue
+		mcu = name.split()[0]
+		flash, ram = MCUS[mcu]
+		print("%-40s %6u %5u %5u %5.0f%% %4.0f%%  %-5s %7s %6s %6s" % (name, r["text"], r["data"], r["bss"],
+			100.0 * r["flash"] / flash, 100.0 * r["ram"] / ram, "yes" if r["fits"] else "NO",
+			delta(r, old, "text"), delta(r, old, "data"), delta(r, old, "bss")))
+		if old and "functions" in old:
+			changes = []
+			for kind in ("functions", "variables"):
+				for symbol in set(r[kind]) | set(old[kind]):
+					d = r[kind].get(symbol, 0) - old[kind].get(symbol, 0)
+					if d:
+						changes.append((abs(d), d, symbol))
+			for _, d, symbol in sorted(changes, reverse=True)[:5]:
+				print("%40s %+6d  %s" % ("", d, symbol))
+
+def show_sim(report, baseline):
+	print("%-31s %8s %7s %7s %6s %8s %8s %9s" % ("simulation", "pings/s", "asleep", "jitter", "frmerr", "main cyc",
+		"d asleep", "d main"))
+	for name, r in report["sim"].items():
+		old = baseline.get("sim", {}).get(name)
+		if "error" in r:
+			print("%-31s  build failed: %s" % (name, r["error"]))
+			continue
+		print("%-31s %8.1f %6.1f%% %5.1fus %6u %8s %8s %9s" % (name, r["pings_per_s"], r["asleep_percent"], r["jitter_us"],
+			r["framing_errors"], r["main_cycles_per_ping"], delta(r, old, "asleep_percent"), delta(r, old, "main_cycles_per_ping")))
+		for isr, i in sorted(r["isr"].items()):
+			o = old.get("isr", {}).get(isr) if old else None
+			print("  %-20s mean %6.1f  max %5u  cpu %5.2f%%  latency %4u  %s" % (isr, i["mean"], i["max"], i["cpu_percent"],
+				i["max_latency"], ("d mean %s" % delta(i, o, "mean")) if o and delta(i, o, "mean") else ""))
+
+
+def regressions(report, baseline):
+	# configurations that stopped building or fitting, simulations that stopped building
+	bad = []
+	for name, r in report["configs"].items():
+		old = baseline.get("configs", {}).get(name)
+		if "error" in r or not r["fits"]:
+			if old is None or ("error" not in old and old.get("fits")):
+				bad.append(name)
+	for name, r in report["sim"].items():
+		old = baseline.get("sim", {}).get(name)
+		if "error" in r and (old is None or "error" not in old):
+			bad.append("simulation " + name)
+	return bad
+
+
+def option(name, default):
+	return sys.argv[sys.argv.index(name) + 1] if name in sys.argv else default
+
+if __name__ == "__main__":
+	dir = option("--dir", "bench")
+	baseline_file = option("--baseline", os.path.join(dir, "baseline.json"))
+	cflags = option("--cflags", CFLAGS)
+	stack = int(option("--stack", STACK))
+	os.makedirs(dir, exist_ok=True)
+
+	report = { "stack": stack, "configs": {}, "sim": {} }
+	if shutil.which("avr-g++"):
+		for mcu in MCUS:
+			for f_cpu in F_CPUS:
+				for smooth in SMOOTHING:
+					for variant in variants(f_cpu, smooth):
+						report["configs"][config_name(mcu, f_cpu, smooth, variant)] = build(dir, mcu, f_cpu, smooth, variant, cflags, stack)
+	elif "--sizes-optional" in sys.argv and "--save-baseline" not in sys.argv:
+		print("avr-g++ not found, no sizes\n")
+	else:
+		sys.exit("avr-g++ not found: no sizes to compare (--sizes-optional runs the simulation alone)")
+	for f_cpu in F_CPUS:
+		for smooth in SMOOTHING:
+			for variant in variants(f_cpu, smooth):
+				report["sim"][sim_name(f_cpu, smooth, variant)] = simulate(dir, f_cpu, smooth, variant)
+
+	with open(os.path.join(dir, "report.json"), "w") as f:
+		json.dump(report, f, indent=1, sort_keys=True)
+	baseline = {}
+	if os.path.exists(baseline_file):
+		with open(baseline_file) as f:
+			baseline = json.load(f)
+		print("compared with %s\n" % baseline_file)
+
+	if report["configs"]:
+		show_sizes(report, baseline)
+		print()
+	show_sim(report, baseline)
+
+	if "--save-baseline" in sys.argv:
+		shutil.copy(os.path.join(dir, "report.json"), baseline_file)
+		print("\nbaseline saved to %s" % baseline_file)
+		baseline = report
+	bad = regressions(report, baseline)
+	if bad:
+		print("\ndon't fit or don't build any more: %s" % ", ".join(bad))
+		sys.exit(1)
@@ -14,12 +14,44 @@
 #define F_CMI_H_
 
 #include <stdint.h>
+#include <stddef.h>
+
+#ifndef SIM_CHARGE
+#define SIM_CHARGE(cycles)  // cycle cost annotation for the host simulator, see mydefs.h
+#endif
 
 namespace analyzer {
 
 /************************************************************************/
 /* Function and Type Declaration                                        */
 /************************************************************************/
+
+		/* arithmetic the StaticCMI needs beyond + - < >, as free functions so other Metric
+		   types (like fixedpoint::FixedPoint) can overload them in their own namespace */
+	namespace metric {
+
+			/* (average * weight_old + value * weight_new) / (weight_old + weight_new)
+			   Metric must hold max_value * (weight_old + weight_new) */
+		template <uint8_t weight_old, uint8_t weight_new, typename Metric>
+		inline Metric weighted_average(const Metric& average, const Metric& value){
+			constexpr uint16_t WEIGHT_SUM { uint16_t(weight_old) + weight_new };
+			SIM_CHARGE(avrcost::mul_by<Metric>(weight_old) + avrcost::mul_by<Metric>(weight_new)
+			           + avrcost::div_by<Metric>(WEIGHT_SUM) + avrcost::add<Metric>());
+			return (average * Metric(weight_old) + value * Metric(weight_new)) / Metric(WEIGHT_SUM);
+		}
+
+			/* whether a difference of delta can be averaged without overflow.
+			   plain integers don't know their range, that's up to you */
+		template <typename Metric>
+		constexpr bool fits_weighted_average(const Metric&, uint8_t, uint16_t){ return true; }
+
+			/* picks fits_weighted_average of the Metric's namespace if there is one */
+		template <typename Metric>
+		constexpr bool delta_fits(const Metric& delta, uint8_t weight_new, uint16_t weight_sum){
+			return fits_weighted_average(delta, weight_new, weight_sum);
+		}
+
+	}
 	
 		/* Channeling Measurement Interpreter */
 		/* This class is for analyzing measured raw values
@@ -31,11 +63,18 @@ namespace analyzer {
 			[like 20, 4590, 20, 4590, 23, 4580, ...], output() may also jump between
 			the two averages of the values in their areas */
 		/*  For details how it works see its source code */
-	template <typename Metric, uint8_t channels>
-	class ChannellingMeasurementInterpreter {
+		/*  There are two flavours which share this base:
+			ChannellingMeasurementInterpreter        configuration is an object, can be changed at run time
+			StaticChannellingMeasurementInterpreter  configuration is a policy type, known at compile time */
+		/*  Config is the derived class (CRTP). It has to provide
+				Metric delta(const Metric& average)                                   allowed delta to the average
+				Metric weighted_average(const Metric& average, const Metric& value)   new average on a match
+				uint8_t reduce_badness(uint8_t badness)                               badness after a match
+				uint8_t initial_badness()                                             badness of a new channel */
+	template <typename Metric, uint8_t channels, typename Config>
+	class ChannellingMeasurementInterpreterBase {
 		static_assert(channels>=1, "too few channels!!!!");
 	public:
-		class Configuration;
 		static constexpr uint8_t NO_CHANNEL { 255 };
 		
 	private:
@@ -54,7 +93,8 @@ namespace analyzer {
 			inline constexpr Channel() : _average(0), _badness(255) {}
 				
 				/* create a valid Channel */
-			inline constexpr Channel(const Metric& initial_value, const Configuration* config);
+			inline constexpr Channel(const Metric& initial_value, uint8_t initial_badness)
+				: _average(initial_value), _badness(initial_badness != 255 ? initial_badness : 254) {}
 			
 				/* returns reference to average of this channel */
 			inline const Metric& get_average() /*const*/ { return _average; } // test const
@@ -63,18 +103,13 @@ namespace analyzer {
 			inline void inc_badness(){ if (_badness < 254) ++_badness; }
 			
 				/* make the Channel 'better' */
-			inline void dec_badness(const Configuration* config){
-				_badness = (static_cast<uint16_t>(_badness) * static_cast<uint16_t>(config->badness_reducer))
-					/ (static_cast<uint16_t>(config->badness_reducer) + 3); // <<<<< maybe change the 3 to a bigger number ?
-						// or make this 3 template ??? ... a better solution could be to make the mapping reducer -> actual factor better
-						// maybe change this mapping generally
-			}
+			inline void dec_badness(Config& config){ _badness = config.reduce_badness(_badness); }
 				
 				/* try to apply value
 				   on match:    applies value, makes channel better, returns true
 				   on mismatch: makes channel worse, returns false
 				   invalid channel means always mismatch */
-			inline bool accumulate(const Metric& value, Configuration* config);
+			inline bool accumulate(const Metric& value, Config& config);
 				// <<< ancapsulate an inline function for bool matching(const Metric& value) !!!! to make code more readable
 			
 				/* comparison by badness */
@@ -103,6 +138,50 @@ namespace analyzer {
 					if so than swap along to build the correct order */
 		inline void smart_sort(uint8_t channel);
 		
+		inline Config& config(){ return *static_cast<Config*>(this); }
+
+	protected:
+		ChannellingMeasurementInterpreterBase() = default;
+
+	public:
+	/* public methods */
+
+			/* enter a new measured value */
+			/* returns the Channel {0, ... ,channels-1} which matched,
+			   returns NO_CHANNEL if no channel matched and creates a new channel */
+		uint8_t input(const Metric& value);
+
+			/* return current measurement result */
+			/* never interrupt output by input or vice versa */
+			/* attention: you'll get a reference to the value stored inside the CMI
+			   if you update the value indirectly via an input(..) the value behind
+			   your reference will be updated too and will be the new correct output. */
+		inline const Metric& output(){ return _ch[0].get_average(); }
+
+			/* input() n values in a row, for offline runs over recorded data */
+			/* out[i] gets output() and matched[i] the return value of input() after in[i],
+			   exactly as if called one by one. out and matched may be nullptr */
+		void input_batch(const Metric* in, size_t n, Metric* out, uint8_t* matched);
+
+		ChannellingMeasurementInterpreterBase(const ChannellingMeasurementInterpreterBase&) = delete;
+		ChannellingMeasurementInterpreterBase(ChannellingMeasurementInterpreterBase&&) = delete;
+		ChannellingMeasurementInterpreterBase& operator = (const ChannellingMeasurementInterpreterBase&) = delete;
+		ChannellingMeasurementInterpreterBase& operator = (ChannellingMeasurementInterpreterBase&&) = delete;
+
+			/* makes all channels invalid
+			   you can use it together with config to reset the cmi */
+		inline void invalidate(){
+			for (uint8_t i = 0; i < channels; ++i) _ch[i].invalidate();
+		}
+
+	};
+
+
+		/* CMI with a configuration object that can be changed at run time */
+	template <typename Metric, uint8_t channels>
+	class ChannellingMeasurementInterpreter
+		: public ChannellingMeasurementInterpreterBase<Metric, channels, ChannellingMeasurementInterpreter<Metric, channels>> {
+		friend ChannellingMeasurementInterpreterBase<Metric, channels, ChannellingMeasurementInterpreter<Metric, channels>>;
 	public:
 	/* public types */
 	
@@ -170,12 +249,15 @@ namespace analyzer {
 		class LinearPercentageDeltaConfiguration : public Configuration {
 		private:
 			multiplicator _mult;
+			Metric _delta;   // last result, delta() returns a reference
 		public:
 				/* you have to ensure by your self that value multiplied with percentage won't overflow!
 				   you may used your own promotion type instead of Metric*/
-			LinearPercentageDeltaConfiguration(multiplicator percentage) : _mult(percentage) {}
+			LinearPercentageDeltaConfiguration(multiplicator percentage) : _mult(percentage), _delta(0) {}
 			const Metric& delta(const Metric& value) override {
-				return (   ( PromotedMetric(value<0 ? -value : value) ) * _mult   ) / 100;  
+				SIM_CHARGE(avrcost::mul<PromotedMetric>() + avrcost::div<PromotedMetric>() + avrcost::st<Metric>());
+				_delta = (   ( PromotedMetric(value<0 ? -value : value) ) * _mult   ) / 100;  
+				return _delta;
 			}
 		};
 		template<typename multiplicator>
@@ -199,37 +281,101 @@ namespace analyzer {
 	
 	/* public methods */
 	
-			/* enter a new measured value */
-			/* returns the Channel {0, ... ,channels-1} which matched,
-			   returns NO_CHANNEL if no channel matched and creates a new channel */
-		uint8_t input(const Metric& value);
-		
-			/* return current measurement result */
-			/* never interrupt output by input or vice versa */
-			/* attention: you'll get a reference to the value stored inside the CMI
-			   if you update the value indirectly via an input(..) the value behind
-			   your reference will be updated too and will be the new correct output. */
-		inline const Metric& output(){ return _ch[0].get_average(); }
-			
 			/* create a CMI with all channels invalid
 			   attention: you have to provide a Configuration object */
 		ChannellingMeasurementInterpreter(Configuration& configuration) : configuration(&configuration) {}
-			
-		ChannellingMeasurementInterpreter(const ChannellingMeasurementInterpreter&) = delete;
-		ChannellingMeasurementInterpreter(ChannellingMeasurementInterpreter&&) = delete;
-		ChannellingMeasurementInterpreter& operator = (const ChannellingMeasurementInterpreter&) = delete;
-		ChannellingMeasurementInterpreter& operator = (ChannellingMeasurementInterpreter&&) = delete;
-		
-			/* makes all channels invalid
-			   you can use it together with config to reset the cmi */
-		inline void invalidate(){
-			for (uint8_t i = 0; i < channels; ++i) _ch[i].invalidate();
-		}
 		
 		inline ~ChannellingMeasurementInterpreter(){
 			// invalidate(); // this should not be needed.
 		}
 		
+	private:
+	/* configuration interface for the base */
+
+		inline Metric delta(const Metric& average){
+			SIM_CHARGE(avrcost::ICALL + avrcost::ld<void*>());
+			return configuration->delta(average);
+		}
+		inline Metric weighted_average(const Metric& average, const Metric& value){
+			SIM_CHARGE(2*avrcost::mul<Metric>() + avrcost::div<Metric>() + 2*avrcost::add<Metric>() + 2*avrcost::ld<Metric>());
+			return (average * configuration->weight_old + value * configuration->weight_new) / configuration->weight_sum();
+		}
+		inline uint8_t reduce_badness(uint8_t badness){
+			SIM_CHARGE(avrcost::MUL_U16 + avrcost::DIV_U16 + avrcost::ld<uint8_t>());
+			return (static_cast<uint16_t>(badness) * static_cast<uint16_t>(configuration->badness_reducer))
+				/ (static_cast<uint16_t>(configuration->badness_reducer) + 3); // <<<<< maybe change the 3 to a bigger number ?
+					// or make this 3 template ??? ... a better solution could be to make the mapping reducer -> actual factor better
+					// maybe change this mapping generally
+		}
+		inline uint8_t initial_badness(){ return configuration->initial_badness; }
+	};
+
+
+		/* CMI with a configuration known at compile time */
+		/* Policy is a type with
+				static constexpr uint8_t weight_old, weight_new;   see Configuration
+				static constexpr uint8_t initial_badness;          see Configuration
+				static constexpr uint8_t badness_reducer;          see Configuration
+				static Metric delta(const Metric& average);        see Configuration::delta
+		   all of it is inlined and folded: there is no virtual call and no pointer.
+		   make weight_old + weight_new and badness_reducer + 3 powers of two,
+		   the compiler replaces the divisions by shifts then.
+		   ConstDeltaPolicy and LinearPercentageDeltaPolicy are ready to use policies. */
+	template <typename Metric, uint8_t channels, typename Policy>
+	class StaticChannellingMeasurementInterpreter
+		: public ChannellingMeasurementInterpreterBase<Metric, channels, StaticChannellingMeasurementInterpreter<Metric, channels, Policy>> {
+		friend ChannellingMeasurementInterpreterBase<Metric, channels, StaticChannellingMeasurementInterpreter<Metric, channels, Policy>>;
+
+		static constexpr uint16_t WEIGHT_SUM { uint16_t(Policy::weight_old) + Policy::weight_new };
+		static constexpr uint16_t BADNESS_DIVISOR { uint16_t(Policy::badness_reducer) + 3 };
+		static_assert(WEIGHT_SUM > 0, "weight_old + weight_new must not be 0");
+
+	public:
+		StaticChannellingMeasurementInterpreter() = default;
+
+	private:
+	/* configuration interface for the base */
+
+		inline Metric delta(const Metric& average){ return Policy::delta(average); }
+		inline Metric weighted_average(const Metric& average, const Metric& value){
+			using metric::weighted_average;   // or the one of the Metric's namespace
+			return weighted_average<Policy::weight_old, Policy::weight_new>(average, value);
+		}
+		inline uint8_t reduce_badness(uint8_t badness){
+			SIM_CHARGE(avrcost::mul_by<uint16_t>(Policy::badness_reducer) + avrcost::div_by<uint16_t>(BADNESS_DIVISOR));
+			return (static_cast<uint16_t>(badness) * uint16_t(Policy::badness_reducer)) / BADNESS_DIVISOR;
+		}
+		inline uint8_t initial_badness(){ return Policy::initial_badness; }
+	};
+
+
+		/* ready to use policies for StaticChannellingMeasurementInterpreter */
+		/* const_delta is converted with Metric(const_delta), for a FixedPoint (fixedpoint.h)
+		   it is the integer part. the policy checks that a difference of delta
+		   can't overflow the weighted average where the Metric knows its range. */
+	template <typename Metric, uint32_t const_delta, uint8_t weight_old_, uint8_t weight_new_,
+	          uint8_t initial_badness_, uint8_t badness_reducer_>
+	struct ConstDeltaPolicy {
+		static constexpr uint8_t weight_old { weight_old_ };
+		static constexpr uint8_t weight_new { weight_new_ };
+		static constexpr uint8_t initial_badness { initial_badness_ };
+		static constexpr uint8_t badness_reducer { badness_reducer_ };
+		static constexpr Metric delta(const Metric&){ return Metric(const_delta); }
+		static_assert(metric::delta_fits(Metric(const_delta), weight_new_, uint16_t(weight_old_) + weight_new_),
+			"delta * weight_new overflows the Metric, use smaller weights, a smaller delta or less fractional bits");
+	};
+
+	template <typename Metric, uint8_t percentage, uint8_t weight_old_, uint8_t weight_new_,
+	          uint8_t initial_badness_, uint8_t badness_reducer_, typename PromotedMetric = Metric>
+	struct LinearPercentageDeltaPolicy {
+		static constexpr uint8_t weight_old { weight_old_ };
+		static constexpr uint8_t weight_new { weight_new_ };
+		static constexpr uint8_t initial_badness { initial_badness_ };
+		static constexpr uint8_t badness_reducer { badness_reducer_ };
+		static Metric delta(const Metric& value){
+			SIM_CHARGE(avrcost::mul_by<PromotedMetric>(percentage) + avrcost::div<PromotedMetric>());
+			return (   ( PromotedMetric(value<0 ? -value : value) ) * percentage   ) / 100;
+		}
 	};
 
 	/* defining synonyms */
@@ -237,30 +383,34 @@ namespace analyzer {
 	template<typename Metric, uint8_t channels>
 	using CMI = ChannellingMeasurementInterpreter<Metric,channels>;
 
+	template<typename Metric, uint8_t channels, typename Policy>
+	using StaticCMI = StaticChannellingMeasurementInterpreter<Metric,channels,Policy>;
+
 
 /************************************************************************/
 /* Function Implementation                                              */
 /************************************************************************/
 
-	template<class Metric, uint8_t channels>
-	inline constexpr ChannellingMeasurementInterpreter<Metric,channels>::Channel::Channel(const Metric& initial_value, const Configuration* config) : _average(initial_value), _badness(config->initial_badness != 255 ? config->initial_badness : 254) {}
-	
-	template<class Metric, uint8_t channels>
-	inline bool ChannellingMeasurementInterpreter<Metric,channels>::Channel::accumulate(const Metric& value, Configuration* config){
+	template<class Metric, uint8_t channels, class Config>
+	inline bool ChannellingMeasurementInterpreterBase<Metric,channels,Config>::Channel::accumulate(const Metric& value, Config& config){
 		if (_badness == 255) return false; // channel invalid
-		if ((value + config->delta(_average)) < _average || (value > _average + config->delta(_average))){
+		const Metric delta = config.delta(_average);
+		SIM_CHARGE(avrcost::ld<Metric>() + 4*avrcost::add<Metric>() + 2*avrcost::BRANCH);
+		if ((value + delta) < _average || (value > _average + delta)){
 				// no match:
 			inc_badness();
 			return false;
 		}
 		// match:
-		_average = (_average * config->weight_old + value * config->weight_new) / config->weight_sum();
+		_average = config.weighted_average(_average, value);
 		dec_badness(config);
+		SIM_CHARGE(avrcost::st<Metric>() + avrcost::st<uint8_t>());
 		return true;
 	}
 	
-	template<class Metric, uint8_t channels>
-	inline void ChannellingMeasurementInterpreter<Metric,channels>::swap_with_previous(uint8_t channel){
+	template<class Metric, uint8_t channels, class Config>
+	inline void ChannellingMeasurementInterpreterBase<Metric,channels,Config>::swap_with_previous(uint8_t channel){
+		SIM_CHARGE(3 * (avrcost::ld<Channel>() + avrcost::st<Channel>()));
 		Channel swap { _ch[channel] };
 		_ch[channel] = _ch[channel-1];
 		_ch[channel-1] = swap;
@@ -269,19 +419,28 @@ namespace analyzer {
 		/* but there is no function like memcpy doing this in the standard library */
 	}
 	
-	template<class Metric, uint8_t channels>
-	inline void ChannellingMeasurementInterpreter<Metric,channels>::smart_sort(uint8_t channel){
+	template<class Metric, uint8_t channels, class Config>
+	inline void ChannellingMeasurementInterpreterBase<Metric,channels,Config>::smart_sort(uint8_t channel){
 		while ((channel != 0) && (_ch[channel] < _ch[channel-1])){
 			swap_with_previous(channel);
 			--channel;
 		}
 	}
 	
-	template<class Metric, uint8_t channels>
-	uint8_t ChannellingMeasurementInterpreter<Metric,channels>::input(const Metric& value){
+	template<class Metric, uint8_t channels, class Config>
+	void ChannellingMeasurementInterpreterBase<Metric,channels,Config>::input_batch(const Metric* in, size_t n, Metric* out, uint8_t* matched){
+		for (size_t i = 0; i < n; ++i){
+			uint8_t m = input(in[i]);
+			if (matched) matched[i] = m;
+			if (out) out[i] = output();
+		}
+	}
+
+	template<class Metric, uint8_t channels, class Config>
+	uint8_t ChannellingMeasurementInterpreterBase<Metric,channels,Config>::input(const Metric& value){
 		uint8_t i;
 		for (i = 0; i<channels; ++i){ // go through all channels and try to accumulate new value
-			if (_ch[i].accumulate(value,configuration)) {
+			if (_ch[i].accumulate(value,config())) {
 				uint8_t matched_channel {i};
 				smart_sort(i); // i was updated and got 'better' so it might need to be pushed to the left.
 				++i; // skip the current (matching) channel
@@ -295,11 +454,11 @@ namespace analyzer {
 		// no_match: // applies if the value did not match any of the channels
 		//ch[channels-1].~Channel(); // empty d-tor
 		///new (&ch[channels-1]) Channel(value, configuration); // replace the worst channel in array by a new channel
-		_ch[channels-1] = Channel(value, configuration); // replace the worst channel in array by a new channel
+		_ch[channels-1] = Channel(value, config().initial_badness()); // replace the worst channel in array by a new channel
 		smart_sort(channels-1); // maybe the new channel is not the worst
 		return NO_CHANNEL;
 	}
 	
 }
 
-#endif /* F_CMI_H_ */
\ No newline at end of file
+#endif /* F_CMI_H_ */
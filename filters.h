@@ -0,0 +1,323 @@
+/*
+ * filters.h
+ *
+ * smoothing filters for the readout of the ultrasonic sensor.
+ * all of them are templates with compile time parameters, so the compiler can
+ * pick the smallest integer types and replace divisions by shifts where possible.
+ * a Pipeline chains them, e.g.
+ *   filter::Pipeline<filter::RunningMedian<5>, filter::MovingAverage<4>> smoothing;
+ *   distance = smoothing.input(readout);
+ */
+
+#ifndef __filters_h__
+#define __filters_h__
+
+#include <stdint.h>
+
+#ifndef SIM_CHARGE
+#define SIM_CHARGE(cycles)  // cycle cost annotation for the host simulator, see mydefs.h
+#endif
+
+namespace filter {
+
+	/* compile time helpers (there is no <type_traits> for avr-gcc) */
+	template <bool condition, typename A, typename B> struct conditional { using type = A; };
+	template <typename A, typename B> struct conditional<false, A, B> { using type = B; };
+
+	constexpr bool is_power_of_two(uint32_t x){ return x && !(x & (x - 1)); }
+	constexpr uint8_t log2(uint32_t x){ return x > 1 ? 1 + log2(x >> 1) : 0; }
+
+		/* smallest unsigned type that can hold max */
+	template <uint32_t max>
+	using uint_for = typename conditional<(max <= 0xFF), uint8_t,
+	                 typename conditional<(max <= 0xFFFF), uint16_t, uint32_t>::type>::type;
+
+
+		/* moving average over the last 'length' values
+		   keeps a running sum: each input subtracts the evicted value and adds
+		   the new one, so the cost does not depend on the window length.
+		   max_value is the largest value passed to input(), it selects the type
+		   of the sum. power-of-two lengths divide by a shift. */
+	template <uint8_t length, uint16_t max_value = 0xFFFF>
+	class MovingAverage {
+		static_assert(length >= 1, "window too short");
+	public:
+		using Sum = uint_for<uint32_t(length) * max_value>;
+
+		MovingAverage() : _window{}, _idx(0), _sum(0) {}
+
+			/* add a new value, returns the new average */
+		uint16_t input(uint16_t value){
+			_sum -= _window[_idx];
+			_sum += value;
+			_window[_idx] = value;
+			if (++_idx == length) _idx = 0;
+			SIM_CHARGE(2*avrcost::ld<uint16_t>() + avrcost::st<uint16_t>() + avrcost::ld<Sum>() + avrcost::st<Sum>()
+			           + 2*avrcost::add<Sum>() + 6);
+			return output();
+		}
+
+			/* average of the window. the window starts filled with zeros */
+		uint16_t output() const {
+			SIM_CHARGE(is_power_of_two(length) ? avrcost::shift<Sum>(log2(length)) : avrcost::div<Sum>());
+			return is_power_of_two(length) ? _sum >> log2(length) : _sum / length;
+		}
+
+	private:
+		uint16_t _window[length];
+		uint8_t _idx;       // position of the oldest value
+		Sum _sum;
+	};
+
+
+		/* weighted average of the previous output and the new value
+		   (old_percentage : 100 - old_percentage). keeps output * 100, so the
+		   rounding error doesn't pile up. WeightedAverageOf takes the percentage
+		   from OldPercentage::value(), e.g. a variable that can change at run time
+		   (0..100) */
+	template <typename OldPercentage>
+	class WeightedAverageOf {
+	public:
+		WeightedAverageOf() : _sum(0) {}
+
+			/* add a new value, returns the new average */
+		uint16_t input(uint16_t value){
+			uint8_t old_percentage = OldPercentage::value();
+			_sum = _sum * old_percentage / 100 + static_cast<uint32_t>(value) * (100 - old_percentage);
+			SIM_CHARGE(2*avrcost::MUL_U32 + 2*avrcost::DIV_U32 + 2*avrcost::ld<uint32_t>() + 2*avrcost::st<uint32_t>());
+			return output();
+		}
+
+		uint16_t output() const { return _sum / 100; }
+
+	private:
+		uint32_t _sum;      // average * 100
+	};
+
+	template <uint8_t old_percentage>
+	struct Percentage {
+		static_assert(old_percentage <= 100, "old_percentage is a percentage");
+		static constexpr uint8_t value(){ return old_percentage; }
+	};
+
+	template <uint8_t old_percentage>
+	using WeightedAverage = WeightedAverageOf<Percentage<old_percentage>>;
+
+
+		/* running median of the last 'length' values (odd)
+		   keeps the window twice: in the order of arrival, to know which value
+		   drops out, and sorted. each input looks the evicted value up in the
+		   sorted one and moves the gap to the place of the new value, no sort.
+		   the cost only depends on the window length and on how far apart the
+		   evicted and the new value are. a spike of up to length / 2 readouts
+		   doesn't get through. the window starts filled with zeros. */
+	template <uint8_t length>
+	class RunningMedian {
+		static_assert(length >= 1 && (length & 1), "window must have an odd length");
+	public:
+		RunningMedian() : _window{}, _sorted{}, _idx(0) {}
+
+			/* add a new value, returns the new median */
+		uint16_t input(uint16_t value){
+			uint16_t old = _window[_idx];
+			_window[_idx] = value;
+			if (++_idx == length) _idx = 0;
+
+			uint8_t i = 0;
+			while (_sorted[i] != old) ++i;   // it is in there
+			uint8_t found = i;
+			while (i > 0 && _sorted[i - 1] > value){
+				_sorted[i] = _sorted[i - 1];
+				--i;
+			}
+			while (i < length - 1 && _sorted[i + 1] < value){
+				_sorted[i] = _sorted[i + 1];
+				++i;
+			}
+			_sorted[i] = value;
+			uint8_t moved = i > found ? i - found : found - i;
+			(void)moved;   // for SIM_CHARGE only
+			SIM_CHARGE(2*avrcost::ld<uint16_t>() + 3*avrcost::st<uint16_t>() + avrcost::BRANCH + 6
+			           + found*(avrcost::ld<uint16_t>() + avrcost::add<uint16_t>() + avrcost::LOOP)
+			           + (moved + 2)*(2*avrcost::ld<uint16_t>() + avrcost::st<uint16_t>() + avrcost::add<uint16_t>() + avrcost::LOOP));
+			return output();
+		}
+
+		uint16_t output() const { return _sorted[length / 2]; }
+
+	private:
+		uint16_t _window[length];
+		uint16_t _sorted[length];
+		uint8_t _idx;       // position of the oldest value
+	};
+
+
+		/* alpha-beta tracker: estimates the distance and its change per readout
+		   (velocity) and corrects both by the difference of the readout to the
+		   prediction, times alpha = 2^-alpha_shift and beta = 2^-beta_shift. no
+		   multiplications, no divisions. on a ramp the lag dies out once the
+		   velocity is learnt (after some 2^beta_shift readouts), unlike behind an
+		   average; shorter slides keep some of it. about critically damped are the shifts 1/3, 2/5, 3/7
+		   (beta = alpha^2 / (2 - alpha)), smaller gains smooth more and follow slower.
+		   the output is extrapolated 'lead' readouts ahead, to make up for what
+		   delays the pitch after the filter (tone::Glide).
+		   a readout more than 'gate' off the prediction is clamped to the gate and
+		   leaves the velocity alone, so a spike moves the output by gate * alpha at
+		   most. 'misses' of them in a row are a jump of the hand: the tracker starts
+		   over at the last one. hold() is for timeouts: the velocity is dropped, so
+		   the output stays where it is, and the next readout off the gate is taken
+		   at once.
+		   distance and velocity are 16 bit fixed point, the fractional bits follow
+		   from max_value (the largest readout) and the gate */
+	template <uint8_t alpha_shift, uint8_t beta_shift, uint8_t lead, uint16_t gate, uint8_t misses, uint16_t max_value>
+	class Tracker {
+		static constexpr uint32_t RANGE { max_value + (lead + 2) * uint32_t(gate) };   // the output, the prediction and a gate off
+		static_assert(alpha_shift >= 1 && beta_shift > alpha_shift, "gains too high for a stable tracker");
+		static_assert(RANGE < 0x4000 && gate > 0 && misses >= 1, "readouts too long for the 16 bit tracker");
+		static constexpr uint8_t FRAC { static_cast<uint8_t>(14 - log2(RANGE)) };                 // of the distance
+		static constexpr uint8_t VFRAC_MAX { static_cast<uint8_t>(14 - log2(uint32_t(gate) << FRAC)) };
+		static constexpr uint8_t VFRAC { VFRAC_MAX < beta_shift ? VFRAC_MAX : beta_shift };     // more of the velocity
+		static constexpr int16_t GATE { static_cast<int16_t>(gate << FRAC) };
+		static constexpr int16_t MAX_V { static_cast<int16_t>(GATE << VFRAC) };   // a gate per readout
+	public:
+		Tracker() : _x(0), _v(0), _misses(misses - 1) {}   // the first readout off the gate is taken at once
+
+			/* add a new value, returns the new estimate */
+		uint16_t input(uint16_t value){
+			int16_t in = static_cast<int16_t>(value << FRAC);
+			int16_t predicted = _x + (_v >> VFRAC);
+			int16_t r = in - predicted;
+			SIM_CHARGE(avrcost::ld<int16_t>() * 2 + avrcost::shift<int16_t>(FRAC) + avrcost::shift<int16_t>(VFRAC)
+			           + 2*avrcost::add<int16_t>() + 2*avrcost::BRANCH);
+			if (r > GATE || r < -GATE){
+				if (++_misses >= misses){   // the hand is somewhere else
+					_x = in;
+					_v = 0;
+					_misses = 0;
+					SIM_CHARGE(2*avrcost::st<int16_t>() + avrcost::st<uint8_t>() + 4);
+					return output();
+				}
+				r = r > 0 ? int16_t(GATE) : int16_t(-GATE);
+				SIM_CHARGE(avrcost::st<uint8_t>() + avrcost::BRANCH + 2);
+			} else {
+				_misses = 0;
+				_v += r >> (beta_shift - VFRAC);
+				if (_v > MAX_V) _v = MAX_V;
+				if (_v < -MAX_V) _v = -MAX_V;
+				SIM_CHARGE(avrcost::shift<int16_t>(beta_shift - VFRAC) + 3*avrcost::add<int16_t>() + 2*avrcost::BRANCH
+				           + avrcost::st<int16_t>() + avrcost::st<uint8_t>());
+			}
+			_x = predicted + (r >> alpha_shift);
+			SIM_CHARGE(avrcost::shift<int16_t>(alpha_shift) + avrcost::add<int16_t>() + avrcost::st<int16_t>());
+			return output();
+		}
+
+			/* estimate 'lead' readouts ahead, rounded, within [0, max_value) */
+		uint16_t output() const {
+			int16_t y = _x + lead * (_v >> VFRAC) + (1 << (FRAC - 1));
+			SIM_CHARGE(avrcost::ld<int16_t>() + avrcost::shift<int16_t>(VFRAC) + avrcost::mul_by<int16_t>(lead)
+			           + 2*avrcost::add<int16_t>() + 2*avrcost::BRANCH + avrcost::shift<int16_t>(FRAC));
+			if (y < 0) return 0;
+			uint16_t out = static_cast<uint16_t>(y) >> FRAC;
+			return out < max_value ? out : max_value - 1;
+		}
+
+			/* no readout (timeout) */
+		void hold(){
+			_v = 0;
+			_misses = misses - 1;
+			SIM_CHARGE(avrcost::st<int16_t>() + avrcost::st<uint8_t>());
+		}
+
+	private:
+		int16_t _x;         // distance << FRAC
+		int16_t _v;         // velocity per readout << (FRAC + VFRAC)
+		uint8_t _misses;    // outliers in a row
+	};
+
+
+		/* the CMI (cmi.h) as a filter. Convert maps the readouts to the Metric of
+		   the Analyzer and back, see IntegerPart and Shifted. channel() is the
+		   one the last readout went into (or NO_CHANNEL), for the debug output */
+	constexpr uint8_t NO_CHANNEL { 0xFF };   // like telemetry::NO_CHANNEL
+
+	template <typename Metric>
+	struct IntegerPart {   // FixedPoint (fixedpoint.h)
+		static Metric to(uint16_t value){ return Metric(value); }
+		static uint16_t from(const Metric& value){ return value.integer(); }
+	};
+
+	template <uint8_t shift>
+	struct Shifted {       // integers with 'shift' fractional bits
+		static uint32_t to(uint16_t value){ return static_cast<uint32_t>(value) << shift; }
+		static uint16_t from(uint32_t value){ return value >> shift; }
+	};
+
+	template <typename Analyzer, typename Convert>
+	class CmiStage {
+	public:
+		CmiStage() : _channel(NO_CHANNEL) {}
+
+		uint16_t input(uint16_t value){
+			_channel = _analyzer.input(Convert::to(value));
+			SIM_CHARGE(avrcost::st<uint8_t>());
+			return Convert::from(_analyzer.output());
+		}
+
+		uint8_t channel() const { return _channel; }
+
+	private:
+		Analyzer _analyzer;
+		uint8_t _channel;
+	};
+
+
+		/* filters in a row, each one gets the output of the one before.
+		   a stage is anything with a default constructor and uint16_t input(uint16_t)
+		   that returns its new output: all filters above and pipelines themselves.
+		   the stages are (base class) members, no pointers, no virtual calls, so
+		   the compiler inlines the whole chain and its cycles can be counted as one.
+		   Pipeline<> passes the readouts through and takes no RAM. channel() is the
+		   one of the first stage that has one */
+	template <typename... Stages> class Pipeline;
+
+	template <>
+	class Pipeline<> {
+	public:
+		uint16_t input(uint16_t value){ return value; }
+		uint8_t channel() const { return NO_CHANNEL; }
+		void hold(){}
+	};
+
+	template <typename First, typename... Rest>
+	class Pipeline<First, Rest...> : private Pipeline<Rest...> {
+		using Next = Pipeline<Rest...>;
+	public:
+		uint16_t input(uint16_t value){ return Next::input(_first.input(value)); }
+
+		uint8_t channel() const {
+			uint8_t c = channel_of(_first, 0);
+			return c != NO_CHANNEL ? c : Next::channel();
+		}
+
+		void hold(){
+			hold_of(_first, 0);
+			Next::hold();
+		}
+
+	private:
+		template <typename Stage>   // picked if Stage has a channel()
+		static auto channel_of(const Stage& stage, int) -> decltype(stage.channel()){ return stage.channel(); }
+		template <typename Stage>
+		static uint8_t channel_of(const Stage&, long){ return NO_CHANNEL; }
+		template <typename Stage>   // picked if Stage has a hold()
+		static auto hold_of(Stage& stage, int) -> decltype(stage.hold()){ stage.hold(); }
+		template <typename Stage>
+		static void hold_of(Stage&, long){}
+
+		First _first;
+	};
+
+}
+
+#endif
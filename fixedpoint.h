@@ -0,0 +1,110 @@
+/*
+ * fixedpoint.h
+ *
+ * unsigned fixed point numbers with a range known at compile time.
+ *
+ * FixedPoint<int_bits, frac_bits, Storage> keeps value * 2^frac_bits in
+ * Storage, using the lowest int_bits + frac_bits bits of it. addition and
+ * subtraction saturate at the ends of the range instead of wrapping around,
+ * so comparisons like (value + delta < average) stay right at the top end.
+ * it is meant as Metric for the CMI (cmi.h): with a readout of 12 bits and
+ * 4 fractional bits the whole filter runs on 16 bit numbers instead of
+ * uint32_t with manual shifts.
+ */
+
+#ifndef __fixedpoint_h__
+#define __fixedpoint_h__
+
+#include <stdint.h>
+#include "filters.h"
+
+#ifndef SIM_CHARGE
+#define SIM_CHARGE(cycles)  // cycle cost annotation for the host simulator, see mydefs.h
+#endif
+
+namespace fixedpoint {
+
+	constexpr uint32_t mask(uint8_t bits){ return bits >= 32 ? 0xFFFFFFFF : (uint32_t(1) << bits) - 1; }
+
+	template <uint8_t int_bits, uint8_t frac_bits, typename Storage = filter::uint_for<mask(int_bits + frac_bits)>>
+	class FixedPoint {
+		static_assert(Storage(-1) > Storage(0), "Storage must be unsigned");
+		static_assert(int_bits + frac_bits <= 8 * sizeof(Storage), "Storage too small for int_bits + frac_bits");
+	public:
+		using Raw = Storage;
+		static constexpr uint8_t INT_BITS { int_bits };
+		static constexpr uint8_t FRAC_BITS { frac_bits };
+		static constexpr Storage MAX_RAW { Storage(mask(int_bits + frac_bits)) };
+
+			/* zero */
+		constexpr FixedPoint() : _raw(0) {}
+
+			/* from an integer, saturates at the largest integer part */
+		explicit constexpr FixedPoint(Storage integer)
+			: _raw(integer > (MAX_RAW >> frac_bits) ? MAX_RAW : Storage(integer << frac_bits)) {}
+
+		static constexpr FixedPoint from_raw(Storage raw){ return FixedPoint(raw, 0); }
+
+		constexpr Storage raw() const { return _raw; }
+		constexpr Storage integer() const { return _raw >> frac_bits; }
+
+		friend FixedPoint operator + (const FixedPoint& a, const FixedPoint& b){
+			SIM_CHARGE(2*avrcost::add<Storage>() + avrcost::BRANCH);
+			return from_raw(a._raw > MAX_RAW - b._raw ? MAX_RAW : Storage(a._raw + b._raw));
+		}
+		friend FixedPoint operator - (const FixedPoint& a, const FixedPoint& b){
+			SIM_CHARGE(2*avrcost::add<Storage>() + avrcost::BRANCH);
+			return from_raw(a._raw < b._raw ? 0 : Storage(a._raw - b._raw));
+		}
+
+			/* a * factor, saturating */
+		template <uint8_t factor>
+		FixedPoint mul_sat() const {
+			SIM_CHARGE(avrcost::mul_by<Storage>(factor) + avrcost::add<Storage>() + avrcost::BRANCH);
+			return from_raw(_raw > MAX_RAW / (factor ? factor : 1) ? MAX_RAW : Storage(_raw * factor));
+		}
+
+		friend constexpr bool operator <  (const FixedPoint& a, const FixedPoint& b){ return a._raw <  b._raw; }
+		friend constexpr bool operator >  (const FixedPoint& a, const FixedPoint& b){ return a._raw >  b._raw; }
+		friend constexpr bool operator <= (const FixedPoint& a, const FixedPoint& b){ return a._raw <= b._raw; }
+		friend constexpr bool operator >= (const FixedPoint& a, const FixedPoint& b){ return a._raw >= b._raw; }
+		friend constexpr bool operator == (const FixedPoint& a, const FixedPoint& b){ return a._raw == b._raw; }
+		friend constexpr bool operator != (const FixedPoint& a, const FixedPoint& b){ return a._raw != b._raw; }
+
+	private:
+		constexpr FixedPoint(Storage raw, int) : _raw(raw) {}
+
+		Storage _raw;
+	};
+
+
+	/* hooks for the StaticCMI (cmi.h), found by argument dependent lookup */
+
+		/* (average * weight_old + value * weight_new) / (weight_old + weight_new)
+		   as multiply-accumulate on the difference: average +- |value - average| * weight_new / sum.
+		   only the difference is multiplied, so it stays in Storage as long as
+		   fits_weighted_average() holds for the largest difference (the CMI's delta).
+		   larger differences saturate. rounds like the integer formula (down). */
+	template <uint8_t weight_old, uint8_t weight_new, uint8_t int_bits, uint8_t frac_bits, typename Storage>
+	inline FixedPoint<int_bits, frac_bits, Storage> weighted_average(const FixedPoint<int_bits, frac_bits, Storage>& average,
+	                                                                 const FixedPoint<int_bits, frac_bits, Storage>& value){
+		using F = FixedPoint<int_bits, frac_bits, Storage>;
+		constexpr Storage SUM { Storage(uint16_t(weight_old) + weight_new) };
+		static_assert(weight_new <= SUM, "weight_new larger than the weight sum");
+		SIM_CHARGE(avrcost::div_by<Storage>(SUM) + avrcost::BRANCH);
+		if (value >= average){
+			return average + F::from_raw((value - average).template mul_sat<weight_new>().raw() / SUM);
+		}
+		// round down like the integer formula: subtract the rounded up step
+		return average - F::from_raw(((average - value).template mul_sat<weight_new>() + F::from_raw(SUM - 1)).raw() / SUM);
+	}
+
+		/* true if a difference of up to delta can't saturate weighted_average() */
+	template <uint8_t int_bits, uint8_t frac_bits, typename Storage>
+	constexpr bool fits_weighted_average(const FixedPoint<int_bits, frac_bits, Storage>& delta, uint8_t weight_new, uint16_t weight_sum){
+		return uint32_t(delta.raw()) * weight_new + weight_sum - 1 <= FixedPoint<int_bits, frac_bits, Storage>::MAX_RAW;
+	}
+
+}
+
+#endif
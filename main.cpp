@@ -2,25 +2,142 @@
 #define F_CPU 1000000UL // or whatever may be your frequency
 #endif
 
+// system clock: the oscillator the fuses select (CLOCK_SOURCE: the internal RC oscillator,
+// 8MHz, or the PLL, 16MHz with CKSEL=0001) through the clock prescaler. the factory fuses
+// (CKDIV8) start it at 1/8, 1MHz. with SET_CLOCK (or from the command line, -DSET_CLOCK)
+// init() sets the prescaler to CLOCK_SOURCE / F_CPU, so -DF_CPU=8000000UL runs at 8MHz
+// without touching the fuses. all times below follow from F_CPU
+//#define SET_CLOCK
+#ifndef CLOCK_SOURCE
+#define CLOCK_SOURCE (F_CPU > 8000000UL ? 16000000UL : 8000000UL)
+#endif
+
 // uncomment at most on of the following lines for smoothing of the US readout
+// (or select one from the command line, e.g. -DSMOOTH_CMI, as the simulator does)
+#if !defined(SMOOTH_CMI) && !defined(SMOOTH_AVR) && !defined(SMOOTH_MOVING_AVR) && !defined(SMOOTH_MEDIAN) && !defined(SMOOTH_TRACKER) && !defined(SMOOTH_NONE)
 //#define SMOOTH_CMI      // channeling measurement interpreter by @Necktschnagge
 //#define SMOOTH_AVR      // weighted average
 #define SMOOTH_MOVING_AVR // moving average
+//#define SMOOTH_MEDIAN     // running median, then a short moving average
+//#define SMOOTH_TRACKER    // alpha-beta tracker, follows the hand with the least lag
+//#define SMOOTH_NONE       // raw readout
+#endif
 
 
 
+// resolution of the echo timing, the prescaler of Timer0, and the playing range in its ticks:
+// see timing.h (or select one from the command line, e.g. -DTIMING_MODE=TIMING_FINE). all
+// times in timer ticks below follow from it
+#include "timing.h"
+// the ping rate, the glide and the settings of the SMOOTH_ modes, shared with sim/replay
+#include "settings.h"
+
+// sound (or select one from the command line, e.g. -DSYNTH_MODE=SYNTH_DDS)
+//   SYNTH_SQUARE  square wave straight from Timer1, OC1A and !OC1A toggle
+//   SYNTH_DDS     wavetable synthesis (see synth.h): Timer1 runs from the PLL as 8 bit PWM,
+//                 its overflow ISR computes every sample. needs F_CPU >= 8MHz
+#define SYNTH_SQUARE 0
+#define SYNTH_DDS    1
+#ifndef SYNTH_MODE
+#define SYNTH_MODE SYNTH_SQUARE
+#endif
+#if SYNTH_MODE == SYNTH_DDS && F_CPU < 8000000UL
+	#error "SYNTH_DDS needs F_CPU >= 8MHz, at 1MHz a sample period is only 32 cycles"
+#elif SYNTH_MODE != SYNTH_DDS && SYNTH_MODE != SYNTH_SQUARE
+	#error "SYNTH_MODE must be SYNTH_SQUARE or SYNTH_DDS"
+#endif
+
+// number of HC-SR04 modules (or select one from the command line, e.g. -DSENSORS=2)
+//   1  pitch
+//   2  pitch and volume (the duty cycle of OC1A, see VOLUME_STEPS). the second module
+//      takes the pins of NEGOUT (its TRIGGER, the speaker goes between B1 and GND) and
+//      TxD (its ECHO): no serial output, and SYNTH_SQUARE only. the two take turns,
+//      see TIMER0_COMPB_vect
+#ifndef SENSORS
+#define SENSORS 1
+#endif
+#if SENSORS == 2 && SYNTH_MODE == SYNTH_DDS
+	#error "the volume sensor needs SYNTH_SQUARE, DDS has no duty cycle to spare"
+#elif SENSORS != 1 && SENSORS != 2
+	#error "SENSORS must be 1 or 2, there are no more free pins"
+#endif
+
+// tuning at run time (or select it from the command line, -DPARAMETERS): the parameters
+// below (PARAM_...) are kept in the EEPROM and can be read and set over a serial line
+// into NEGOUT (RxD, the speaker goes between B1 and GND), see params.h and
+// showdata.py --param. a byte that comes in blocks all interrupts for about 1ms, the
+// echo that is measured meanwhile is lost
+//#define PARAMETERS
+#if defined(PARAMETERS) && SENSORS > 1
+	#error "the second sensor takes the pin of the serial input"
+#elif defined(PARAMETERS) && TIMER0_PRESCALE == TIMING_FINE
+	#error "receiving a byte takes longer than a round of Timer0, it needs TIMING_COARSE"
+#endif
+
+// bits per second of the telemetry (and the parameters), showdata.py --baud. the send ISR
+// takes ~60 cycles a bit: up to 9600 at 1MHz, 38400 (57600 without SYNTH_DDS) at 8MHz
+#ifndef BAUDRATE
+#define BAUDRATE 9600
+#endif
+// how far an edge of the serial output may be off, in % of a bit (make simcheck fails on more):
+// the receiver samples in the middle of a bit, the rest is left for the clocks. the ISRs below
+// disable interrupts for less than a fifth of a bit, one after the other they keep compare A
+// waiting for a quarter at most. the rounding to Timer0 ticks comes on top
+#ifndef MAXBITERROR
+#define MAXBITERROR 30
+#endif
+#define TxDMaxDelay (F_CPU / BAUDRATE / 4)
 #define TxDBit BIT(4)   // needs to be defined before including myserial.h
+#define TxDInterrupt    // send in the background with Timer0 compare A (Timer0 runs all the time)
+#define TxDBufferSize 16   // a telemetry frame starts with up to 10 bytes at once
+#define TxDWaitWhenFull    // the main loop waits rather than break a frame
+#define TxDTimerPrescale TIMER0_PRESCALE
+#if TIMER0_PRESCALE == TIMING_FINE
+#define TxDOverflow timer0_overflow   // while sending, the send ISR counts the overflows of Timer0
+inline void timer0_overflow();
+#endif
+//#define PROFILING PROBE_FILTER   // time one of the probes below, sent via UART on request (see profile.h and showdata.py --profile)
+// the request comes in on NEGOUT like the parameters (RxD, the speaker goes between B1 and
+// GND). without PARAMETERS PCINT0_vect only stamps the edges and the main loop tells it
+// from them (serve_profile_request()), nothing blocks, so it works with TIMING_FINE as well
+#if defined(PROFILING) && !defined(PARAMETERS)
+#define PROFILE_REQUEST
+#endif
+#if defined(PARAMETERS) || defined(PROFILE_REQUEST)
+#define RxDBit BIT(0)      // NEGOUT
+#endif
+#ifdef PARAMETERS
+#define RxDLatency 40      // cycles from the start bit to recv_byte(): interrupt response and PCINT0_vect up to there
+#endif
 
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include "mydefs.h"
 #include "myserial.h"
+#ifdef PARAMETERS
+	#include "params.h"
+#endif
 #ifdef SMOOTH_CMI
 	#include "cmi.h"
+	#include "fixedpoint.h"
+#endif
+#include "filters.h"
+#include "ringbuf.h"
+#include "tone.h"
+#include "scale.h"
+#if SYNTH_MODE == SYNTH_DDS
+	#include "synth.h"
 #endif
 
-//#define DEBUG_OUTPUT  // send current distance via UART
+#define PROFILE_CLOCK() profile_clock()
+inline uint16_t profile_clock();
+#include "profile.h"
+
+//#define DEBUG_OUTPUT  // send readouts via UART as telemetry frames (see showdata.py), always on with SMOOTH_CMI
+//#define TRACE_OUTPUT  // send raw readouts with time stamps instead, for sim/replay (showdata.py --trace FILE)
 
 
 // wireing for this project. don't confuse port/bit and pin!
@@ -28,70 +145,462 @@
 #define NEGOUT  BIT(0)
 #define TRIGGER BIT(2)
 #define ECHO    BIT(3)
+#define TRIGGER2 NEGOUT   // SENSORS 2
+#define ECHO2    TxDBit
 // already defined: TxDBit BIT(4)
 
 
-constexpr uint8_t MAX_ECHO_HIGH{ 0x0B };
-constexpr uint16_t DIST_OCT{ (MAX_ECHO_HIGH/2) << 8 };     // distance per octave
+#ifdef SET_CLOCK
+constexpr uint8_t CLOCK_PRESCALE{ filter::log2(CLOCK_SOURCE / F_CPU) };   // CLKPS3..0
+static_assert((CLOCK_SOURCE >> CLOCK_PRESCALE) == F_CPU && CLOCK_PRESCALE <= 8, "F_CPU must be CLOCK_SOURCE / 2^n, n <= 8");
+#endif
+
+constexpr uint16_t ISR_TICKS{ 64 / TIMER0_PRESCALE };      // an ISR needs this long to schedule the next compare match
+
+// distance -> tone registers. the resolution follows from DIST_OCT (see tone.h),
+// pass a shift as third parameter to trade resolution for flash (make simbench)
+using ToneTable = tone::Table<F_CPU, MAX_DISTANCE, DIST_OCT>;
+constexpr ToneTable tone_table PROGMEM {};
+
+// musical scales (see scale.h). the position of the hand during the first
+// SCALE_SELECT_PINGS pings after power-up selects the scale: the playing range
+// is split into NO_SCALES zones, the closest one is SCALE_LINEAR (as above).
+// without a hand SCALE_LINEAR is used.
+enum : uint8_t { SCALE_LINEAR, SCALE_CONTINUOUS, SCALE_CHROMATIC, SCALE_MAJOR, SCALE_MINOR, SCALE_PENTATONIC, NO_SCALES };
+constexpr uint8_t SCALE_SELECT_PINGS{ 64 };
+constexpr uint8_t CONTINUOUS_STEPS{ 4 };   // steps per semitone, 8 would need another 290 bytes of flash
+
+constexpr scale::Table<F_CPU, scale::CHROMATIC, CONTINUOUS_STEPS> continuous_notes PROGMEM {};
+constexpr scale::Table<F_CPU, scale::CHROMATIC>  chromatic_notes  PROGMEM {};
+constexpr scale::Table<F_CPU, scale::MAJOR>      major_notes      PROGMEM {};
+constexpr scale::Table<F_CPU, scale::MINOR>      minor_notes      PROGMEM {};
+constexpr scale::Table<F_CPU, scale::PENTATONIC> pentatonic_notes PROGMEM {};
+constexpr scale::Info scales[NO_SCALES - 1] PROGMEM {   // all but SCALE_LINEAR
+	scale::info(continuous_notes, MAX_DISTANCE),
+	scale::info(chromatic_notes,  MAX_DISTANCE),
+	scale::info(major_notes,      MAX_DISTANCE),
+	scale::info(minor_notes,      MAX_DISTANCE),
+	scale::info(pentatonic_notes, MAX_DISTANCE),
+};
+uint8_t current_scale = SCALE_LINEAR;
+scale::Quantizer quantizer;
 
-constexpr uint8_t OLD_AVR_PERCENTAGE{ 80 };
-constexpr uint8_t NO_AVERAGE{ 20 };
-#ifdef SMOOTH_MOVING_AVR
-	volatile uint16_t avr_window[NO_AVERAGE];
+#if SYNTH_MODE == SYNTH_DDS
+// Timer1 counts PLL_HZ / 2^(DDS_PRESCALE - 1) up to 255: that is the PWM frequency and
+// the sample rate, above hearing. the tone registers from the tables above become a
+// tuning word (synth::step)
+constexpr uint32_t PLL_HZ{ 64000000 };
+constexpr uint8_t DDS_PRESCALE{ 4 };         // CS13..CS10 of TCCR1: PCK / 8
+constexpr uint32_t DDS_SAMPLE_RATE{ PLL_HZ / (1UL << (DDS_PRESCALE - 1)) / 256 };   // 31250 Hz
+constexpr uint16_t DDS_BUDGET{ F_CPU / DDS_SAMPLE_RATE };   // cycles per sample, for all ISRs and the main loop
+constexpr synth::Wave DDS_WAVE{ synth::SINE };   // SINE, TRIANGLE or SOFT_SAW
+constexpr synth::Wavetable<DDS_WAVE> wavetable PROGMEM {};
+synth::Oscillator oscillator;
+#endif
+
+// portamento (see tone::Glide): between two readouts the pitch slides towards the
+// last one with a time constant of about GLIDE_MS (settings.h), 0 jumps. it steps about
+// every GLIDE_TICK_US from the main loop, on whole Timer0 rounds (the main loop wakes up
+// at least once per round), so the pitch moves smoothly however slow the pings are
+constexpr uint16_t GLIDE_TICK_US{ 2000 };
+constexpr uint8_t GLIDE_ROUNDS{ us_to_ticks(GLIDE_TICK_US) / 256 > 1 ? us_to_ticks(GLIDE_TICK_US) / 256 : 1 };
+constexpr uint8_t GLIDE_SHIFT{ filter::log2(uint32_t(GLIDE_MS) * TIMER0_HZ / 1000 * 3 / 2 / (GLIDE_ROUNDS * 256)) };   // 2^shift steps, rounded
+tone::Glide<GLIDE_SHIFT> glide;
+uint8_t glide_high;               // timer0_high at the last step
+
+// volume (SENSORS 2): the hand over the second sensor sets the duty cycle of OC1A,
+// OCR1A = OCR1C >> volume_shift. far away is 50% and the loudest, every step of
+// MAX_DISTANCE / 2^VOLUME_SHIFT closer halves it (a bit less than 6dB), down to
+// a needle at VOLUME_STEPS steps. without a hand it stays where it is
+constexpr uint8_t VOLUME_STEPS{ 6 };
+constexpr uint8_t VOLUME_SHIFT{ filter::log2(MAX_DISTANCE / VOLUME_STEPS) };
+uint8_t volume_shift = 1;
+
+// measurement timing, see TIMER0_COMPB_vect. a ping starts a guard time after
+// the end of the previous echo (so late reflections don't overlap with the next
+// one), but not more often than PING_RATE (settings.h) times per second.
+// while the hand is found again and again (PING_TRACKING) the timeout and the
+// guard follow its distance: the timeout waits for echoes up to 1.5 times the
+// farthest recent one, the guard is as long as the last echo (a reflection
+// between hand and sensor comes back after that time). otherwise (PING_SEARCH)
+// they cover the whole playing range
+constexpr uint16_t PING_GUARD_US{ 2000 };     // PING_SEARCH
+constexpr uint16_t PING_GUARD_MIN_US{ 500 };  // PING_TRACKING
+constexpr uint16_t ECHO_DELAY_US{ 1000 };     // trigger -> start of ECHO is about 0.3..0.5 ms
+constexpr uint8_t TRACK_HITS{ 4 };            // echoes in a row to start tracking
+constexpr uint8_t SEARCH_MISSES{ 2 };         // timeouts in a row to search again
+constexpr uint8_t RATE_REPORT_PINGS{ 64 };    // the achieved rate is reported via telemetry every ... pings
+
+constexpr uint16_t PING_PERIOD_TICKS{ static_cast<uint16_t>(TIMER0_HZ / PING_RATE) };
+constexpr uint16_t PING_GUARD_TICKS{ us_to_ticks(PING_GUARD_US) };
+constexpr uint16_t PING_GUARD_MIN_TICKS{ us_to_ticks(PING_GUARD_MIN_US) };
+constexpr uint16_t PING_TRIGGER_TICKS{ us_to_ticks(20) > ISR_TICKS ? us_to_ticks(20) : ISR_TICKS };   // at least 10 µs, long enough to schedule it
+constexpr uint16_t ECHO_DELAY_TICKS{ us_to_ticks(ECHO_DELAY_US) };
+constexpr uint16_t TRACK_MARGIN_US{ 256 };   // added to the window while tracking
+constexpr uint16_t TRACK_MARGIN{ us_to_ticks(TRACK_MARGIN_US) };
+static_assert(TIMER0_HZ / PING_RATE < 0x10000, "PING_RATE too low for a 16 bit Timer0 period");
+static_assert(uint32_t(ECHO_DELAY_TICKS) + MAX_DISTANCE + PING_GUARD_TICKS < 0x10000, "ping timeout and guard must fit into 16 bit Timer0 ticks");
+static_assert(PING_GUARD_MIN_TICKS >= ISR_TICKS && PING_GUARD_MIN_TICKS <= PING_GUARD_TICKS, "guard too short to schedule it from the ISR");
+
+// with PARAMETERS the measurement reads these instead of the constants above, they are
+// set from the parameters at run time (apply_parameters()). otherwise they are the constants
+#ifdef PARAMETERS
+#define TUNABLE
+#else
+#define TUNABLE constexpr
+#endif
+TUNABLE uint16_t ping_period{ PING_PERIOD_TICKS };
+TUNABLE uint16_t ping_guard{ PING_GUARD_TICKS };
+TUNABLE uint16_t ping_guard_min{ PING_GUARD_MIN_TICKS };
+TUNABLE uint16_t track_margin{ TRACK_MARGIN };
+
+// more than one sensor: they share Timer0 and the pin change interrupt and only one
+// listens at a time, so the edges on the ECHO pins belong to it and a burst of one
+// never ends the echo of another one. each keeps its own guard (against its own late
+// reflections), the next one may trigger CROSS_GUARD_US after the end of the echo of
+// the last one, so the guard of one overlaps with the echo of the next. what still
+// comes over is the reflection of the burst of the last one between its hand and
+// its module, it arrives one echo time after the end of that echo: an echo that ends
+// within CROSS_WINDOW_US of it is dropped. together they get about 1.7 times the
+// pings of a single one (make sim SENSORS=2), waiting for the whole guard would
+// leave them where a single one is
+constexpr uint16_t CROSS_GUARD_US{ 300 };
+constexpr uint16_t CROSS_WINDOW_US{ 64 };
+constexpr uint16_t CROSS_GUARD_TICKS{ us_to_ticks(CROSS_GUARD_US) };
+constexpr uint16_t CROSS_WINDOW_TICKS{ us_to_ticks(CROSS_WINDOW_US) };
+static_assert(CROSS_GUARD_TICKS >= ISR_TICKS, "cross guard too short to schedule it from the ISR");
+
+// the settings of the SMOOTH_ modes are in settings.h, sim/replay takes them from there
+TUNABLE uint8_t avr_percentage{ OLD_AVR_PERCENTAGE };
+volatile uint8_t timer0_high;     // software high byte of the free running Timer0
+
+// state of the measurement of each sensor, see TIMER0_COMPB_vect. only the ISRs of
+// the measurement use it, and they keep each other off
+enum : uint8_t { PING_GUARD, PING_WAIT, PING_TRIGGER, PING_ECHO };
+enum : uint8_t { PING_SEARCH, PING_TRACKING };
+struct Sensor {
+	uint8_t state = PING_GUARD;
+	uint8_t mode = PING_SEARCH;
+	uint8_t streak = 0;           // echoes (PING_SEARCH) or timeouts (PING_TRACKING) in a row
+	bool echo_started = false;
+	uint16_t due = 0;             // Timer0 at the next step
+	uint16_t start = 0;           // Timer0 at the trigger
+	uint16_t echo_start = 0;      // Timer0 at the rising edge of ECHO
+	uint16_t track = 0;           // farthest recent echo, fading out
+	uint16_t timeout{ ECHO_DELAY_TICKS + MAX_DISTANCE };   // trigger -> give up
+	uint16_t guard{ PING_GUARD_TICKS };                    // end of the echo -> next trigger
+};
+Sensor sensors[SENSORS];
+constexpr uint8_t NO_SENSOR{ 0xFF };
+struct SensorPins { uint8_t trigger, echo; };
+constexpr SensorPins sensor_pins[] { { TRIGGER, ECHO }, { TRIGGER2, ECHO2 } };   // pitch, volume
+uint8_t ping_enable_high;         // TIMER0_OVF_vect enables compare B when timer0_high gets there (TIMING_FINE)
+#if SENSORS > 1
+uint16_t ping_ghost;              // Timer0 when the reflection of the last echo is due (CROSS_WINDOW_US)
+#endif
+// what the rate report sends (report_rate()), counted by the ISRs only. every RATE_REPORT_PINGS
+// pings compare B hands a copy over to the main loop, which would otherwise have to take it
+// with interrupts disabled, for longer than the serial output can wait
+struct PingRates {
+	uint8_t count;            // pings since the last rate report
+	uint32_t ticks;           // their total duration
+	uint32_t search_ticks;    // the part of it in PING_SEARCH
+	uint8_t timeouts;         // pings without echo
+	uint8_t lost;             // readouts the main loop was too slow to take
+	uint8_t changes;          // between PING_SEARCH and PING_TRACKING
+};
+PingRates ping_rates;
+RingBuffer<PingRates, 1> rate_reports;
+volatile bool ping_busy;          // the measurement is locked (ping_lock()), PCINT0_vect leaves the edges of ECHO to it
+// the edges of ECHO from the time stamp to echo_edge(), in their order: PCINT0_vect takes a
+// slot together with the time stamp, with interrupts disabled, and fills it in later
+struct PingEdge {
+	uint16_t time;   // Timer0 at the edge
+	uint8_t pins;    // PINB then, EDGE_READY once it is filled in
+};
+constexpr uint8_t PING_EDGES{ 4 };      // a power of two, more than the ISRs nest
+constexpr uint8_t EDGE_READY{ 0x80 };   // there is no PB7
+PingEdge ping_edges[PING_EDGES];
+uint8_t ping_edges_taken;         // slots taken
+uint8_t ping_edges_done;          // slots handled, by the ISR that holds the lock
+
+#ifdef TRACE_OUTPUT   // the UART can't take both
+	#undef DEBUG_OUTPUT
+	telemetry::TraceEncoder<16> trace_output;
+#elif defined(DEBUG_OUTPUT) || (defined(SMOOTH_CMI) && SENSORS == 1)
+	#ifndef DEBUG_OUTPUT
+	#define DEBUG_OUTPUT
+	#endif
+	telemetry::Encoder<16> debug_output;
+#endif
+
+// what PROFILING can time, numbers as sent to showdata.py
+enum : uint8_t {
+	PROBE_PCINT,       // PCINT0_vect at the end of an echo, without the scheduling at the end
+	PROBE_COMPB,       // TIMER0_COMPB_vect, the same
+	PROBE_TIMESTAMP,   // end of an echo: from the time stamp until the readout is queued for the main loop
+	PROBE_FILTER,      // process_echo(): smoothing
+	PROBE_TONE,        // process_echo(): tone mapping and registers
+	PROBE_TELEMETRY,   // process_echo(): debug output
+};
+PROFILE_STATS()
+
+#if SENSORS > 1 && (defined(DEBUG_OUTPUT) || defined(TRACE_OUTPUT) || defined(PROFILING))
+	#error "the second sensor takes the pin of the serial output"
+#endif
+
+#ifdef PROFILING
+volatile bool profile_sending = false;   // asked for the profile ('p'), until it is out (report_profile())
+#endif
+
+// raw echo run times (timer ticks, 0: no echo) from the ISRs to the main loop
+struct Ping {
+	uint16_t echo;
+	#if SENSORS > 1
+	uint8_t sensor;
+	#endif
+	#ifdef TRACE_OUTPUT
+	uint16_t dt;                  // ticks since the previous trigger
+	#endif
+};
+RingBuffer<Ping, 4> echoes;
+#ifdef TRACE_OUTPUT
+uint16_t ping_dt;
 #endif
-volatile uint8_t curr_window_idx=0;
-volatile uint8_t echo_timer_high;
-volatile uint32_t distance=0;
-volatile uint32_t avr_distance=0;
 
 #ifdef SMOOTH_CMI
-using TAnalyzer = analyzer::ChannellingMeasurementInterpreter<uint32_t, 4>;
-TAnalyzer* channelPointer;
+// -DCMI_UINT32 builds the compile time CMI with uint32_t like the run time one (for comparison)
+#if defined(CMI_RUNTIME_CONFIG) || defined(CMI_UINT32)
 constexpr uint8_t fixed_comma_position{ 8 };
+using TDistance = uint32_t;         // distance << fixed_comma_position
+#else
+// readouts are < MAX_DISTANCE (12 bit), 4 fractional bits for the averages: fits into 16 bit
+using TDistance = fixedpoint::FixedPoint<12, 4, uint16_t>;
+static_assert(MAX_DISTANCE <= 0x1000, "readouts don't fit into 12 bit, use a coarser TIMING_MODE");
+#endif
+#ifdef CMI_RUNTIME_CONFIG   // configuration object, can be changed at run time (set up in init())
+struct TAnalyzer : analyzer::ChannellingMeasurementInterpreter<TDistance, 4> {
+	static ConstDeltaConfiguration channelConfig;
+	TAnalyzer() : ChannellingMeasurementInterpreter(channelConfig) {}
+};
+TAnalyzer::ConstDeltaConfiguration TAnalyzer::channelConfig((uint32_t(CMI_WIDTH)) << fixed_comma_position /*channel width*/);
+#else                       // configuration known at compile time, no virtual calls, divisions become shifts
+using TAnalyzer = analyzer::StaticCMI<TDistance, 4,
+	analyzer::ConstDeltaPolicy<TDistance,
+	#ifdef CMI_UINT32
+	                           uint32_t(CMI_WIDTH) << fixed_comma_position /*channel width*/,
+	#else
+	                           CMI_WIDTH /*channel width*/,
+	#endif
+	                           CMI_WEIGHT_OLD, CMI_WEIGHT_NEW, CMI_INITIAL_BADNESS, CMI_BADNESS_REDUCER>>;
+#endif
+#if defined(CMI_RUNTIME_CONFIG) || defined(CMI_UINT32)
+using Cmi = filter::CmiStage<TAnalyzer, filter::Shifted<fixed_comma_position>>;
+#else
+using Cmi = filter::CmiStage<TAnalyzer, filter::IntegerPart<TDistance>>;
+#endif
+#endif
+
+// the smoothing of each SMOOTH_ mode is a pipeline of filters (filters.h), in the
+// order the readouts go through them. other combinations are one more line, e.g.
+// filter::Pipeline<Cmi, filter::MovingAverage<4, MAX_DISTANCE>> (Cmi comes with SMOOTH_CMI)
+#if defined(SMOOTH_CMI)
+using Smoothing = filter::Pipeline<Cmi>;
+#elif defined(SMOOTH_AVR)
+struct AvrPercentage { static uint8_t value(){ return avr_percentage; } };
+using Smoothing = filter::Pipeline<filter::WeightedAverageOf<AvrPercentage>>;
+#elif defined(SMOOTH_MOVING_AVR)
+using Smoothing = filter::Pipeline<filter::MovingAverage<NO_AVERAGE, MAX_DISTANCE>>;
+#elif defined(SMOOTH_MEDIAN)   // drop the spikes, then smooth what is left a little
+using Smoothing = filter::conditional<(MEDIAN_MEAN > 1),
+	filter::Pipeline<filter::RunningMedian<MEDIAN_LENGTH>, filter::MovingAverage<MEDIAN_MEAN, MAX_DISTANCE>>,
+	filter::Pipeline<filter::RunningMedian<MEDIAN_LENGTH>>>::type;
+#elif defined(SMOOTH_TRACKER)
+using Smoothing = filter::Pipeline<filter::Tracker<TRACKER_ALPHA, TRACKER_BETA, TRACKER_LEAD, TRACKER_GATE, TRACKER_MISSES, MAX_DISTANCE>>;
+#else
+using Smoothing = filter::Pipeline<>;
+#endif
+Smoothing smoothing[SENSORS];   // each sensor its own
+
+// OCR0B for the next step of the measurement, 'ticks' after the Timer0 time 'from'. with
+// TIMING_COARSE only compare B counts the overflows, each one before the next: a wait past the
+// next round, or into its last quarter, goes in steps that end a quarter into a round, the last
+// one at the step, or at the next tick but one if it is due already after a long ISR (instead
+// of a round later). matches that come too early are skipped by TIMER0_COMPB_vect
+inline uint8_t ping_match(uint16_t from, uint16_t ticks){
+	uint16_t due = from + ticks;
+	#if TIMER0_PRESCALE != TIMING_FINE
+	uint8_t rounds = (due >> 8) - (from >> 8);
+	uint8_t low = TCNT0;
+	SIM_CHARGE(2*avrcost::add<uint8_t>() + 3*avrcost::BRANCH);
+	if (rounds > 1 || (rounds == 1 && static_cast<uint8_t>(due) >= 0xC0)){
+		return 0x40;
+	}
+	// due or about to be: OCR0B is set a few cycles later, a match TCNT0 already reached waits a round
+	if (static_cast<uint8_t>(low - static_cast<uint8_t>(from)) + 2 > ticks){
+		return low + 2;
+	}
+	#endif
+	SIM_CHARGE(avrcost::add<uint16_t>());
+	return static_cast<uint8_t>(due);
+}
+
+// compare B at 'match' (ping_match(from, ticks)). call with interrupts disabled. compare B would
+// fire every 256 ticks while waiting: with TIMING_FINE TIMER0_OVF_vect only enables it a round
+// before, with TIMING_COARSE it stays on and counts the overflows
+void ping_schedule(uint16_t from, uint16_t ticks, uint8_t match){
+	OCR0B = match;
+	#if TIMER0_PRESCALE == TIMING_FINE
+	uint8_t enable_high = ((from + ticks) >> 8) - 1;
+	ping_enable_high = enable_high;
+	SIM_CHARGE(avrcost::ld<uint8_t>() + avrcost::add<uint16_t>() + 2*avrcost::BRANCH);
+	// that round might have started already, after a long ISR even the one before
+	if (ticks < 0x200 || static_cast<int8_t>(enable_high - timer0_high) <= 0){
+		TIFR = 1<<OCF0B;
+		TIMSK |= 1<<OCIE0B;
+	} else {
+		TIMSK &= ~(1<<OCIE0B);
+	}
+	#else
+	(void)ticks;
+	// an ISR between ping_match() and here may have let TCNT0 get to the match. it would come a
+	// round later, after a second overflow that TOV0 can't tell from the first: the next tick but
+	// one. the flag goes first, a match between the check and clearing it would be lost as well
+	TIFR = 1<<OCF0B;
+	uint8_t low = TCNT0;
+	if (static_cast<uint8_t>(low - static_cast<uint8_t>(from)) >= static_cast<uint8_t>(match - static_cast<uint8_t>(from))){
+		OCR0B = low + 2;
+	}
+	SIM_CHARGE(2*avrcost::add<uint8_t>() + avrcost::BRANCH);
+	TIMSK |= 1<<OCIE0B;
+	#endif
+	SIM_CHARGE(avrcost::st<uint8_t>());
+}
+
+
+#ifdef PARAMETERS
+// the parameters, in the units of their names. the number is the one of showdata.py
+// --param: append new ones and bump PARAMS_VERSION, the EEPROM of the old version is
+// ignored then. the limits keep the static_asserts above true. PARAM_AVR_PERCENTAGE
+// applies to SMOOTH_AVR, the CMI ones to SMOOTH_CMI with CMI_RUNTIME_CONFIG only
+enum : uint8_t { PARAM_PING_RATE, PARAM_GUARD_US, PARAM_GUARD_MIN_US, PARAM_TRACK_MARGIN_US, PARAM_AVR_PERCENTAGE,
+                 PARAM_CMI_WIDTH_US, PARAM_CMI_WEIGHT_OLD, PARAM_CMI_BADNESS, PARAM_CMI_REDUCER, NO_PARAMS };
+constexpr uint8_t PARAMS_VERSION{ 1 };
+constexpr uint16_t MIN_PING_RATE{ TIMER0_HZ / 0x10000 + 1 };
+constexpr uint16_t MIN_GUARD_US{ 100 };
+constexpr uint16_t MAX_GUARD_US{ 10000 };
+constexpr uint16_t MAX_DISTANCE_US{ static_cast<uint16_t>(uint32_t(MAX_DISTANCE) * 1000 / (TIMER0_HZ / 1000)) };
+static_assert(us_to_ticks(MIN_GUARD_US) >= ISR_TICKS, "guard too short to schedule it from the ISR");
+static_assert(uint32_t(ECHO_DELAY_TICKS) + MAX_DISTANCE + us_to_ticks(MAX_GUARD_US) < 0x10000, "ping timeout and guard must fit into 16 bit Timer0 ticks");
+constexpr params::Info parameter_info[NO_PARAMS] PROGMEM {
+	// initial           min            max
+	{ PING_RATE,         MIN_PING_RATE, 1000 },
+	{ PING_GUARD_US,     MIN_GUARD_US,  MAX_GUARD_US },
+	{ PING_GUARD_MIN_US, MIN_GUARD_US,  MAX_GUARD_US },
+	{ TRACK_MARGIN_US,   0,             MAX_DISTANCE_US },
+	{ OLD_AVR_PERCENTAGE, 0,            99 },
+	{ CMI_WIDTH_US,      16,            MAX_DISTANCE_US },
+	{ OLD_AVR_PERCENTAGE, 1,            99 },   // weight_old of 100, the rest is weight_new
+	{ 40,                0,             254 },  // initial_badness
+	{ 9,                 1,             255 },  // badness_reducer
+};
+// the rules between the parameters: the guard after a near hand not longer than the one
+// while searching (the guard is clamped between them), the period of the ping rate not
+// shorter than the guard. a set that breaks them is refused, the answer has the old value
+bool parameters_consistent(const uint16_t* value){
+	return value[PARAM_GUARD_MIN_US] <= value[PARAM_GUARD_US]
+	    && uint32_t(value[PARAM_PING_RATE]) * value[PARAM_GUARD_US] <= 1000000;
+}
+static_assert(PING_GUARD_MIN_US <= PING_GUARD_US && uint32_t(PING_RATE) * PING_GUARD_US <= 1000000, "the initial parameters must be consistent");
+using ParameterStore = params::Store<NO_PARAMS, PARAMS_VERSION, parameter_info, parameters_consistent>;
+ParameterStore parameters;
+ParameterStore::Block parameter_block EEMEM;
+params::Console console;
+RingBuffer<uint8_t, 8> received;   // bytes from PCINT0_vect for the console
+bool rx_high = true;               // level of RxD at the last pin change
+
+// the parameters into the variables they tune, as timer ticks. the guard of the sensors
+// starts over from the new one
+void apply_parameters(){
+	uint16_t period = TIMER0_HZ / parameters.get(PARAM_PING_RATE);
+	uint16_t guard = us_to_ticks(parameters.get(PARAM_GUARD_US));
+	uint16_t guard_min = us_to_ticks(parameters.get(PARAM_GUARD_MIN_US));
+	uint16_t margin = us_to_ticks(parameters.get(PARAM_TRACK_MARGIN_US));
+	uint8_t sreg = SREG;
+	cli();   // the measurement ISRs read them
+	ping_period = period;
+	ping_guard = guard;
+	ping_guard_min = guard_min;
+	track_margin = margin;
+	for (Sensor& s : sensors){
+		s.guard = guard;
+	}
+	SREG = sreg;
+	avr_percentage = parameters.get(PARAM_AVR_PERCENTAGE);
+	#if defined(SMOOTH_CMI) && defined(CMI_RUNTIME_CONFIG)
+		TAnalyzer::ConstDeltaConfiguration& channelConfig = TAnalyzer::channelConfig;
+		channelConfig.set_delta(uint32_t(us_to_ticks(parameters.get(PARAM_CMI_WIDTH_US))) << fixed_comma_position);
+		channelConfig.weight_old = parameters.get(PARAM_CMI_WEIGHT_OLD);
+		channelConfig.weight_new = 100 - parameters.get(PARAM_CMI_WEIGHT_OLD);
+		channelConfig.initial_badness = parameters.get(PARAM_CMI_BADNESS);
+		channelConfig.badness_reducer = parameters.get(PARAM_CMI_REDUCER);
+	#endif
+}
 #endif
 
+
 void init(){
-	#ifdef SMOOTH_CMI
+	#ifdef SET_CLOCK
+		// timed sequence: the new prescaler within 4 cycles after CLKPCE. interrupts are still off
+		CLKPR = 1<<CLKPCE;
+		CLKPR = CLOCK_PRESCALE;
+	#endif
+	#ifdef PARAMETERS
+		parameters.load(&parameter_block);
+		apply_parameters();   // the run time CMI as well
+	#elif defined(SMOOTH_CMI) && defined(CMI_RUNTIME_CONFIG)
 		// setup channels for denoising of US sensor
-		static TAnalyzer::ConstDeltaConfiguration
-			channelConfig((uint32_t(0xC0)) << fixed_comma_position /*channel width*/);
+		TAnalyzer::ConstDeltaConfiguration& channelConfig = TAnalyzer::channelConfig;
 		channelConfig.weight_old = OLD_AVR_PERCENTAGE;
 		/* assert: (weight_old + weight_new) * (max_measured_value << fixed_comma_position) < (1(U)LL << 32) */
 		channelConfig.weight_new = 100-OLD_AVR_PERCENTAGE;
 		channelConfig.initial_badness = 40;
 		channelConfig.badness_reducer = 9;
-
-		static TAnalyzer channels(channelConfig);
-		channelPointer = &channels;
-	#endif
-
-	#ifdef SMOOTH_MOVING_AVR
-		// initialize array for moving average calculation
-		for (int i=0; i<NO_AVERAGE; i++){
-			avr_window[i] = 0;
-		}
 	#endif
 
 	// configure TONE generator with Timer 1
 		SETOUTPUT(POSOUT);
+		#if SENSORS == 1 && !defined(PARAMETERS) && !defined(PROFILING)
 		SETOUTPUT(NEGOUT);
+		#endif
 
-		#if false   // PLL is not really necessary. internal system clock is fast enough
+		#if SYNTH_MODE == SYNTH_DDS
 		// activate PLL clock source
-			PLLCSR |= (1<<LSM);                 // low speed mode (=32MHz). for compatibility with low operating volatges (<2.7V)
-			PLLCSR |= (1<<PLLE);                // enable PLL
+			PLLCSR |= (1<<PLLE);                // enable PLL (64MHz. LSM would halve it for supply voltages below 2.7V)
 			_delay_us(100);                     // wait for PLL to become stable
 			while(!(PLLCSR & (1<<PLOCK))) {}    // wait for PLL to be locked
 			PLLCSR |= (1<<PCKE);                // use PLL as peripheral clock (async mode)
-			// clock source for Timer 1 is now running with 32MHz
+			// clock source for Timer 1 is now running with 64MHz
 		#endif
 
 		// setup timer 1
+			#if SENSORS == 1 && !defined(PARAMETERS) && !defined(PROFILING)
 			#define TIMER1_SETTINGS (1<<CTC1 | 1<<PWM1A | 0<<COM1A1 | 1<<COM1A0)
+			#else   // NEGOUT is TRIGGER2 or RxD
+			#define TIMER1_SETTINGS (1<<CTC1 | 1<<PWM1A | 1<<COM1A1 | 0<<COM1A0)
+			#endif
 			//                      clear timer/counter on Compare Match with OCR1C
 			//                                activate PWM mode (compare against OCR1A)
-			//                                           activate output according to compare
-			
+			//                                           activate output according to compare (OC1A and !OC1A, or OC1A only)
+
+		#if SYNTH_MODE == SYNTH_DDS
+			// 8 bit PWM, OCR1A is the sample. OC1A and !OC1A drive the speaker push-pull.
+			// the overflow is the sample clock
+			OCR1C = 0xFF;
+			OCR1A = 0x80;
+			TCCR1 = TIMER1_SETTINGS | DDS_PRESCALE;
+			TIMSK |= 1<<TOIE1;
+		#else
 			// initial timer values:
 				//uint8_t timer1prescaleExp = 0<<CS13 | 0<<CS12 | 0<<CS11 | 0<<CS10;
 				uint8_t timer1prescaleExp = 0xF<<CS10; // must be a 4 Bit value
@@ -113,21 +622,42 @@ void init(){
 				// in case of 1MHz system clock (sync mode) as clock source
 			
 			TCCR1 = TIMER1_SETTINGS | timer1prescaleExp;
+		#endif
 
 	// configure ultrasonic distance measurement
-		SETOUTPUT(TRIGGER);
-		SETINPUT(ECHO);
-		CLEARBIT(ECHO);   // disable pullup resistor for this port
+		for (uint8_t i = 0; i < SENSORS; ++i){
+			SETOUTPUT(sensor_pins[i].trigger);
+			SETINPUT(sensor_pins[i].echo);
+			CLEARBIT(sensor_pins[i].echo);   // disable pullup resistor for this port
 
 		// enable interrupts for ECHO signal
-			GIMSK |= 1<<PCIE;    // globaly enable pin change interrupt
-			PCMSK |= (ECHO);     // enable pin change interrupt for ECHO pin
+			PCMSK |= sensor_pins[i].echo;    // enable pin change interrupt for ECHO pin
+		}
+		#if defined(PARAMETERS) || defined(PROFILE_REQUEST)
+		// serial input for the parameters or the request for the profile
+			#ifdef PARAMETERS
+			init_recv();
+			#endif
+			SETBIT(RxDBit);      // pullup, an open input is idle
+			PCMSK |= RxDBit;
+		#endif
+		GIMSK |= 1<<PCIE;    // globaly enable pin change interrupt
 
-		// setup timer 0
+		// setup timer 0. it runs all the time: the echo is measured as the difference
+		// of two time stamps, the serial output uses compare A
+		// and the measurement compare B
+			#if TIMER0_PRESCALE == TIMING_FINE
 			TIMSK |= (1<<TOIE0);    // enable interrupt on overflow of timer 0
-			//#define ACTIVATE_ECHO_TIMER (0<<CS02 | 1<<CS01 | 0<<CS00) // activate Timer0, internal source, /8 prescaling -> 125kHz
-			#define ACTIVATE_ECHO_TIMER (0<<CS02 | 0<<CS01 | 1<<CS00)   // activate Timer0, internal source, /1 prescaling -> 1MHz
-			#define STOP_ECHO_TIMER (~(1<<CS02 | 1<<CS01 | 1<<CS00))
+			#define ACTIVATE_ECHO_TIMER (0<<CS02 | 0<<CS01 | 1<<CS00)   // activate Timer0, internal source, /1 prescaling -> F_CPU
+			#elif TIMER0_PRESCALE == TIMING_COARSE
+			#define ACTIVATE_ECHO_TIMER (0<<CS02 | 1<<CS01 | 0<<CS00)   // activate Timer0, internal source, /8 prescaling -> F_CPU / 8
+			#else
+			#define ACTIVATE_ECHO_TIMER (0<<CS02 | 1<<CS01 | 1<<CS00)   // activate Timer0, internal source, /64 prescaling -> F_CPU / 64
+			#endif
+			for (uint8_t i = 0; i < SENSORS; ++i){   // the first pings after a guard time, one after the other
+				sensors[i].due = ping_guard + i * CROSS_GUARD_TICKS;
+			}
+			ping_schedule(0, ping_guard, ping_match(0, ping_guard));   // compare B runs the measurement
 			TCCR0B |= ACTIVATE_ECHO_TIMER;
 
 
@@ -135,105 +665,826 @@ void init(){
 	sei();
 
 	// configure serial communication (send only)
+	#if SENSORS == 1
 	init_send();
+	#endif
 }
 
 
-// handle ECHO timer overflow. implements 16Bit timer
+// count an overflow of timer 0. implements 16Bit timer
+inline void timer0_overflow(){
+	uint8_t high = timer0_high + 1;
+	timer0_high = high;
+	#if TIMER0_PRESCALE == TIMING_FINE
+	if (high == ping_enable_high){   // the next step of the measurement is in the next round
+		TIFR = 1<<OCF0B;
+		TIMSK |= 1<<OCIE0B;
+	}
+	SIM_CHARGE(avrcost::BRANCH);
+	#endif
+	SIM_CHARGE(avrcost::ld<uint8_t>());
+}
+
+#if TIMER0_PRESCALE == TIMING_FINE
+// handle timer 0 overflow
 ISR(TIMER0_OVF_vect){
-	echo_timer_high++;
-	if (echo_timer_high >= MAX_ECHO_HIGH){ //no sensible measurement
-		TCCR0B &= STOP_ECHO_TIMER;          // stop timer
+	timer0_overflow();
+}
+#endif
+
+
+// count a pending overflow right here. call with interrupts disabled.
+// that saves the overflow ISR right after the calling one, which would delay
+// the serial output too much. true if there was one
+inline bool timer0_catch_up(){
+	SIM_CHARGE(avrcost::BRANCH + 1);
+	if (!(TIFR & (1<<TOV0))) return false;
+	TIFR = 1<<TOV0;
+	timer0_overflow();
+	return true;
+}
+
+// 16 bit time stamp of Timer0. call with interrupts disabled
+inline uint16_t timer0_now(){
+	uint8_t low = TCNT0;
+	if (timer0_catch_up()){
+		low = TCNT0;   // the first read might have been before the overflow
 	}
+	SIM_CHARGE(avrcost::ld<uint8_t>() + 1);
+	return static_cast<uint16_t>(timer0_high) << 8 | low;
 }
 
+// the same in two halves, for the ISRs: timer0_read() with interrupts disabled only reads
+// the registers, stamp() comes later with interrupts enabled. a pending overflow is left to
+// the ones that count them
+struct Timer0Read {
+	uint8_t before, low, after, high;   // TIFR, TCNT0, TIFR again, timer0_high
+	uint16_t stamp() const {
+		// the overflow came before TCNT0 was read: it was pending, or it came meanwhile and TCNT0 is past it
+		bool wrapped = (before & (1<<TOV0)) || ((after & (1<<TOV0)) && low < 0x80);
+		SIM_CHARGE(2*avrcost::BRANCH + avrcost::add<uint8_t>() + 2);
+		return static_cast<uint16_t>(high + wrapped) << 8 | low;
+	}
+};
+inline Timer0Read timer0_read(){
+	Timer0Read r;
+	r.before = TIFR;
+	r.low = TCNT0;
+	r.after = TIFR;
+	r.high = timer0_high;
+	SIM_CHARGE(avrcost::ld<uint8_t>());
+	return r;
+}
 
-// handle ECHO signal
-ISR(PCINT0_vect){
-	if(READBIT(ECHO)){   // signal send. reset and start timer
-		TCCR0B &= STOP_ECHO_TIMER;    // stop timer
-		echo_timer_high = 0;          // reset both timer bytes
-		TCNT0 = 0;
-		GTCCR |= (1<<PSR0);           // clear internal prescaler counter
-		TCCR0B |= ACTIVATE_ECHO_TIMER;   // start timer
+#ifdef PARAMETERS
+// Timer0 after interrupts were off for longer than a round, 'expected' is the time now
+// within half a round: the overflows meanwhile are taken from it instead of counted.
+// call with interrupts disabled
+inline void timer0_resync(uint16_t expected){
+	TIFR = 1<<TOV0;
+	uint8_t low = TCNT0;
+	uint16_t now = expected + static_cast<int8_t>(low - static_cast<uint8_t>(expected));
+	timer0_high = now >> 8;
+	if (low < 0x80){   // an overflow since the flag was cleared is in 'now' already
+		TIFR = 1<<TOV0;
+	}
+	SIM_CHARGE(2*avrcost::add<uint16_t>() + avrcost::st<uint8_t>() + avrcost::BRANCH + 2);
+}
+#endif
+
+// the same for profile.h, from anywhere
+inline uint16_t profile_clock(){
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t now = timer0_now();
+	SREG = sreg;
+	return now;
+}
 
-	} else {             // signal received. stop and read timer
-		TCCR0B &= STOP_ECHO_TIMER;    // stop timer
-		
-		if (TIFR & (1<<TOV0)) {       // an overflow occured recently, that has not yet been processed
-			echo_timer_high++;         // step high byte of timer
-			TIFR = 1<<TOV0;            // clear timer overflow interrupt flag
-												// this is a strange way to clear a bit. see datasheet.
+// ping_lock() with interrupts disabled
+inline void ping_lock_cli(){
+	TIMSK &= ~(1<<OCIE0B);
+	#if TIMER0_PRESCALE == TIMING_FINE
+	ping_enable_high = timer0_high;   // TIMER0_OVF_vect leaves it off as well
+	SIM_CHARGE(avrcost::ld<uint8_t>() + avrcost::st<uint8_t>());
+	#endif
+	ping_busy = true;
+	SIM_CHARGE(avrcost::st<uint8_t>());
+}
+
+// the ISRs of the measurement run with interrupts enabled, the serial output (compare A)
+// must not wait for them. they keep each other off with ping_lock() .. ping_unlock(): compare
+// B is off in between, the pin change interrupt stays on and takes the time stamp of an edge
+// of ECHO, ping_busy leaves the rest to the end (ping_pending_edges()). only the time stamp,
+// these two and the handover of an edge disable interrupts, for a few cycles. call with
+// interrupts enabled
+inline void ping_lock(){
+	cli();
+	ping_lock_cli();
+	sei();
+}
+
+// compare B at the next step, 'ticks' after 'from' (ping_earliest()), and the edges of
+// ECHO back to PCINT0_vect
+inline void ping_unlock(uint16_t from, uint16_t ticks){
+	uint8_t match = ping_match(from, ticks);
+	cli();
+	ping_schedule(from, ticks, match);
+	ping_busy = false;
+	SIM_CHARGE(avrcost::st<uint8_t>());
+	#if TIMER0_PRESCALE != TIMING_FINE
+	timer0_catch_up();   // the next compare B might come after the next overflow
+	#endif
+	sei();
+}
+
+
+// hand a readout of sensor i over to the main loop. called from the ISRs
+inline void push_ping(uint8_t i, uint16_t echo){
+	Ping p;
+	p.echo = echo;
+	#if SENSORS > 1
+		p.sensor = i;
+	#else
+		(void)i;
+	#endif
+	#ifdef TRACE_OUTPUT
+		p.dt = ping_dt;
+	#endif
+	if (!echoes.push(p)){
+		ping_rates.lost++;
+	}
+	SIM_CHARGE(avrcost::ld<uint8_t>() + 12);
+}
+
+
+// adapt timeout and guard of a sensor to the result of its ping (echo in ticks, 0: none),
+// see PING_TRACKING above. called from the ISRs of the measurement
+void ping_adapt(Sensor& s, uint16_t echo){
+	bool hit = echo != 0;
+	if (s.mode == PING_SEARCH){
+		s.streak = hit ? s.streak + 1 : 0;
+		SIM_CHARGE(avrcost::ld<uint8_t>() + 2*avrcost::BRANCH);
+		if (s.streak < TRACK_HITS){
+			return;
+		}
+		s.mode = PING_TRACKING;
+		ping_rates.changes++;
+		s.streak = 0;
+		s.track = echo;
+	} else if (!hit){   // reacquire with the whole range
+		s.timeout = ECHO_DELAY_TICKS + MAX_DISTANCE;
+		s.guard = ping_guard;
+		SIM_CHARGE(2*avrcost::st<uint16_t>() + 2*avrcost::BRANCH);
+		if (++s.streak < SEARCH_MISSES){
+			return;
 		}
+		s.mode = PING_SEARCH;
+		ping_rates.changes++;
+		s.streak = 0;
+		return;
+	} else {
+		s.streak = 0;
+		uint16_t faded = s.track - s.track / 16;
+		s.track = echo > faded ? echo : faded;
+	}
+	uint16_t window = s.track + s.track / 2 + track_margin;
+	s.timeout = ECHO_DELAY_TICKS + (window < MAX_DISTANCE ? window : MAX_DISTANCE);
+	s.guard = echo < ping_guard_min ? ping_guard_min : echo > ping_guard ? ping_guard : echo;
+	SIM_CHARGE(6*avrcost::add<uint16_t>() + 3*avrcost::st<uint16_t>() + 6*avrcost::BRANCH);
+}
 
-		if (echo_timer_high < MAX_ECHO_HIGH){  // otherwise assume timeout
-			distance = ((uint32_t) echo_timer_high) << 8 | TCNT0; //distance = run time of US sensor in timer ticks
-			
+// ticks from now to the next trigger of a sensor: its guard, but not before its period is over
+inline uint16_t ping_next(const Sensor& s, uint16_t since_trigger){
+	SIM_CHARGE(2*avrcost::add<uint16_t>() + avrcost::BRANCH);
+	return since_trigger + s.guard < ping_period ? ping_period - since_trigger : s.guard;
+}
 
-#ifdef SMOOTH_CMI
-			//denoise the distance with the channel object
-			uint32_t localDistanceCopy = distance << fixed_comma_position;
-			send_byte(distance >> 8); send_byte(distance & 0xFF);
-			send_byte(channelPointer->input(localDistanceCopy));
-			distance = channelPointer->output() >> fixed_comma_position;
-#endif
-
-#ifdef SMOOTH_AVR
-			//denoise the distance with weighted average
-			avr_distance = (avr_distance*OLD_AVR_PERCENTAGE/100 + distance*(100-OLD_AVR_PERCENTAGE));
-			distance = avr_distance/100;
-#endif
-
-#ifdef SMOOTH_MOVING_AVR
-			//denoise with true moving average
-			avr_window[curr_window_idx++] = static_cast<uint16_t>(distance);
-			curr_window_idx %= NO_AVERAGE;
-			distance = 0;
-			for (int i=0; i<NO_AVERAGE; i++){
-				distance += avr_window[i];
-			}
-			distance /= NO_AVERAGE;
+// the sensor in PING_ECHO, or NO_SENSOR. the pin changes are its edges
+inline uint8_t ping_listener(){
+	for (uint8_t i = 0; i < SENSORS; ++i){
+		SIM_CHARGE(avrcost::ld<uint8_t>() + avrcost::BRANCH);
+		if (sensors[i].state == PING_ECHO) return i;
+	}
+	return NO_SENSOR;
+}
+
+#if SENSORS > 1
+// may sensor i trigger now? not while another one is on (PING_TRIGGER, PING_ECHO),
+// and from PING_GUARD not before the ones that have been waiting longer
+inline bool ping_turn(uint8_t i){
+	for (uint8_t j = 0; j < SENSORS; ++j){
+		uint8_t state = sensors[j].state;
+		SIM_CHARGE(avrcost::ld<uint8_t>() + 2*avrcost::BRANCH);
+		if (j != i && (state >= PING_TRIGGER || (state == PING_WAIT && sensors[i].state == PING_GUARD))){
+			return false;
+		}
+	}
+	return true;
+}
+
+// the ping of sensor i is over at 'now' (echo in ticks, 0: none): the others go on
+// CROSS_GUARD_TICKS later at the earliest, the waiting ones right then. called from the
+// ISRs of the measurement
+inline void ping_release(uint8_t i, uint16_t now, uint16_t echo){
+	ping_ghost = now + (echo ? echo : 0x8000);
+	uint16_t due = now + CROSS_GUARD_TICKS;
+	for (uint8_t j = 0; j < SENSORS; ++j){
+		Sensor& s = sensors[j];
+		if (j != i && (s.state == PING_WAIT || (s.state == PING_GUARD && static_cast<int16_t>(s.due - due) < 0))){
+			s.due = due;
+		}
+		SIM_CHARGE(2*avrcost::ld<uint8_t>() + avrcost::add<uint16_t>() + 3*avrcost::BRANCH);
+	}
+}
 #endif
 
-			// set tone
-			uint8_t octave = (distance / DIST_OCT + 2) & 0x0F; // be shure to get a 4Bit value
-			uint8_t Tperiod = (uint32_t)(distance % DIST_OCT) * 128 / DIST_OCT + 128;
+// ticks from now to the next step of any sensor, for ping_schedule()
+inline uint16_t ping_earliest(uint16_t now){
+	uint16_t next = sensors[0].due - now;
+	for (uint8_t i = 1; i < SENSORS; ++i){
+		uint16_t ticks = sensors[i].due - now;
+		if (ticks < next) next = ticks;
+		SIM_CHARGE(2*avrcost::ld<uint16_t>() + avrcost::add<uint16_t>() + avrcost::BRANCH);
+	}
+	return next;   // with a single sensor the compiler takes the due from the register it just stored
+}
 
-			TCCR1 = TIMER1_SETTINGS | octave;
-			OCR1C = Tperiod;
-			OCR1A = Tperiod/2;
 
-			#ifdef DEBUG_OUTPUT
-				// send debugging output
-				send_byte(distance>>8);
-				send_byte(distance);
+// measurement state machine of every sensor:
+//   PING_GUARD   -> rising edge on TRIGGER (as soon as the sensor is idle)       -> PING_TRIGGER
+//                   another one is on                                            -> PING_WAIT
+//   PING_WAIT    -> rising edge on TRIGGER, CROSS_GUARD_TICKS after the other    -> PING_TRIGGER
+//   PING_TRIGGER -> falling edge on TRIGGER starts the ping, time stamp          -> PING_ECHO
+//   PING_ECHO    -> timeout, no echo (the end of the echo is handled in PCINT0)  -> PING_GUARD
+// compare B is set to the next step of any of them (ping_earliest()).
+// the main loop only processes the readouts and sleeps otherwise
+inline void ping_step(uint8_t i, uint16_t now){
+	Sensor& s = sensors[i];
+	uint16_t next;
+	if (static_cast<int16_t>(now - s.due) < 0){   // not yet, or a round early
+		SIM_CHARGE(avrcost::add<uint16_t>() + avrcost::BRANCH);
+		return;
+	} else switch (s.state){
+		case PING_TRIGGER: {
+			CLEARBIT(sensor_pins[i].trigger);
+			uint16_t dt = now - s.start;
+			s.start = now;
+			ping_rates.ticks += dt;
+			if (s.mode == PING_SEARCH){
+				ping_rates.search_ticks += dt;
+			}
+			ping_rates.count++;
+			#if defined(DEBUG_OUTPUT) || defined(TRACE_OUTPUT)
+			if (ping_rates.count >= RATE_REPORT_PINGS && rate_reports.push(ping_rates)){   // else the next ping tries again
+				ping_rates = PingRates{};
+				SIM_CHARGE(avrcost::ld<PingRates>() + 2*avrcost::st<PingRates>());
+			}
+			SIM_CHARGE(avrcost::BRANCH);
+			#endif
+			#ifdef TRACE_OUTPUT
+				ping_dt = dt;
+			#endif
+			s.state = PING_ECHO;
+			next = s.timeout;
+			SIM_CHARGE(avrcost::add<uint16_t>() + 2*avrcost::add<uint32_t>() + 4*avrcost::ld<uint32_t>() + 10);
+			break;
+		}
+		case PING_ECHO:      // out of range or no sensor
+			s.echo_started = false;
+			ping_rates.timeouts++;
+			push_ping(i, 0);
+			ping_adapt(s, 0);
+			s.state = PING_GUARD;
+			next = ping_next(s, now - s.start);
+			#if SENSORS > 1
+			ping_release(i, now, 0);
 			#endif
+			break;
+		default:             // PING_GUARD, PING_WAIT
+			#if SENSORS > 1
+			if (!ping_turn(i)){   // until ping_release()
+				s.state = PING_WAIT;
+				next = 0x7FFF;
+				break;
+			}
+			#endif
+			if (READBIT(sensor_pins[i].echo)){   // the sensor is still busy with an echo that timed out
+				next = s.guard;
+				break;
+			}
+			SETBIT(sensor_pins[i].trigger);
+			s.state = PING_TRIGGER;
+			next = PING_TRIGGER_TICKS;
+	}
+	s.due = now + next;
+	SIM_CHARGE(avrcost::add<uint16_t>() + avrcost::st<uint16_t>() + 2*avrcost::BRANCH);
+}
+
+inline void echo_edge(uint16_t now, uint8_t pins);
+
+// handle the edges of ECHO in the order of their slots, up to the first one that isn't
+// filled in yet: its PCINT0_vect comes back to it. returns the time of the last one, 'now'
+// without any. call locked
+inline uint16_t ping_handle_edges(uint16_t now){
+	for (;;){
+		cli();
+		PingEdge& e = ping_edges[ping_edges_done & (PING_EDGES - 1)];
+		uint8_t pins = e.pins;
+		SIM_CHARGE(2*avrcost::ld<uint8_t>() + avrcost::add<uint8_t>() + avrcost::BRANCH);
+		if (!(pins & EDGE_READY)){
+			sei();
+			return now;
 		}
-	
+		now = e.time;
+		e.pins = 0;
+		ping_edges_done++;
+		sei();
+		SIM_CHARGE(avrcost::ld<uint16_t>() + 2*avrcost::st<uint8_t>() + avrcost::add<uint8_t>());
+		echo_edge(now, pins);
+	}
+}
 
+// the edges that came while the measurement was locked (ping_busy), at the end of an ISR:
+// it takes the lock for them unless an ISR further down holds it, that one comes here as
+// well. with interrupts disabled from the check on, else a compare B in between would find
+// ECHO changed and nothing waiting and take the edge with its own, later time stamp. call with
+// interrupts enabled
+inline void ping_pending_edges(){
+	for (;;){
+		cli();
+		uint8_t pins = ping_edges[ping_edges_done & (PING_EDGES - 1)].pins;
+		SIM_CHARGE(3*avrcost::ld<uint8_t>() + avrcost::add<uint8_t>() + 2*avrcost::BRANCH);
+		if (ping_busy || !(pins & EDGE_READY)){
+			sei();
+			return;
+		}
+		ping_lock_cli();
+		sei();
+		uint16_t now = ping_handle_edges(0);   // one at least
+		uint16_t next = ping_earliest(now);
+		ping_unlock(now, next);
 	}
 }
 
+// an edge of ECHO whose PCINT0_vect let this ISR in during its prologue, before its time
+// stamp: it would be late by all of this ISR. the edge takes the time stamp of this one
+// instead, PCINT0_vect finds it handled then. the edges that waited for the lock come first,
+// and none may be left: one that isn't filled in yet has an earlier time stamp. call locked
+inline void ping_early_edge(uint16_t now){
+	ping_handle_edges(now);
+	uint8_t i = ping_listener();
+	cli();   // against a PCINT0_vect in between
+	uint8_t pins = PINB;
+	bool early = i != NO_SENSOR && ping_edges_done == ping_edges_taken && static_cast<bool>(pins & sensor_pins[i].echo) != sensors[i].echo_started;
+	sei();
+	SIM_CHARGE(4*avrcost::ld<uint8_t>() + 4*avrcost::BRANCH + 1);
+	if (early){
+		echo_edge(now, pins);
+	}
+}
 
+#ifdef PARAMETERS
+// Timer0 ticks from the time stamp of the ISR to the stop bit of a received byte
+constexpr uint16_t RXD_TICKS{ (SerialTiming::at(2 * SERIAL_FRAME_BITS - 1) - RxDLatency) / TIMER0_PRESCALE };
 
-void trigger_us(){
-	CLEARBIT(TRIGGER);
-	_delay_us(20);          // stay low for at least 20 μs
-	SETBIT(TRIGGER);
+// a start bit on RxD: take the byte for the console and return true. interrupts stay
+// disabled until the stop bit, the edges of the data bits are dropped, and with them
+// the ones of the echo: its ping times out. 'time' is the time stamp of the ISR and
+// 'pins' PINB then. returns false with interrupts still disabled
+inline bool receive(const Timer0Read& time, uint8_t pins){
+	if (pins & RxDBit){   // the usual case first, it delays the serial output
+		rx_high = true;
+		SIM_CHARGE(avrcost::st<uint8_t>() + avrcost::BRANCH);
+		return false;
+	}
+	bool start = rx_high;   // not when the line is stuck low
+	rx_high = false;
+	SIM_CHARGE(avrcost::ld<uint8_t>() + avrcost::st<uint8_t>() + 2*avrcost::BRANCH);
+	if (!start){
+		return false;
+	}
+	int b = recv_byte();
+	if (b >= 0){
+		received.push(b);
+	}
+	recv_stop();
+	rx_high = READBIT(RxDBit);
+	GIFR = 1<<PCIF;
+	uint8_t i = ping_listener();
+	if (i != NO_SENSOR){
+		sensors[i].echo_started = false;
+	}
+	timer0_resync(time.stamp() + RXD_TICKS);
+	return true;
 }
 
+// a start bit whose PCINT0_vect let this ISR in during its prologue: it would come to
+// recv_byte() late by all of this ISR, past the middle of the first bit. the byte is taken
+// here instead, PCINT0_vect finds the line high or the next start bit then. call with
+// interrupts disabled, it returns true with them still disabled after a byte
+inline bool receive_early(const Timer0Read& time){
+	uint8_t pins = PINB;
+	SIM_CHARGE(2*avrcost::ld<uint8_t>() + 2*avrcost::BRANCH);
+	return rx_high && !(pins & RxDBit) && receive(time, pins);
+}
+#endif
+
+#ifdef PROFILE_REQUEST
+// the request for the profile without the console: the byte 'p' (0x70, the first one of
+// showdata.py --profile) from the times of its edges. RxD goes high with data bit 4 (0..3
+// are low like the start bit) and stays so for 4..6. the low bit 7 is gone before a late
+// PCINT0_vect reads the pin, an edge from there on will do. else a falling edge starts over.
+// 0xF0 passes as well, and the console repeats a request that got lost
+constexpr uint16_t RXD_BIT_TICKS{ TIMER0_HZ / BAUDRATE };
+static_assert(RXD_BIT_TICKS >= 4, "a bit of the serial input needs a few Timer0 ticks to tell the edges apart");
+enum RequestEdge : uint8_t { REQUEST_START, REQUEST_RISE, REQUEST_HIGH };   // the one that comes next
+RequestEdge request_edge{ REQUEST_START };
+uint16_t request_start;   // Timer0 at the start bit
+
+// the time stamps of the edges for the main loop, the level after it in bit 0. PCINT0_vect
+// nests, an edge can get in before the one in front of it is stamped: the slot is taken
+// with interrupts disabled, in the order of the edges, the time stamp goes in later. when
+// the main loop runs, every ISR that took a slot has filled it
+constexpr uint8_t RX_EDGES{ 16 };   // a power of two, the edges of a whole request (5 bytes)
+uint16_t rx_edges[RX_EDGES];
+volatile uint8_t rx_edge_count;     // slots taken, PCINT0_vect
+uint8_t rx_edges_done;              // slots decoded, main loop
+uint8_t rx_pins = RxDBit;           // RxD and ECHO at the last edge, PCINT0_vect
+// the ISRs of RxD and of the answer on TxD may hold up the time stamps of an echo around
+// them by a few bits: the next one to end is no readout, like one a byte of PARAMETERS blocks
+bool rx_seen = false;              // an edge of RxD since the end of the last echo
+
+// the time stamp of an edge of RxD into the slot it took, 'pins' PINB then
+inline void rx_stamp(uint8_t slot, uint16_t now, uint8_t pins){
+	rx_seen = true;
+	rx_edges[slot & (RX_EDGES - 1)] = (now & ~1) | static_cast<bool>(pins & RxDBit);
+	SIM_CHARGE(avrcost::st<uint8_t>() + avrcost::st<uint16_t>() + avrcost::add<uint8_t>() + 2);
+}
+
+// an edge of RxD at 'now', 'high' the level after it
+inline void profile_request(uint16_t now, bool high){
+	uint16_t ticks = now - request_start;
+	SIM_CHARGE(avrcost::ld<uint16_t>() + avrcost::add<uint16_t>() + avrcost::ld<uint8_t>() + avrcost::BRANCH);
+	if (request_edge == REQUEST_RISE && high && static_cast<uint16_t>(ticks - 5 * RXD_BIT_TICKS + RXD_BIT_TICKS / 2) < RXD_BIT_TICKS){
+		request_edge = REQUEST_HIGH;   // within half a bit of the end of bit 3
+		SIM_CHARGE(avrcost::add<uint16_t>() + avrcost::st<uint8_t>() + 2*avrcost::BRANCH);
+		return;
+	}
+	if (request_edge == REQUEST_HIGH && ticks >= 7 * RXD_BIT_TICKS + RXD_BIT_TICKS / 2){
+		profile_sending = true;   // report_profile() answers
+		SIM_CHARGE(avrcost::st<uint8_t>() + 2*avrcost::BRANCH);
+	}
+	request_edge = high ? REQUEST_START : REQUEST_RISE;
+	request_start = now;
+	SIM_CHARGE(avrcost::st<uint8_t>() + avrcost::st<uint16_t>() + 2*avrcost::BRANCH);
+}
+
+// decode the edges of RxD that came since the last call. after more than fit the slots
+// (the main loop was busy for long) the first ones are gone, it starts over
+void serve_profile_request(){
+	uint8_t count = rx_edge_count;
+	SIM_CHARGE(2*avrcost::ld<uint8_t>() + avrcost::add<uint8_t>() + avrcost::BRANCH);
+	if (static_cast<uint8_t>(count - rx_edges_done) > RX_EDGES){
+		rx_edges_done = count;
+		request_edge = REQUEST_START;
+		SIM_CHARGE(2*avrcost::st<uint8_t>());
+		return;
+	}
+	while (rx_edges_done != count){
+		uint16_t edge = rx_edges[rx_edges_done++ & (RX_EDGES - 1)];
+		profile_request(edge & ~1, edge & 1);
+		SIM_CHARGE(avrcost::ld<uint16_t>() + avrcost::add<uint8_t>() + 2*avrcost::BRANCH + 2);
+	}
+	SIM_CHARGE(avrcost::st<uint8_t>());
+}
+#endif
+
+ISR(TIMER0_COMPB_vect, ISR_NOBLOCK){
+	// the serial output may come in anytime but in the few cycles of the time
+	// stamp and of the lock, it gets a chance in between
+	cli();
+	Timer0Read time = timer0_read();
+	#ifdef PARAMETERS
+	if (receive_early(time)){
+		time = timer0_read();   // after the byte
+	}
+	#endif
+	sei();
+	uint16_t now = time.stamp();
+	ping_lock();
+	ping_early_edge(now);
+	PROFILE_ISR_BEGIN(now)
+
+	for (uint8_t i = 0; i < SENSORS; ++i){
+		ping_step(i, now);
+	}
+	uint16_t next = ping_earliest(now);
+
+	PROFILE_ISR_END(PROBE_COMPB)
+	ping_unlock(now, next);   // the epilogue with interrupts enabled as well
+	ping_pending_edges();
+}
+
+
+// handle ECHO signal, 'now' is the time of the edge and 'pins' the levels then: by the time
+// it gets here ECHO may have changed again. only the sensor in PING_ECHO listens, the edges
+// belong to it. call locked
+inline void echo_edge(uint16_t now, uint8_t pins){
+	PROFILE_ISR_BEGIN(now)
+	uint8_t i = ping_listener();
+	if (i == NO_SENSOR){   // end of an echo that timed out
+		SIM_CHARGE(avrcost::BRANCH);
+	} else if (static_cast<int16_t>(now - sensors[i].start) < 0){
+		// older than this ping: the ISR of the edge was held up by a nested one, which went on
+		// to the next ping
+		SIM_CHARGE(avrcost::ld<uint16_t>() + avrcost::add<uint16_t>() + avrcost::BRANCH);
+	} else if(pins & sensor_pins[i].echo){   // signal send. remember the time
+		Sensor& s = sensors[i];
+		if (!s.echo_started){   // not an edge of another sensor
+			s.echo_start = now;
+			s.echo_started = true;
+		}
+		SIM_CHARGE(avrcost::st<uint16_t>() + avrcost::st<uint8_t>() + 2*avrcost::BRANCH);
+
+	} else if (sensors[i].echo_started){   // signal received
+		Sensor& s = sensors[i];
+		s.echo_started = false;
+		uint16_t echo = now - s.echo_start;
+		#if SENSORS > 1
+		if (static_cast<uint16_t>(now - ping_ghost + CROSS_WINDOW_TICKS) < 2 * CROSS_WINDOW_TICKS){
+			echo = 0;   // the reflection of the other one, no readout
+			SIM_CHARGE(2*avrcost::add<uint16_t>() + avrcost::BRANCH);
+		} else
+		#endif
+		#ifdef PROFILE_REQUEST
+		if (rx_seen){
+			rx_seen = false;
+			echo = 0;   // RxD around it, no readout
+			SIM_CHARGE(avrcost::ld<uint8_t>() + avrcost::st<uint8_t>() + avrcost::BRANCH);
+		} else
+		#endif
+		{
+			SIM_READOUT(i, echo);
+			// run time of US sensor in timer ticks, otherwise assume timeout. everything else is done in the main loop
+			if (echo >= MAX_DISTANCE){
+				echo = 0;
+			}
+			push_ping(i, echo);
+			PROFILE_ISR_END(PROBE_TIMESTAMP)
+			ping_adapt(s, echo);
+		}
+		s.due = now + ping_next(s, now - s.start);
+		#if SENSORS > 1
+		ping_release(i, now, echo);
+		#endif
+		s.state = PING_GUARD;
+		SIM_CHARGE(avrcost::ld<uint16_t>() + 3*avrcost::add<uint16_t>() + avrcost::st<uint8_t>() + 2*avrcost::BRANCH);
+		PROFILE_ISR_END(PROBE_PCINT)
+	}
+}
+
+// the time stamp first, with PARAMETERS the start bits of the serial input, with
+// PROFILE_REQUEST the edges of RxD for the main loop. an edge of ECHO takes a slot of
+// ping_edges with it and is handled by the ISR that holds the lock, or this one takes it
+// (ping_pending_edges()). one of RxD takes a slot only with ECHO changed since the last one
+ISR(PCINT0_vect, ISR_NOBLOCK){
+	cli();
+	Timer0Read time = timer0_read();
+	uint8_t pins = PINB;
+	#ifdef PARAMETERS
+	if (receive(time, pins)){
+		return;
+	}
+	#elif defined(PROFILE_REQUEST)
+	uint8_t changed = (pins ^ rx_pins) & (RxDBit | sensor_pins[0].echo);
+	uint8_t rx_slot = rx_edge_count;
+	rx_pins = pins;
+	SIM_CHARGE(2*avrcost::ld<uint8_t>() + 2*avrcost::add<uint8_t>() + avrcost::st<uint8_t>() + avrcost::BRANCH);
+	if (changed & RxDBit){
+		rx_edge_count = rx_slot + 1;
+		SIM_CHARGE(avrcost::add<uint8_t>() + avrcost::st<uint8_t>() + avrcost::BRANCH);
+		if (changed == RxDBit){   // RxD alone, nothing for the measurement
+			sei();
+			rx_stamp(rx_slot, time.stamp(), pins);
+			return;
+		}
+	}
+	#endif
+	PingEdge& edge = ping_edges[ping_edges_taken++ & (PING_EDGES - 1)];   // in the order of the time stamps
+	SIM_CHARGE(2*avrcost::ld<uint8_t>() + avrcost::add<uint8_t>() + avrcost::st<uint8_t>());
+	sei();
+	edge.time = time.stamp();
+	#ifdef PROFILE_REQUEST
+	SIM_CHARGE(avrcost::BRANCH);
+	if (changed & RxDBit){
+		rx_stamp(rx_slot, edge.time, pins);
+	}
+	#endif
+	cli();
+	edge.pins = pins | EDGE_READY;
+	sei();
+	SIM_CHARGE(avrcost::st<uint16_t>() + avrcost::st<uint8_t>() + 1);
+	ping_pending_edges();
+}
+
+
+#if SYNTH_MODE == SYNTH_DDS
+// sample clock: the next sample into the PWM. together with the other ISRs it has to fit
+// into DDS_BUDGET cycles (make simbench, make sim F_CPU=8000000UL SYNTH=SYNTH_DDS). it
+// comes before compare A and 31250 times per second, so it lets the bits of the serial
+// output in. now and then another ISR gets in first and the sample comes late
+ISR(TIMER1_OVF_vect, ISR_NOBLOCK){
+	OCR1A = oscillator.next(wavetable);
+}
+#endif
+
+
+// new tone registers. Timer1 starts over if it is past the new period already,
+// instead of counting up to 255 first (a click at every downward step)
+void set_tone(const tone::Tone& t){
+	#if SYNTH_MODE == SYNTH_DDS
+	oscillator.tune(synth::step<F_CPU, DDS_SAMPLE_RATE>(t));
+	#else
+	TCCR1 = TIMER1_SETTINGS | t.prescale;
+	OCR1C = t.ocr1c;
+	#if SENSORS > 1
+	OCR1A = t.ocr1c >> volume_shift;
+	#else
+	OCR1A = t.ocr1a;
+	#endif
+	if (TCNT1 > t.ocr1c){
+		TCNT1 = 0;
+	}
+	#endif
+}
+
+
+// smooth a new readout and set the tone accordingly. called from the main loop
+void process_echo(uint16_t echo){
+	PROFILE_BEGIN(PROBE_FILTER)
+	uint16_t distance = smoothing[0].input(echo);
+	uint8_t channel = smoothing[0].channel();   // for the debug output
+	PROFILE_END(PROBE_FILTER)
+
+	// set tone
+	PROFILE_BEGIN(PROBE_TONE)
+	tone::Tone t = (current_scale == SCALE_LINEAR) ? tone_table.lookup(distance)
+	                                               : quantizer.map(distance, MAX_DISTANCE);
+	if (!GLIDE_MS || glide.target(t)){   // else the main loop slides there
+		set_tone(t);
+	}
+	PROFILE_END(PROBE_TONE)
+
+	#ifdef DEBUG_OUTPUT
+		// send debugging output: readout, smoothed distance, CMI channel (see showdata.py)
+		PROFILE_BEGIN(PROBE_TELEMETRY)
+		debug_output.sample(echo, distance, channel);
+		PROFILE_END(PROBE_TELEMETRY)
+	#else
+		(void)channel;
+	#endif
+}
+
+
+
+#if SENSORS > 1
+// smooth a readout of the volume sensor and set the duty cycle accordingly
+void process_volume(uint16_t echo){
+	uint8_t step = smoothing[1].input(echo) >> VOLUME_SHIFT;
+	volume_shift = step < VOLUME_STEPS ? 1 + VOLUME_STEPS - step : 1;
+	OCR1A = OCR1C >> volume_shift;
+	SIM_CHARGE(avrcost::shift<uint16_t>(VOLUME_SHIFT) + avrcost::shift<uint8_t>(4) + avrcost::st<uint8_t>() + avrcost::BRANCH);
+}
+#endif
+
+
+// choose the scale by the zone the (raw) readout is in
+void select_scale(uint16_t echo){
+	uint8_t zone = 0;
+	for (uint16_t limit = MAX_DISTANCE / NO_SCALES; echo >= limit && zone < NO_SCALES - 1; limit += MAX_DISTANCE / NO_SCALES){
+		zone++;
+	}
+	current_scale = zone;
+	if (zone != SCALE_LINEAR){
+		quantizer.select(&scales[zone - 1]);
+	}
+}
+
+
+#if defined(DEBUG_OUTPUT) || defined(TRACE_OUTPUT)
+// send the achieved sample rate and the time spent searching every RATE_REPORT_PINGS pings (see showdata.py)
+void report_rate(){
+	PingRates r;
+	if (!telemetry::Frame::idle() || !send_buffer.empty() || !rate_reports.pop(r)){   // not in the middle of a frame
+		return;
+	}
+	uint16_t status[] { r.count, static_cast<uint16_t>(r.ticks / r.count) /*mean period in ticks*/, r.timeouts, r.lost,
+	                    static_cast<uint16_t>(r.search_ticks * 100 / r.ticks) /*% of the time in PING_SEARCH*/, r.changes,
+	                    TIMER0_HZ / 1000 /*ticks per ms*/ };
+	telemetry::status(status, sizeof(status) / sizeof(status[0]));
+	SIM_CHARGE(2*avrcost::DIV_U32 + avrcost::MUL_U32 + avrcost::ld<PingRates>());
+}
+#endif
+
+#ifdef PROFILING
+// send the profile on request. it takes two frames, one per call while the
+// output is idle (see profile.h)
+void report_profile(){
+	if (profile_sending && telemetry::Frame::idle() && send_buffer.empty()){
+		profile_sending = !profiler.report();
+	}
+}
+#endif
+
+#ifdef PARAMETERS
+// feed the received bytes to the console. a command is answered when the serial
+// output is idle, a commit keeps the main loop busy for 3.4ms per changed byte
+void serve_parameters(){
+	uint8_t b;
+	while (telemetry::Frame::idle() && send_buffer.empty() && received.pop(b)){
+		if (!console.input(b)){
+			continue;
+		}
+		#ifdef PROFILING
+		if (console.command().op == 'p'){
+			profile_sending = true;   // report_profile() answers
+			continue;
+		}
+		#endif
+		if (console.execute(parameters, &parameter_block, PARAMS_VERSION)){
+			apply_parameters();
+		}
+	}
+}
+#endif
+
 
 
 
 int main(void){
 	init();
+	uint8_t boot_pings = 0;
+	set_sleep_mode(SLEEP_MODE_IDLE);   // the timers keep running
 
 	while(1){
-		trigger_us();
-		_delay_ms(1);
-		// ECHO pulse should have started by now
-		while(READBIT(ECHO)) {} // wait until ECHO pulse is over
-		_delay_ms(5);           // to be on the save side
+		Ping ping;
+		while (echoes.pop(ping)){
+			#ifdef TRACE_OUTPUT
+				trace_output.record(ping.dt, ping.echo);
+			#endif
+			#if SENSORS > 1
+			if (ping.sensor != 0){
+				if (ping.echo){
+					process_volume(ping.echo);
+				} else {
+					smoothing[1].hold();
+				}
+				continue;
+			}
+			#endif
+			if (ping.echo){
+				if (boot_pings < SCALE_SELECT_PINGS){
+					select_scale(ping.echo);
+				}
+				process_echo(ping.echo);
+			} else {
+				smoothing[0].hold();   // timeout, the tone stays where it is
+			}
+			if (boot_pings < SCALE_SELECT_PINGS){
+				boot_pings++;
+			}
+		}
+		#if defined(DEBUG_OUTPUT) || defined(TRACE_OUTPUT)
+			report_rate();
+		#endif
+		#ifdef PARAMETERS
+			serve_parameters();
+		#elif defined(PROFILE_REQUEST)
+			serve_profile_request();
+		#endif
+		if (GLIDE_MS && static_cast<uint8_t>(timer0_high - glide_high) >= GLIDE_ROUNDS){
+			glide_high = timer0_high;
+			tone::Tone t;
+			if (glide.step(t)){
+				set_tone(t);
+			}
+		}
+		PROFILE_COLLECT()
+		#ifdef PROFILING
+			report_profile();
+		#endif
+
+		// wait for the next interrupt. sei() takes effect after the next instruction,
+		// so a readout can't slip in between the check and sleep_cpu()
+		cli();
+		if (echoes.empty()){
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
 	}
 	return 0;
-}
\ No newline at end of file
+}
@@ -14,4 +14,17 @@
 #define SETINPUT(m)  (DDRB &= ~(m));
 #define SETOUTPUT(m) (DDRB |= (m));
 
+
+// cycle cost of code without register access for the host simulator (see sim/).
+// the simulator defines it in its <avr/io.h>, on the target it vanishes.
+#ifndef SIM_CHARGE
+#define SIM_CHARGE(cycles)
+#endif
+
+// a readout of the echo of a sensor in timer ticks, the simulator compares it with
+// the echo it produced. vanishes on the target as well
+#ifndef SIM_READOUT
+#define SIM_READOUT(sensor, ticks)
+#endif
+
 #endif
\ No newline at end of file
@@ -7,6 +7,49 @@
 * including this library (reasonable defaults exist: Bit4, PORTB, DDRB, no parity, 9600bps)
 * call init_send() once and send_byte(unsigned char) as required.
 *
+* SEND IN THE BACKGROUND:
+* define TxDInterrupt to make send_byte() only put the byte into a buffer of
+* TxDBufferSize bytes (default 8). the bits are sent by the TIMER0_COMPA_vect
+* of this library (compare A: of the other pending interrupts only INT0, PCINT0,
+* Timer1 and the overflow of Timer0 go first). Timer0 must be running all the time in normal mode
+* with a prescaler of TxDTimerPrescale (default 1), OCR0A and OCIE0A belong to
+* the library.
+* define TxDOverflow as a function to count an overflow of Timer0 (e.g. for a
+* 16 bit time) to keep the overflow interrupt from delaying the bits: while
+* sending, TOIE0 is off and the ISR calls TxDOverflow() for a pending overflow
+* every bit. the time stamps must take a pending TOV0 into account.
+* If the buffer is full, the new byte is dropped (or the oldest one, if
+* TxDDropOldest is defined) and send_dropped is counted up. with TxDWaitWhenFull
+* send_byte() waits for room instead (not from an ISR).
+* flush_send() waits until everything has been sent.
+*
+* TELEMETRY:
+* telemetry::Encoder<n> and TraceEncoder<n> pack measurements into frames for showdata.py:
+*   0xA5 (sync) | seq | type | count | payload | crc
+* seq counts frames (modulo 256), type is telemetry::TYPE_SAMPLES, TYPE_TRACE, TYPE_STATUS,
+* TYPE_PROFILE, TYPE_HISTOGRAM or TYPE_PARAMETER,
+* count is the number of samples/records in the payload, crc is a CRC-8
+* (polynomial 0x07, initial value 0) over seq, type, count and payload.
+* a trace record is varint(timer ticks since the previous record), varint(echo
+* in timer ticks, 0 if none). a status frame holds count varints, main.cpp
+* sends (pings, mean ping period in timer ticks, timeouts, lost readouts,
+* % of the time searching the hand, changes between searching and tracking,
+* timer ticks per ms). profile frames (profile.h) hold count varints as well:
+* (probe, count, min, mean, max in timer ticks, lost), histogram frames (probe,
+* 8 buckets of durations < 2, < 4, ... < 128 ticks and the rest). parameter frames
+* (params.h) answer a command: (index, value, min, max), (index) if there is no
+* such parameter, (0xFF, version) after a commit or a reset to the initial values.
+* each sample is (distance, output, channel). the first sample of a frame is
+* sent as is (varint distance, varint output, channel byte), the others as
+* differences to the previous one, D = zigzag(d distance), O = zigzag(d output),
+* c = 1 if the channel changed:
+*   D < 128 and O < 128:  0cDDDDDD DOOOOOOO     (two bytes, the usual case)
+*   otherwise:            1c000000 varint(D) varint(O)
+* followed by the channel byte if c.
+* varint: 7 bits per byte, least significant first, bit 7 set if more follow.
+* zigzag: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+* every frame can be decoded on its own, a lost byte costs one frame.
+*
 * RECEIVING:
 * define RxDBit, RxDPort, RxDPullup and RxDDDRRegister, PARITY and BAUDRATE as required before
 * including this library (reasonable defaults exist: Bit4, PINB, PORTB, DDRB, no parity, 9600bps)
@@ -14,18 +57,30 @@
 * recv_byte returns -1 if parity check failed or no START bit is detected and
 * otherwise the received byte.
 * You are responsible yourself for calling recv_byte() at the right moment, that is at
-* the beginning of the START bit.
+* the beginning of the START bit. From the pin change interrupt of RxDBit it comes
+* later: define RxDLatency as the cycles from the edge to the call (default 10).
+* It blocks for 9 bits (with parity 10), interrupts that are disabled meanwhile
+* are delayed as long.
 *
 * TWEAKING:
-* BITDELAY should be the duration of one bit minus 1 CPU cycle. 
-* FRSTBITDELAY should be the delay between the start of the START bit and the
-* middle of the first DATA bit minus a few CPU cycles. It should be a little bit
-* less then 1.5 times the duration of one bit.
-* Both are calculated automatically but can be overwritten by defining them.
+* the bits are timed in CPU cycles (Timer0 ticks in the background), every edge and
+* sample point is the nearest cycle to the ideal one (BitTiming), so F_CPU / BAUDRATE
+* doesn't need to be a whole number. blocking, 115200 bps work from 1MHz on, in the
+* background up to 57600 bps at 8MHz (the ISR takes ~60 cycles a bit).
+* SerialIOCycles are the cycles between two delays, the single out/in of the
+* precomputed port value (default 1), RxDLatency those of the caller in front of
+* recv_byte(). MAXBITERROR (default 10) is how far an edge or sample point may be
+* off, in % of a bit: a BAUDRATE that F_CPU (or the ticks of Timer0) can't reach as
+* exactly fails to compile, like one with a bit shorter than SerialIOCycles or the ISR.
+* in the background the bits come late by as long as other interrupts keep the ISR
+* waiting: TxDMaxDelay (default 0) is the longest of that in CPU cycles, the rounding to
+* ticks and it together have to stay within MAXBITERROR.
 * NOCHECKSTARTBIT can be defined to omit the early return of recv_byte() if no
 * start bit was detected.
 *
 * CONSTRAINTS:
+* (of the blocking send_byte(). in the background the bits are delayed by other
+* interrupts and by the few cycles send_byte() disables them, keep that within TxDMaxDelay)
 * while send_byte() is running, the TxDPort ist reset to its initial state several times.
 * This might be an issue, if send_byte() is interrupted and some bits of TxDPort are
 * changed in the interrupt handler.
@@ -90,32 +145,260 @@
 
 
 // timing
-#ifndef BITDELAY
-// (duration of one bit) - (cycles needed to prepare next bit)*(cycle time)
-// (factors are rearanged to minimize rounding errors)
-#define BITDELAY ((1000000UL / BAUDRATE) - (1*1000000UL)/F_CPU)    
-//#define BITDELAY 103  // for 1MHz and 1 cycle delay
+// the bits are timed to the cycle (blocking send_byte() and recv_byte()) or to the timer tick
+// (in the background): point h of a frame, in half bits from the start of the START bit, is
+// the nearest cycle/tick to h * clock / (2 * BAUDRATE). the rounding error stays below half a
+// cycle/tick instead of adding up over the frame
+#include <stdint.h>
+
+#ifndef RxDLatency
+#define RxDLatency 10
+#endif
+
+#ifndef SerialIOCycles
+#define SerialIOCycles 1    // cycles between two delays of send_byte()/recv_byte(): one out or in
 #endif
 
-#ifndef FRSTBITDELAY
-// delay between call of recv_byte (that should be at beginning of the START bit)
-// and the first measurement of the first DATA bit (that should be in the middle
-// of this bit)
-// it is 1.5 times the duration of one bit minus 10 CPU cycles that are spend with
-// some overhead
-#define FRSTBITDELAY ((1500000UL / BAUDRATE) - (10*1000000UL)/F_CPU)
+#ifndef MAXBITERROR
+#define MAXBITERROR 10      // worst edge or sample point off the ideal one, in % of a bit
 #endif
 
+// start bit, 8 data bits, parity bit (if any), stop bit
+constexpr uint8_t SERIAL_FRAME_BITS { PARITY ? 11 : 10 };
+
+template <uint32_t clock, uint32_t baudrate>
+struct BitTiming {
+		/* cycles/ticks from the start of the START bit to point h (in half bits) */
+	static constexpr uint32_t at(uint8_t h){
+		return static_cast<uint32_t>((uint64_t(clock) * h + baudrate) / (2 * uint64_t(baudrate)));
+	}
+		/* bit i of the frame, the stop bit (last) is 1.5 bits long */
+	static constexpr uint32_t bit(uint8_t i){
+		return i + 1 < SERIAL_FRAME_BITS ? at(2 * i + 2) - at(2 * i) : at(2 * i + 3) - at(2 * i);
+	}
+		/* from the middle of bit i to the middle of the next one */
+	static constexpr uint32_t sample(uint8_t i){ return at(2 * i + 3) - at(2 * i + 1); }
+
+	static constexpr uint32_t shortest(){
+		uint32_t s = bit(0);
+		for (uint8_t i = 1; i < SERIAL_FRAME_BITS; ++i) if (bit(i) < s) s = bit(i);
+		return s;
+	}
+		/* the worst edge of a frame of bits that are all bit(0) long (the stop bit 1.5 of them), in 1/1000 bit */
+	static constexpr uint32_t even_error_permille(){
+		uint32_t worst = 0;
+		for (uint8_t i = 1; i < SERIAL_FRAME_BITS; ++i){
+			uint64_t ideal = uint64_t(clock) * i;              // in 1/baudrate cycles
+			uint64_t real = uint64_t(bit(0)) * i * baudrate;
+			uint64_t d = real > ideal ? real - ideal : ideal - real;
+			uint32_t e = static_cast<uint32_t>((d * 1000 + clock - 1) / clock);
+			if (e > worst) worst = e;
+		}
+		return worst;
+	}
+		/* the worst point of a frame against the ideal one, in 1/1000 bit (rounded up) */
+	static constexpr uint32_t error_permille(){
+		uint32_t worst = 0;
+		for (uint8_t h = 0; h <= 2 * SERIAL_FRAME_BITS + 1; ++h){
+			uint64_t ideal = uint64_t(clock) * h;                  // in 1/(2 baudrate) cycles
+			uint64_t real = uint64_t(at(h)) * 2 * baudrate;
+			uint64_t d = real > ideal ? real - ideal : ideal - real;
+			uint32_t e = static_cast<uint32_t>((d * 500 + clock - 1) / clock);
+			if (e > worst) worst = e;
+		}
+		return worst;
+	}
+};
+
+using SerialTiming = BitTiming<F_CPU, BAUDRATE>;   // in CPU cycles
+static_assert(SerialTiming::error_permille() <= 10 * MAXBITERROR, "BAUDRATE too fast for F_CPU");
+
+	// exactly 'cycles' CPU cycles, the avr-gcc builtin behind _delay_us()
+template <int32_t cycles>
+inline void serial_delay(){
+	static_assert(cycles >= 0, "bit too short for F_CPU, lower the BAUDRATE");
+	if (cycles > 0) __builtin_avr_delay_cycles(cycles);
+}
+
+	// blocking send_byte(): after bit i of the frame is out
+constexpr int32_t send_delay(uint8_t i){ return int32_t(SerialTiming::bit(i)) - SerialIOCycles; }
+	// recv_byte(): before data bit i (parity bit 8) is read, the first from the call on
+constexpr int32_t recv_delay(uint8_t i){
+	return i ? int32_t(SerialTiming::sample(i)) - SerialIOCycles : int32_t(SerialTiming::at(3)) - RxDLatency - SerialIOCycles;
+}
+
+
 
+#ifdef TxDInterrupt
+
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "ringbuf.h"
+
+#ifndef TxDBufferSize
+#define TxDBufferSize 8
+#endif
+
+#ifndef TxDTimerPrescale
+#define TxDTimerPrescale 1
+#endif
+
+#ifndef TxDMaxDelay
+#define TxDMaxDelay 0       // cycles other interrupts may keep the ISR waiting, at most
+#endif
+
+// frame as sent by the ISR, LSB first: start bit, 8 data bits, parity bit (if any), stop bit
+using TxDTiming = BitTiming<F_CPU / TxDTimerPrescale, BAUDRATE>;   // in Timer0 ticks
+constexpr uint8_t  TXD_FRAME_BITS { SERIAL_FRAME_BITS };
+constexpr uint16_t TXD_BIT_TICKS  { TxDTiming::bit(0) };                       // Timer0 ticks per bit
+constexpr uint16_t TXD_STOP_TICKS { TxDTiming::bit(SERIAL_FRAME_BITS - 1) };   // 1.5 stop bits
+// bits of the same length if that is close enough, else they differ by a tick (txd_ticks(), a few cycles more)
+constexpr bool     TXD_EVEN_BITS  { TxDTiming::even_error_permille() <= 10 * MAXBITERROR / 4 };
+constexpr uint8_t  TXD_LEAD_TICKS { 64 / TxDTimerPrescale + 2 };   // first start bit after send_byte() on an idle line
+constexpr uint8_t  TXD_ISR_CYCLES { 80 };   // the ISR with interrupt response and reti, a little more
+static_assert(TxDTiming::shortest() * TxDTimerPrescale >= TXD_ISR_CYCLES, "bit too short for the ISR, lower the BAUDRATE");
+static_assert(TxDTiming::error_permille() <= 10 * MAXBITERROR, "BAUDRATE too fast for the ticks of Timer0, use a smaller TxDTimerPrescale");
+static_assert((TXD_EVEN_BITS ? TxDTiming::even_error_permille() : TxDTiming::error_permille())
+              + 1000ULL * TxDMaxDelay * BAUDRATE / F_CPU <= 10 * MAXBITERROR, "TxDMaxDelay too long for MAXBITERROR");
+#ifdef TxDOverflow
+static_assert(TXD_STOP_TICKS < 256, "TxDOverflow needs the send ISR at least once per Timer0 round");
+#endif
+
+RingBuffer<uint16_t, TxDBufferSize> send_buffer;   // frames
+volatile uint16_t send_frame;    // bits of the current frame still to send
+volatile uint8_t send_bits;      // number of them, 0: line idle after the stop bit
+volatile uint8_t send_wraps;     // Timer0 rounds to wait until the next bit (slow Timer0)
+volatile uint8_t send_dropped;   // bytes lost because the buffer was full
+
+inline uint16_t send_frame_of(unsigned char b){
+	uint16_t frame = static_cast<uint16_t>(b) << 1;   // start bit is 0
+	#if PARITY == 0
+		frame |= 1 << 9;                               // stop bit
+	#else
+		uint8_t p = b ^ (b >> 4);
+		p ^= p >> 2;
+		p ^= p >> 1;
+		p = (p & 1) ^ (PARITY == 1);                   // even parity: number of ones incl. parity bit is even
+		frame |= static_cast<uint16_t>(p) << 9 | 1 << 10;
+	#endif
+	SIM_CHARGE(PARITY ? 24 : 8);
+	return frame;
+}
+
+	// ticks of the data and parity bits by the number of bits that follow them
+struct TxDTicks {
+	uint16_t ticks[TXD_FRAME_BITS];
+	constexpr TxDTicks() : ticks{} {
+		for (uint8_t bits = 1; bits < TXD_FRAME_BITS; ++bits) ticks[bits] = TxDTiming::bit(TXD_FRAME_BITS - 1 - bits);
+	}
+};
+constexpr TxDTicks txd_tick_table PROGMEM {};
+
+inline uint16_t txd_ticks(uint8_t bits){
+	if (TXD_EVEN_BITS) return TXD_BIT_TICKS;
+	SIM_CHARGE(avrcost::add<uint16_t>() + 1);
+	return pgm_read_word(&txd_tick_table.ticks[bits]);
+}
+
+	// Timer0 ticks to the next bit
+inline void send_schedule(uint16_t ticks){
+	OCR0A = OCR0A + static_cast<uint8_t>(ticks);      // 0 is a whole round
+	if (TXD_STOP_TICKS > 256) send_wraps = (ticks - 1) >> 8;
+}
+
+ISR(TIMER0_COMPA_vect){
+	if ((TXD_STOP_TICKS > 256) && send_wraps){
+		send_wraps--;
+		return;
+	}
+	uint8_t bits = send_bits;
+	if (!bits){                                        // stop bit is over and nothing to send
+		#ifdef TxDOverflow
+			TIMSK = (TIMSK & ~(1<<OCIE0A)) | 1<<TOIE0;
+		#else
+			TIMSK &= ~(1<<OCIE0A);
+		#endif
+		return;
+	}
+	uint16_t frame = send_frame;
+	if (frame & 1) TxDPort |= TxDBit;                  // first thing, keeps the jitter low
+	else           TxDPort &= ~TxDBit;
+	#ifdef TxDOverflow
+		if (TIFR & (1<<TOV0)){                         // count it here, the overflow ISR is off while sending
+			TIFR = 1<<TOV0;
+			TxDOverflow();
+		}
+		SIM_CHARGE(avrcost::BRANCH + 1);
+	#endif
+	frame >>= 1;
+	if (--bits){
+		send_schedule(txd_ticks(bits));
+	} else {                                           // that was the stop bit, fetch the next frame
+		send_schedule(TXD_STOP_TICKS);
+		if (send_buffer.pop(frame)) bits = TXD_FRAME_BITS;
+	}
+	send_frame = frame;
+	send_bits = bits;
+	SIM_CHARGE(2*avrcost::ld<uint16_t>() + 2*avrcost::st<uint16_t>() + 4*avrcost::BRANCH + 4);
+}
 
 void init_send(){
 	TxDDDRRegister |= TxDBit;  // set pin as output
 	TxDPort        |= TxDBit;  // default state is HIGH
+	send_bits = 0;
 }
 
-void init_recv(){
-	RxDDDRRegister &= ~RxDBit; // set pin an input
-	RxDPullup      &= ~RxDBit; // disable Pullup resistor
+void send_byte(unsigned char b){
+	uint16_t frame = send_frame_of(b);
+	#ifdef TxDWaitWhenFull
+		while (send_buffer.full()){   // only the ISR takes from it
+			SIM_CHARGE(avrcost::ld<uint8_t>() + avrcost::LOOP);
+		}
+	#endif
+	uint8_t sreg = SREG;
+	if (!send_buffer.push(frame)){                    // lock-free, the ISR may send meanwhile
+		#ifdef TxDDropOldest
+			cli();
+			uint16_t oldest;
+			send_buffer.pop(oldest);
+			send_buffer.push(frame);
+			SREG = sreg;
+		#endif
+		send_dropped++;
+	}
+	cli();                                             // only to start the ISR if it doesn't fetch the frame itself
+	uint16_t next;
+	// line idle, start the ISR. the frame may be out already: interrupts held up the way here,
+	// meanwhile the ISR sent it and found nothing more
+	if (!(TIMSK & (1<<OCIE0A)) && send_buffer.pop(next)){
+		send_frame = next;
+		send_bits = TXD_FRAME_BITS;
+		send_wraps = 0;
+		OCR0A = TCNT0 + TXD_LEAD_TICKS;
+		TIFR = 1<<OCF0A;
+		#ifdef TxDOverflow
+			TIMSK = (TIMSK & ~(1<<TOIE0)) | 1<<OCIE0A;
+		#else
+			TIMSK |= 1<<OCIE0A;
+		#endif
+	} else if (!send_bits && send_buffer.pop(next)){   // last stop bit running, start right after it
+		send_frame = next;
+		send_bits = TXD_FRAME_BITS;
+	}
+	SREG = sreg;
+}
+
+	// wait until all bytes have been sent
+void flush_send(){
+	while (TIMSK & (1<<OCIE0A)) {}
+}
+
+#else   // TxDInterrupt
+
+void init_send(){
+	TxDDDRRegister |= TxDBit;  // set pin as output
+	TxDPort        |= TxDBit;  // default state is HIGH
 }
 
 
@@ -135,25 +418,25 @@ void send_byte(unsigned char b){
 
 	#if PARITY == 0
 		TxDPort = zero;            // start bit
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(0)>();
 		TxDPort = b0;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(1)>();
 		TxDPort = b1;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(2)>();
 		TxDPort = b2;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(3)>();
 		TxDPort = b3;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(4)>();
 		TxDPort = b4;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(5)>();
 		TxDPort = b5;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(6)>();
 		TxDPort = b6;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(7)>();
 		TxDPort = b7;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(8)>();
 		TxDPort = one;          // 1.5 stop bits
-		_delay_us(1.5 * BITDELAY);
+		serial_delay<send_delay(9)>();
 
 	#else
 		unsigned char parity = b0 ^ b1 ^ b2 ^ b3 ^ b4 ^ b5 ^ b6 ^ b7;
@@ -164,30 +447,192 @@ void send_byte(unsigned char b){
 
 
 		TxDPort = zero;            // start bit
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(0)>();
 		TxDPort = b0;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(1)>();
 		TxDPort = b1;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(2)>();
 		TxDPort = b2;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(3)>();
 		TxDPort = b3;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(4)>();
 		TxDPort = b4;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(5)>();
 		TxDPort = b5;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(6)>();
 		TxDPort = b6;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(7)>();
 		TxDPort = b7;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(8)>();
 		TxDPort = parity;
-		_delay_us(BITDELAY);
+		serial_delay<send_delay(9)>();
 		TxDPort = one;          // 1.5 stop bits
-		_delay_us(1.5 * BITDELAY);
+		serial_delay<send_delay(10)>();
 	#endif
 }
 
+#endif  // TxDInterrupt
+
+
+
+namespace telemetry {
+
+	constexpr uint8_t SYNC         { 0xA5 };
+	constexpr uint8_t TYPE_SAMPLES   { 0x01 };
+	constexpr uint8_t TYPE_TRACE     { 0x02 };
+	constexpr uint8_t TYPE_STATUS    { 0x03 };
+	constexpr uint8_t TYPE_PROFILE   { 0x04 };
+	constexpr uint8_t TYPE_HISTOGRAM { 0x05 };
+	constexpr uint8_t TYPE_PARAMETER { 0x06 };
+	constexpr uint8_t NO_CHANNEL     { 0xFF };
+
+		/* CRC-8, polynomial x^8 + x^2 + x + 1 (0x07) */
+	inline uint8_t crc8_update(uint8_t crc, uint8_t b){
+		crc ^= b;
+		for (uint8_t i = 0; i < 8; ++i){
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+		}
+		SIM_CHARGE(8 * 5);
+		return crc;
+	}
+
+	inline uint16_t zigzag(int16_t v){
+		return (static_cast<uint16_t>(v) << 1) ^ static_cast<uint16_t>(v >> 15);
+	}
+
+
+		/* writes one frame at a time, see TELEMETRY above.
+		   nothing is buffered: begin() sends the header, put() and varint() the
+		   payload, end() the crc. all frames share the sequence number.
+		   the encoders spread a frame over several calls, another frame may
+		   only begin when idle() */
+	class Frame {
+	public:
+		static void begin(uint8_t type, uint8_t count){
+			static uint8_t seq = 0;
+			send_byte(SYNC);
+			_open = true;
+			_crc = 0;
+			put(seq++);
+			put(type);
+			put(count);
+		}
+		static void put(uint8_t b){
+			_crc = crc8_update(_crc, b);
+			send_byte(b);
+		}
+		static void varint(uint16_t v){
+			while (v >= 0x80){
+				put(static_cast<uint8_t>(v) | 0x80);
+				v >>= 7;
+				SIM_CHARGE(avrcost::shift<uint16_t>(7) + avrcost::BRANCH);
+			}
+			put(static_cast<uint8_t>(v));
+		}
+		static void end(){
+			send_byte(_crc);
+			_open = false;
+		}
+		static bool idle(){ return !_open; }
+
+	private:
+		static uint8_t _crc;
+		static bool _open;
+	};
+	uint8_t Frame::_crc;
+	bool Frame::_open;
+
+
+		/* samples (distance, output, channel), samples_per_frame per frame */
+	template <uint8_t samples_per_frame = 8>
+	class Encoder {
+		static_assert(samples_per_frame >= 1, "a frame needs at least one sample");
+	public:
+		Encoder() : _count(0), _distance(0), _output(0), _channel(NO_CHANNEL) {}
+
+		void sample(uint16_t distance, uint16_t output, uint8_t channel){
+			if (_count == 0){
+				Frame::begin(TYPE_SAMPLES, samples_per_frame);
+				Frame::varint(distance);
+				Frame::varint(output);
+				Frame::put(channel);
+			} else {
+				uint8_t changed = (channel != _channel) ? 0x40 : 0;
+				uint16_t d = zigzag(distance - _distance);
+				uint16_t o = zigzag(output - _output);
+				if (d < 0x80 && o < 0x80){
+					Frame::put(changed | static_cast<uint8_t>(d >> 1));
+					Frame::put(static_cast<uint8_t>(d << 7) | static_cast<uint8_t>(o));
+				} else {
+					Frame::put(0x80 | changed);
+					Frame::varint(d);
+					Frame::varint(o);
+				}
+				if (changed) Frame::put(channel);
+				SIM_CHARGE(4*avrcost::add<uint16_t>() + 4*avrcost::BRANCH + 6);
+			}
+			_distance = distance;
+			_output = output;
+			_channel = channel;
+			if (++_count == samples_per_frame){
+				Frame::end();
+				_count = 0;
+			}
+		}
+
+	private:
+		uint8_t _count;       // samples sent in the current frame
+		uint16_t _distance;   // previous sample
+		uint16_t _output;
+		uint8_t _channel;
+	};
+
+
+		/* count values at once as a frame of the given type. only if Frame::idle() */
+	inline void values(uint8_t type, const uint16_t* values, uint8_t count){
+		Frame::begin(type, count);
+		for (uint8_t i = 0; i < count; ++i){
+			Frame::varint(values[i]);
+		}
+		Frame::end();
+	}
+
+		/* counters of the firmware */
+	inline void status(const uint16_t* values, uint8_t count){
+		telemetry::values(TYPE_STATUS, values, count);
+	}
+
+
+		/* raw readouts with time stamps for offline replay (sim/replay.cpp),
+		   records_per_frame per frame */
+	template <uint8_t records_per_frame = 16>
+	class TraceEncoder {
+		static_assert(records_per_frame >= 1, "a frame needs at least one record");
+	public:
+		TraceEncoder() : _count(0) {}
+
+			/* dt: timer ticks since the previous record, echo: timer ticks, 0 if there was none */
+		void record(uint16_t dt, uint16_t echo){
+			if (_count == 0) Frame::begin(TYPE_TRACE, records_per_frame);
+			Frame::varint(dt);
+			Frame::varint(echo);
+			if (++_count == records_per_frame){
+				Frame::end();
+				_count = 0;
+			}
+		}
+
+	private:
+		uint8_t _count;       // records sent in the current frame
+	};
+
+}
+
+void init_recv(){
+	RxDDDRRegister &= ~RxDBit; // set pin an input
+	RxDPullup      &= ~RxDBit; // disable Pullup resistor
+}
+
 int recv_byte(){
 	#ifndef NOCHECKSTARTBIT
 	if(RxDPort & RxDBit){
@@ -197,42 +642,41 @@ int recv_byte(){
 
 	unsigned char b0, b1, b2, b3, b4, b5, b6, b7, parity, oddeven, retval;
 	#if PARITY == 0
-		_delay_us(FRSTBITDELAY);
+		serial_delay<recv_delay(0)>();
 		b0 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(1)>();
 		b1 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(2)>();
 		b2 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(3)>();
 		b3 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(4)>();
 		b4 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(5)>();
 		b5 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(6)>();
 		b6 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(7)>();
 		b7 = RxDPort;
 
 	#else
-		unsigned char parity;
-		_delay_us(FRSTBITDELAY);
+		serial_delay<recv_delay(0)>();
 		b0 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(1)>();
 		b1 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(2)>();
 		b2 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(3)>();
 		b3 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(4)>();
 		b4 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(5)>();
 		b5 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(6)>();
 		b6 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(7)>();
 		b7 = RxDPort;
-		_delay_us(BITDELAY);
+		serial_delay<recv_delay(8)>();
 		parity = RxDPort;
 	#endif
 	
@@ -267,5 +711,10 @@ int recv_byte(){
 	return retval;
 }
 
+	// after recv_byte(): on to the middle of the stop bit
+inline void recv_stop(){
+	serial_delay<int32_t(SerialTiming::sample(SERIAL_FRAME_BITS - 2))>();
+}
+
 
 #endif
\ No newline at end of file
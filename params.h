@@ -0,0 +1,178 @@
+/*
+ * params.h
+ *
+ * parameters that can be changed at run time and are kept in the EEPROM.
+ * a Store holds 'count' uint16_t values in RAM, an Info table in flash has
+ * their initial values and limits. load() takes them from a Block in the
+ * EEPROM (version, values, CRC-8), or the initial values if the block is of
+ * another version, broken or was never written. set() checks the limits and
+ * 'consistent', a function over all the values for the rules between them
+ * (e.g. a minimum below its maximum), commit() writes the block back: only the bytes that changed, but each of
+ * them takes ~3.4 ms in which the caller waits. bump the version whenever the
+ * list of parameters changes.
+ *
+ * a Console decodes commands that come in byte by byte (e.g. from recv_byte()),
+ * 5 bytes each:
+ *   op | index | value low | value high | crc
+ * op is 'g' (get), 's' (set), 'c' (commit to the EEPROM), 'd' (the initial
+ * values, not committed) or 'p' (the profile, see profile.h: the caller answers
+ * it, there is no answer without PROFILING), crc the CRC-8 of telemetry
+ * (myserial.h) over the first four. bytes in front of a command are skipped, a broken command is
+ * lost: the sender repeats it if no answer comes. the answer is a telemetry
+ * frame of TYPE_PARAMETER, see Console::execute().
+ *
+ * include it after myserial.h (like profile.h).
+ */
+
+#ifndef __params_h__
+#define __params_h__
+
+#include <stdint.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+#ifndef SIM_CHARGE
+#define SIM_CHARGE(cycles)  // cycle cost annotation for the host simulator, see mydefs.h
+#endif
+
+namespace params {
+
+	struct Info { uint16_t initial, min, max; };   // in flash
+
+	constexpr uint8_t ALL { 0xFF };   // index of the answers to 'c' and 'd'
+
+	template <uint8_t count, uint8_t block_version, const Info* info, bool (*consistent)(const uint16_t* value)>
+	class Store {
+	public:
+		struct Block {
+			uint8_t version;
+			uint8_t crc;        // of version and values
+			uint16_t value[count];
+		};
+
+			/* from the EEPROM. values out of their limits get the initial one, all of
+			   them if they aren't consistent then */
+		void load(const Block* eeprom){
+			Block b;
+			eeprom_read_block(&b, eeprom, sizeof(b));
+			bool valid = b.version == block_version && b.crc == crc(b);
+			for (uint8_t i = 0; i < count; ++i){
+				_value[i] = valid && within(i, b.value[i]) ? b.value[i] : initial(i);
+			}
+			if (!consistent(_value)) defaults();
+		}
+
+		void commit(Block* eeprom) const {
+			Block b;
+			b.version = block_version;
+			for (uint8_t i = 0; i < count; ++i) b.value[i] = _value[i];
+			b.crc = crc(b);
+			eeprom_update_block(&b, eeprom, sizeof(b));
+		}
+
+		void defaults(){
+			for (uint8_t i = 0; i < count; ++i) _value[i] = initial(i);
+		}
+
+		uint16_t get(uint8_t i) const { return _value[i]; }
+		static constexpr uint8_t size(){ return count; }
+
+			/* false if i or the value are out of range or the value doesn't fit the
+			   others, the old one stays then */
+		bool set(uint8_t i, uint16_t value){
+			if (i >= count || !within(i, value)) return false;
+			uint16_t old = _value[i];
+			_value[i] = value;
+			if (!consistent(_value)){
+				_value[i] = old;
+				return false;
+			}
+			return true;
+		}
+
+		static uint16_t initial(uint8_t i){ return pgm_read_word(&info[i].initial); }
+		static uint16_t min(uint8_t i){ return pgm_read_word(&info[i].min); }
+		static uint16_t max(uint8_t i){ return pgm_read_word(&info[i].max); }
+
+	private:
+		static bool within(uint8_t i, uint16_t value){ return value >= min(i) && value <= max(i); }
+
+		static uint8_t crc(const Block& b){
+			uint8_t c = telemetry::crc8_update(0, b.version);
+			for (uint8_t i = 0; i < count; ++i){
+				c = telemetry::crc8_update(c, static_cast<uint8_t>(b.value[i]));
+				c = telemetry::crc8_update(c, static_cast<uint8_t>(b.value[i] >> 8));
+			}
+			return c;
+		}
+
+		uint16_t _value[count];
+	};
+
+
+	struct Command {
+		uint8_t op;
+		uint8_t index;
+		uint16_t value;
+	};
+
+	class Console {
+	public:
+			/* the next received byte. true if it completes a command */
+		bool input(uint8_t b){
+			for (uint8_t i = 0; i < sizeof(_window) - 1; ++i) _window[i] = _window[i + 1];
+			_window[sizeof(_window) - 1] = b;
+			uint8_t op = _window[0];
+			if (op != 'g' && op != 's' && op != 'c' && op != 'd' && op != 'p') return false;
+			uint8_t c = 0;
+			for (uint8_t i = 0; i < sizeof(_window) - 1; ++i) c = telemetry::crc8_update(c, _window[i]);
+			if (c != b) return false;
+			_command = Command{ op, _window[1], static_cast<uint16_t>(_window[2] | _window[3] << 8) };
+			for (uint8_t& w : _window) w = 0;   // not again
+			return true;
+		}
+
+		const Command& command() const { return _command; }
+
+			/* executes the command on the store and answers with a frame of TYPE_PARAMETER:
+			   (index, value, min, max) after 'g' and 's' (the value is the old one if it was
+			   out of limits or inconsistent), (index) alone if there is no such parameter, (ALL, version)
+			   after 'c' and 'd', nothing after 'p'. true if the values changed. up to 15
+			   bytes, call it when the send buffer is empty */
+		template <typename Store>
+		bool execute(Store& store, typename Store::Block* eeprom, uint8_t version){
+			const Command& c = _command;
+			bool changed = false;
+			if (c.op == 'p') return false;   // for the caller
+			if (c.op == 'c' || c.op == 'd'){
+				if (c.op == 'c'){
+					store.commit(eeprom);
+				} else {
+					store.defaults();
+					changed = true;
+				}
+				uint16_t answer[] { ALL, version };
+				telemetry::values(telemetry::TYPE_PARAMETER, answer, 2);
+				return changed;
+			}
+			if (c.op == 's') changed = store.set(c.index, c.value);
+			uint16_t answer[4] { c.index };
+			uint8_t n = 1;
+			if (c.index < store.size()){
+				answer[1] = store.get(c.index);
+				answer[2] = store.min(c.index);
+				answer[3] = store.max(c.index);
+				n = 4;
+			}
+			telemetry::values(telemetry::TYPE_PARAMETER, answer, n);
+			return changed;
+		}
+
+	private:
+		uint8_t _window[5] {};   // the last bytes
+		Command _command {};
+	};
+
+}
+
+#endif
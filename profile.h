@@ -0,0 +1,149 @@
+/*
+ * profile.h
+ *
+ * opt-in timing of a hot path on the chip. define PROFILING as the number of
+ * the probe to time and PROFILE_CLOCK() (a free running uint16_t time stamp,
+ * callable with interrupts enabled or not) and include it after myserial.h, then
+ *   PROFILE_STATS()          once, the statistics (profiler)
+ *   PROFILE_ISR_BEGIN(now)   at the top of an ISR, with its first time stamp
+ *   PROFILE_ISR_END(probe)   later in the same ISR: times it up to here (more than once is fine)
+ *   PROFILE_BEGIN(probe) ... PROFILE_END(probe)   around a stage of the main loop
+ *   PROFILE_COLLECT()        in the main loop, often enough for the queue (see below)
+ * only the probe PROFILING is timed, the macros of all others are no code: its
+ * statistics take 19 bytes of RAM and the queue another 10, the ones of all
+ * probes wouldn't fit into the 256 bytes of an ATtiny45 next to the rest.
+ *
+ * the statistics are count, min, max and sum of the durations in clock ticks and
+ * a histogram of log2 buckets: < 2, < 4, ... < 128 and the rest. they take too
+ * long for an ISR: it only queues the duration, profiler.collect() in the main
+ * loop adds them up (durations that don't fit into the queue are counted as
+ * lost). profiler.report() sends them as telemetry frames (see TELEMETRY in
+ * myserial.h) and starts over.
+ *
+ * the time stamps are taken inside the ISR, the prologue and the way to the
+ * vector aren't included. nested ISRs count for the one they interrupt, the
+ * stages of the main loop include the ISRs in between.
+ * the serial output has no time to spare for the profiler: put PROFILE_ISR_END()
+ * where interrupts are enabled, e.g. before the final cli() of an ISR, so the
+ * short atomic push is the only thing that may delay it.
+ *
+ * without PROFILING all macros are empty, so the same source goes into
+ * production with it off.
+ */
+
+#ifndef __profile_h__
+#define __profile_h__
+
+#ifdef PROFILING
+
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include "ringbuf.h"
+
+#ifndef SIM_CHARGE
+#define SIM_CHARGE(cycles)  // cycle cost annotation for the host simulator, see mydefs.h
+#endif
+
+namespace profile {
+
+	constexpr uint8_t BUCKETS   { 8 };
+	constexpr uint8_t MAX_SHARE { 0x7F };   // the histogram is halved when a bucket gets there (one byte varints)
+
+	struct Stats {
+		uint16_t count;
+		uint16_t min;
+		uint16_t max;
+		uint32_t sum;
+		uint8_t histogram[BUCKETS];
+		volatile uint8_t lost;   // durations the queue had no room for
+
+		void add(uint16_t ticks){
+			if (count == 0 || ticks < min) min = ticks;
+			if (ticks > max) max = ticks;
+			if (count != 0xFFFF){
+				count++;
+				sum += ticks;
+			}
+			uint8_t b = 0;
+			for (uint16_t t = ticks; t >= 2 && b < BUCKETS - 1; t >>= 1) b++;
+			if (++histogram[b] == MAX_SHARE){   // keep the shape, forget the old ones faster
+				for (uint8_t& h : histogram) h >>= 1;
+			}
+			SIM_CHARGE(3*avrcost::add<uint16_t>() + avrcost::add<uint32_t>() + 4*avrcost::BRANCH
+			           + b*(avrcost::shift<uint16_t>(1) + avrcost::LOOP) + 2*avrcost::ld<uint32_t>() + 2*avrcost::st<uint32_t>() + 6);
+		}
+	};
+
+	template <uint8_t probe>
+	class Profiler {
+	public:
+			/* from the ISRs, interrupts enabled or not. they may interrupt each other,
+			   so the push is atomic */
+		void queue(uint16_t ticks){
+			uint8_t sreg = SREG;
+			cli();
+			if (!_queue.push(ticks)) _stats.lost++;
+			SREG = sreg;
+			SIM_CHARGE(avrcost::st<uint16_t>() + avrcost::BRANCH + 6);
+		}
+
+			/* main loop */
+		void add(uint16_t ticks){
+			_stats.add(ticks);
+		}
+
+			/* the queued durations into the statistics. main loop */
+		void collect(){
+			uint16_t ticks;
+			while (_queue.pop(ticks)) _stats.add(ticks);
+		}
+
+			/* one frame per call: (probe, count, min, mean, max, lost) with TYPE_PROFILE,
+			   then (probe, histogram) with TYPE_HISTOGRAM. both fit into the send
+			   buffer as long as the times stay below 2^14 ticks, call it when it is
+			   empty. true after the last one */
+		bool report(){
+			collect();
+			const Stats& s = _stats;
+			if (!_histogram){
+				uint16_t values[] { probe, s.count, s.min, s.count ? static_cast<uint16_t>(s.sum / s.count) : uint16_t(0), s.max, s.lost };
+				telemetry::values(telemetry::TYPE_PROFILE, values, sizeof(values) / sizeof(values[0]));
+				SIM_CHARGE(avrcost::DIV_U32);
+				_histogram = true;
+				return false;
+			}
+			uint16_t values[BUCKETS + 1] { probe };
+			for (uint8_t b = 0; b < BUCKETS; ++b) values[b + 1] = s.histogram[b];
+			telemetry::values(telemetry::TYPE_HISTOGRAM, values, BUCKETS + 1);
+			_stats = Stats{};
+			_histogram = false;
+			return true;
+		}
+
+	private:
+		Stats _stats {};
+		RingBuffer<uint16_t, 4> _queue;
+		bool _histogram { false };   // the next frame
+	};
+
+}
+
+#define PROFILE_STATS()        profile::Profiler<PROFILING> profiler;
+#define PROFILE_ISR_BEGIN(now) uint16_t _profile_isr = now;
+#define PROFILE_ISR_END(p)     if ((p) == PROFILING){ profiler.queue(PROFILE_CLOCK() - _profile_isr); }
+#define PROFILE_BEGIN(p)       uint16_t _profile_##p = (p) == PROFILING ? PROFILE_CLOCK() : 0;
+#define PROFILE_END(p)         if ((p) == PROFILING){ profiler.add(PROFILE_CLOCK() - _profile_##p); }
+#define PROFILE_COLLECT()      profiler.collect();
+
+#else   // PROFILING
+
+#define PROFILE_STATS()
+#define PROFILE_ISR_BEGIN(now)
+#define PROFILE_ISR_END(p)
+#define PROFILE_BEGIN(p)
+#define PROFILE_END(p)
+#define PROFILE_COLLECT()
+
+#endif
+
+#endif
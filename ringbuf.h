@@ -0,0 +1,55 @@
+/*
+ * ringbuf.h
+ *
+ * lock-free ring buffer for exactly one producer and one consumer, typically
+ * an ISR on one side and the main loop on the other.
+ * head is only written by the producer, tail only by the consumer. both are
+ * single bytes, so reading and writing them is atomic on the AVR and no
+ * interrupts need to be disabled.
+ */
+
+#ifndef __ringbuf_h__
+#define __ringbuf_h__
+
+#include <stdint.h>
+
+// keep the compiler from moving memory accesses across this point
+#define MEMORY_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+template <typename T, uint8_t size>
+class RingBuffer {
+	static_assert(size >= 1 && size <= 128 && !(size & (size - 1)), "size must be a power of two <= 128");
+public:
+	RingBuffer() : _head(0), _tail(0) {}
+
+		/* producer side. returns false if the buffer is full (value is dropped) */
+	bool push(const T& value){
+		uint8_t h = _head;
+		if (static_cast<uint8_t>(h - _tail) == size) return false;
+		_buf[h & (size - 1)] = value;
+		MEMORY_BARRIER();   // value must be stored before it is published
+		_head = h + 1;
+		return true;
+	}
+
+		/* consumer side. returns false if the buffer is empty */
+	bool pop(T& value){
+		uint8_t t = _tail;
+		if (t == _head) return false;
+		MEMORY_BARRIER();
+		value = _buf[t & (size - 1)];
+		MEMORY_BARRIER();   // value must be read before the slot is released
+		_tail = t + 1;
+		return true;
+	}
+
+	bool empty() const { return _head == _tail; }
+	bool full() const { return static_cast<uint8_t>(_head - _tail) == size; }
+
+private:
+	T _buf[size];
+	volatile uint8_t _head;   // next slot to write, free running
+	volatile uint8_t _tail;   // next slot to read, free running
+};
+
+#endif
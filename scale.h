@@ -0,0 +1,176 @@
+/*
+ * scale.h
+ *
+ * musical scales for the Timer1 tone generator.
+ *
+ * every scale is a table in flash with the best (prescaler, OCR1C) pair for
+ * each of its notes, computed by the compiler for the given F_CPU (equal
+ * temperament, A4 = 440Hz). the playing range is split into bands of equal
+ * width, one band per note, with the highest note closest to the sensor.
+ * A Quantizer snaps a distance to a note. it only leaves the current note if
+ * the distance is more than a quarter band (at least a tick) outside of it, so
+ * sensor noise at a band border doesn't make the tone flutter.
+ * the scale can be changed at run time with Quantizer::select().
+ */
+
+#ifndef __scale_h__
+#define __scale_h__
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "tone.h"
+
+namespace scale {
+
+	/* compile time math */
+
+		/* 2^x for 0 <= x, exact enough for tuning tables */
+	constexpr double exp2(double x){
+		double r = 1;
+		while (x >= 1){ r *= 2; x -= 1; }
+		double term = 1, sum = 1;   // e^(x*ln2) as series, x < 1
+		for (uint8_t i = 1; i < 24; ++i){
+			term *= x * 0.69314718055994531 / i;
+			sum += term;
+		}
+		return r * sum;
+	}
+
+		/* frequency of a midi note */
+	constexpr double note_frequency(double midi_note){
+		return midi_note >= 69 ? 440.0 * exp2((midi_note - 69) / 12) : 440.0 / exp2((69 - midi_note) / 12);
+	}
+
+		/* register values for a frequency (Timer1 in sync mode, clocked with f_cpu):
+		   smallest prescaler that fits the period into 8 bit -> best resolution */
+	constexpr tone::Entry tone_entry(uint32_t f_cpu, double frequency){
+		double ticks = f_cpu / frequency;
+		uint8_t prescale = 1;
+		while (ticks > 256 && prescale < 15){ ticks /= 2; ++prescale; }
+		uint16_t period = static_cast<uint16_t>(ticks + 0.5);
+		if (period > 256) period = 256;
+		return tone::Entry{ prescale, static_cast<uint8_t>(period - 1) };
+	}
+
+		/* semitone masks, bit n = n semitones above the root */
+	constexpr uint16_t CHROMATIC  { 0x0FFF };
+	constexpr uint16_t MAJOR      { 1<<0 | 1<<2 | 1<<4 | 1<<5 | 1<<7 | 1<<9 | 1<<11 };
+	constexpr uint16_t MINOR      { 1<<0 | 1<<2 | 1<<3 | 1<<5 | 1<<7 | 1<<8 | 1<<10 };   // natural minor
+	constexpr uint16_t PENTATONIC { 1<<0 | 1<<2 | 1<<4 | 1<<7 | 1<<9 };                  // major pentatonic
+
+	constexpr bool in_scale(uint16_t mask, uint8_t subdivision, uint16_t step){
+		return subdivision > 1 || (mask >> (step % 12)) & 1;
+	}
+
+	constexpr uint16_t count_notes(uint16_t mask, uint8_t subdivision, uint8_t octaves){
+		uint16_t n = 0;
+		for (uint16_t s = 0; s <= uint16_t(12) * subdivision * octaves; ++s) n += in_scale(mask, subdivision, s);
+		return n;
+	}
+
+
+		/* note table of a scale
+		   mask:        semitones of the scale (ignored if subdivision > 1)
+		   subdivision: steps per semitone. > 1 gives an (almost) continuous equal tempered glide
+		   octaves:     range, starting at lowest_note (midi note number, 72 = C5) */
+	template <uint32_t f_cpu, uint16_t mask, uint8_t subdivision = 1, uint8_t octaves = 3, uint8_t lowest_note = 72>
+	struct Table {
+		static constexpr uint16_t SIZE { count_notes(mask, subdivision, octaves) };
+
+		tone::Entry note[SIZE];
+
+		constexpr Table() : note{} {
+			uint16_t n = 0;
+			for (uint16_t s = 0; s <= uint16_t(12) * subdivision * octaves; ++s){
+				if (in_scale(mask, subdivision, s)){
+					note[n++] = tone_entry(f_cpu, note_frequency(lowest_note + double(s) / subdivision));
+				}
+			}
+		}
+	};
+
+
+		/* what a Quantizer needs to know about a scale. lives in flash */
+	struct Info {
+		const tone::Entry* notes;   // table in flash
+		uint16_t size;              // number of notes
+		uint16_t width;             // band width per note in timer ticks
+		uint16_t hysteresis;        // distance to leave a band
+	};
+
+		/* a quarter band of hysteresis, at least a tick: with TIMING_COARSE the
+		   bands of the continuous scale are only 2 ticks wide */
+	template <typename Table>
+	constexpr Info info(const Table& table, uint16_t max_distance){
+		return Info{ table.note, Table::SIZE, static_cast<uint16_t>(max_distance / Table::SIZE),
+		             static_cast<uint16_t>(max_distance / Table::SIZE / 4 ? max_distance / Table::SIZE / 4 : 1) };
+	}
+
+
+	class Quantizer {
+	public:
+		Quantizer() : _s{ nullptr, 0, 0, 0 }, _note(0), _low(0) {}
+
+			/* switch to another scale. info must be in flash */
+		void select(const Info* info){
+			memcpy_P(&_s, info, sizeof(Info));
+			_note = 0;
+			_low = 0;
+		}
+
+			/* register values of the note for a readout (distance < max_distance).
+			   the neighbour of the current note is a step, a jump (and the first
+			   readout after select()) a division */
+		tone::Tone map(uint16_t distance, uint16_t max_distance){
+			uint16_t pos = max_distance - 1 - distance;   // near means high
+			SIM_CHARGE(5*avrcost::add<uint16_t>() + 3*avrcost::BRANCH);
+			if (pos + _s.hysteresis < _low){                      // down to the highest band within hysteresis
+				uint16_t p = pos + _s.hysteresis;
+				SIM_CHARGE(2*avrcost::add<uint16_t>() + avrcost::BRANCH);
+				if (p + _s.width >= _low){
+					--_note;
+					_low -= _s.width;
+					SIM_CHARGE(2*avrcost::add<uint16_t>());
+				} else {
+					enter(p);
+				}
+			} else if (_note < _s.size - 1 && pos >= _low + _s.width + _s.hysteresis){   // up to the lowest one
+				uint16_t p = pos - _s.hysteresis;
+				SIM_CHARGE(2*avrcost::add<uint16_t>() + avrcost::BRANCH);
+				if (p < _low + 2 * _s.width){
+					++_note;
+					_low += _s.width;
+					SIM_CHARGE(2*avrcost::add<uint16_t>());
+				} else {
+					enter(p);
+				}
+			}
+			const tone::Entry* e = &_s.notes[_note];
+			uint8_t period = pgm_read_byte(&e->period);
+			SIM_CHARGE(avrcost::add<uint16_t>() + 8);
+			return tone::Tone{ pgm_read_byte(&e->prescale), period, static_cast<uint8_t>(period / 2) };
+		}
+
+		uint16_t note() const { return _note; }
+
+	private:
+			/* the band of position p, the highest one if p is beyond it */
+		void enter(uint16_t p){
+			_note = p / _s.width;
+			_low = p - p % _s.width;   // one call of __udivmodhi4 for both
+			if (_note >= _s.size){
+				_note = _s.size - 1;
+				_low = _note * _s.width;
+				SIM_CHARGE(avrcost::MUL_U16);
+			}
+			SIM_CHARGE(avrcost::DIV_U16 + avrcost::add<uint16_t>() + avrcost::BRANCH + avrcost::CALL);
+		}
+
+		Info _s;            // copy of the current scale
+		uint16_t _note;     // current note
+		uint16_t _low;      // lower end of its band (= _note * width)
+	};
+
+}
+
+#endif
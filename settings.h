@@ -0,0 +1,47 @@
+/*
+ * settings.h
+ *
+ * the settings of the smoothing in main.cpp (SMOOTH_ modes, see filters.h)
+ * and the ping rate and glide they depend on, in Timer0 ticks of timing.h.
+ * sim/replay runs the traces through the same numbers, it defines TRACE_OUTPUT
+ * like the firmware that records them.
+ */
+
+#ifndef __settings_h__
+#define __settings_h__
+
+#include <stdint.h>
+#include "timing.h"
+
+// target rate of the pings [1/s], the serial output takes what it can carry
+#if defined(TRACE_OUTPUT)
+constexpr uint16_t PING_RATE{ 150 };          // a trace record takes ~4.5 bytes, 9600 baud carry ~900 bytes/s
+#elif defined(DEBUG_OUTPUT) || defined(SMOOTH_CMI)
+constexpr uint16_t PING_RATE{ 200 };          // a debug sample takes ~3 bytes, the rest of the ~900 bytes/s for the frames
+#else
+constexpr uint16_t PING_RATE{ 400 };
+#endif
+
+// time constant of the portamento (tone::Glide), 0 jumps
+constexpr uint8_t GLIDE_MS{ 8 };
+
+constexpr uint8_t OLD_AVR_PERCENTAGE{ 80 };
+constexpr uint8_t NO_AVERAGE{ 16 };      // a power of two: a shift instead of a division (20 cost ~250 cycles, 16 ~34)
+constexpr uint8_t MEDIAN_LENGTH{ 5 };    // odd. spikes of up to MEDIAN_LENGTH / 2 readouts are dropped
+constexpr uint8_t MEDIAN_MEAN{ 4 };      // readouts averaged after the median, 1: none
+constexpr uint8_t TRACKER_ALPHA{ 3 };    // gains of the tracker as shifts (1/8, 1/128), see filter::Tracker and make replay
+constexpr uint8_t TRACKER_BETA{ 7 };
+constexpr uint16_t TRACKER_GATE{ us_to_ticks(192) };   // readouts further off the prediction are outliers
+constexpr uint8_t TRACKER_MISSES{ 3 };   // outliers in a row that are the hand somewhere else
+constexpr uint8_t TRACKER_LEAD{ GLIDE_MS * PING_RATE / 1000 };   // readouts ahead, about the lag of the glide
+
+constexpr uint16_t CMI_WIDTH_US{ 192 };   // readouts closer than this belong to one channel
+constexpr uint16_t CMI_WIDTH{ us_to_ticks(CMI_WIDTH_US) };
+// the compile time CMI: weights 51:13 (~80:20) and badness reducer 13 (13/16 instead
+// of 9/12) are chosen to make both divisors powers of two
+constexpr uint8_t CMI_WEIGHT_OLD{ 51 };
+constexpr uint8_t CMI_WEIGHT_NEW{ 13 };
+constexpr uint8_t CMI_INITIAL_BADNESS{ 40 };
+constexpr uint8_t CMI_BADNESS_REDUCER{ 13 };
+
+#endif
@@ -1,51 +1,508 @@
 #!/usr/bin/python3
- 
+
 # receive data from com port and print it to the terminal.
 # usefull for debugging of microcontroller by serial communication
 # you might need to have root privileges to open the com port
+#
+# the firmware sends telemetry frames (see TELEMETRY in myserial.h), they are
+# decoded and printed one sample per line:
+#   ./showdata.py                 read from the com port
+#   ./showdata.py --file FILE     decode a recording (e.g. of the simulator: sim/theremin_sim --uart FILE)
+#   ./showdata.py --check         with --file: fail on crc errors or lost frames (make simcheck)
+#   ./showdata.py --trace OUT     also write the trace records (TRACE_OUTPUT in main.cpp) to OUT for sim/replay
+#   ./showdata.py --raw [N]       old behaviour: print blocks of N raw bytes (default 3)
+#   ./showdata.py --selftest      check the decoder against the test vectors below
+#   ./showdata.py --vectors FILE  with --selftest: also the vectors against the frames of the firmware in FILE (make simcheck)
+#   ./showdata.py --baud N        bits per second of the port (BAUDRATE of the firmware, default 9600)
+#
+# a firmware built with PARAMETERS takes commands on its serial input (see params.h):
+#   ./showdata.py --param NAME    show a parameter (NAME as in PARAMETERS below or its number, all: every one)
+#   ./showdata.py --param NAME=V  set it, until the next reset
+#   ./showdata.py --commit        keep the current values in the EEPROM
+#   ./showdata.py --defaults      back to the initial values (commit them to keep them)
+#   ./showdata.py --profile       the timing of the probe (PROFILING in main.cpp) since the last one
+# several of them go in a row. with --encode they are printed as hex for sim/theremin_sim --send
 
 
-import serial
 import time
 import os
 import sys
- 
 
-blockSize = 3 #number of bytes belonging together
-if len(sys.argv) == 2:
+
+SYNC = 0xA5
+TYPE_SAMPLES = 0x01
+TYPE_TRACE = 0x02
+TYPE_STATUS = 0x03
+TYPE_PROFILE = 0x04
+TYPE_HISTOGRAM = 0x05
+TYPE_PARAMETER = 0x06
+PROBES = ["PCINT0", "COMPB", "timestamp", "filter", "tone", "telemetry"]   # as in main.cpp (PROFILING)
+BUCKETS = ["<2", "<4", "<8", "<16", "<32", "<64", "<128", ">=128"]         # ticks, see profile.h
+PARAMETERS = ["ping_rate", "guard_us", "guard_min_us", "track_margin_us", "avr_percentage",   # PARAM_... of main.cpp
+              "cmi_width_us", "cmi_weight_old", "cmi_badness", "cmi_reducer"]
+PARAM_ALL = 0xFF    # index of the answer to a commit or reset
+NO_CHANNEL = 0xFF
+MAX_SAMPLES = 64    # larger counts are treated as corrupted
+TICK_RATE = 1000000 # Hz of the time stamps (F_CPU / prescaler of Timer0 in main.cpp) until a status frame tells
+
+
+def crc8(data, crc=0):
+	# CRC-8, polynomial x^8 + x^2 + x + 1 (0x07), like telemetry::crc8_update
+	for b in data:
+		crc ^= b
+		for _ in range(8):
+			crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+	return crc
+
+
+def unzigzag(v):
+	return (v >> 1) ^ -(v & 1)
+
+
+class Incomplete(Exception):
+	pass
+
+class Corrupted(Exception):
+	pass
+
+
+class Decoder:
+	# feed() bytes as they come in, it returns the frames completed so far as
+	# (seq, TYPE_SAMPLES, [(distance, output, channel), ...]),
+	# (seq, TYPE_TRACE, [(dt, echo), ...]) or (seq, type, [value, ...]) for the
+	# other types (TYPE_STATUS, TYPE_PROFILE, TYPE_HISTOGRAM, TYPE_PARAMETER).
+	# lost or broken bytes cost the
+	# frame they are in: the decoder looks for the next sync byte after it.
+
+	def __init__(self):
+		self.buf = bytearray()
+		self.frames = 0
+		self.samples = 0
+		self.crc_errors = 0
+		self.skipped = 0        # bytes thrown away while looking for a frame
+		self.lost_frames = 0    # gaps in the sequence numbers
+		self.last_seq = None
+		self.tick_rate = None   # Hz, from the status frames
+
+	def feed(self, data):
+		self.buf += data
+		frames = []
+		while True:
+			start = self.buf.find(SYNC)
+			if start < 0:
+				self.skipped += len(self.buf)
+				self.buf.clear()
+				break
+			self.skipped += start
+			del self.buf[:start]
+			try:
+				frame, length = self.parse(self.buf)
+			except Incomplete:
+				break
+			except Corrupted:
+				self.skipped += 1
+				del self.buf[:1]
+				continue
+			del self.buf[:length]
+			frames.append(frame)
+		return frames
+
+	def parse(self, buf):
+		pos = [1]   # behind the sync byte
+
+		def byte():
+			if pos[0] >= len(buf):
+				raise Incomplete()
+			pos[0] += 1
+			return buf[pos[0] - 1]
+
+		def varint():
+			v = 0
+			for shift in (0, 7, 14):
+				b = byte()
+				v |= (b & 0x7F) << shift
+				if not b & 0x80:
+					return v
+			raise Corrupted()
+
+		seq = byte()
+		typ = byte()
+		count = byte()
+		if typ not in (TYPE_SAMPLES, TYPE_TRACE, TYPE_STATUS, TYPE_PROFILE, TYPE_HISTOGRAM, TYPE_PARAMETER) or not 1 <= count <= MAX_SAMPLES:
+			raise Corrupted()
+		if typ == TYPE_TRACE:
+			samples = [(varint(), varint()) for _ in range(count)]
+		elif typ != TYPE_SAMPLES:
+			samples = [varint() for _ in range(count)]
+		else:
+			distance = varint()
+			output = varint()
+			channel = byte()
+			samples = [(distance, output, channel)]
+			for _ in range(count - 1):
+				tag = byte()
+				if tag & 0x80:
+					if tag & 0x3F:
+						raise Corrupted()
+					d = varint()
+					o = varint()
+				else:
+					low = byte()
+					d = (tag & 0x3F) << 1 | low >> 7
+					o = low & 0x7F
+				if tag & 0x40:
+					channel = byte()
+				distance = (distance + unzigzag(d)) & 0xFFFF
+				output = (output + unzigzag(o)) & 0xFFFF
+				samples.append((distance, output, channel))
+		crc = byte()
+		if crc8(buf[1:pos[0] - 1]) != crc:
+			self.crc_errors += 1
+			raise Corrupted()
+
+		if self.last_seq is not None:
+			self.lost_frames += (seq - self.last_seq - 1) & 0xFF
+		self.last_seq = seq
+		self.frames += 1
+		if typ in (TYPE_SAMPLES, TYPE_TRACE):
+			self.samples += len(samples)
+		elif typ == TYPE_STATUS and len(samples) >= 7 and samples[6]:
+			self.tick_rate = samples[6] * 1000
+		return (seq, typ, samples), pos[0]
+
+
+def probe_name(probe):
+	return PROBES[probe] if probe < len(PROBES) else "probe %u" % probe
+
+def parameter_name(index):
+	return PARAMETERS[index] if index < len(PARAMETERS) else "parameter %u" % index
+
+def show(frames, tick_rate=None):
+	# times in us once a status frame told the tick rate, in ticks before
+	us, unit = (1e6 / tick_rate, "us") if tick_rate else (1, "ticks")
+	for seq, typ, samples in frames:
+		if typ == TYPE_PROFILE:
+			# (probe, count, min, mean, max, lost) in ticks, see profile.h
+			probe, count, low, mean, high, lost = (samples + [0] * 6)[:6]
+			print("%3u  profile %-9s %5u calls  min %6.0f  mean %6.0f  max %6.0f %s  %u lost" % (
+				seq, probe_name(probe), count, low * us, mean * us, high * us, unit, lost))
+			continue
+		if typ == TYPE_HISTOGRAM:
+			print("%3u  profile %-9s %s" % (seq, probe_name(samples[0]),
+				"  ".join("%s:%u" % (b, n) for b, n in zip(BUCKETS, samples[1:]))))
+			continue
+		if typ == TYPE_PARAMETER:
+			# (index, value, min, max), (index) if there is none, (PARAM_ALL, version), see params.h
+			if samples[0] == PARAM_ALL:
+				print("%3u  parameters done, version %u" % (seq, (samples + [0])[1]))
+			elif len(samples) < 4:
+				print("%3u  %s: no such parameter" % (seq, parameter_name(samples[0])))
+			else:
+				print("%3u  %-16s %5u  (%u .. %u)" % (seq, parameter_name(samples[0]), samples[1], samples[2], samples[3]))
+			continue
+		if typ == TYPE_STATUS:
+			# (pings, mean ping period in ticks, timeouts, lost readouts, % of the time searching, mode changes,
+			# ticks per ms), see report_rate() in main.cpp
+			pings, period, timeouts, lost, search, changes, ticks_ms = (samples + [0] * 7)[:7]
+			rate = ticks_ms * 1000 or TICK_RATE
+			print("%3u  status: %u pings at %.1f /s, %u timeouts, %u readouts lost, searching %u%%, %u mode changes" % (
+				seq, pings, rate / period if period else 0, timeouts, lost, search, changes))
+			continue
+		if typ == TYPE_TRACE:
+			for dt, echo in samples:
+				print("%3u  dt %5u  echo %5s" % (seq, dt, echo or "-"))
+			continue
+		for distance, output, channel in samples:
+			print("%3u  %5u %5u  %s" % (seq, distance, output, "-" if channel == NO_CHANNEL else channel))
+
+
+class TraceWriter:
+	# trace file for sim/replay, the format is described in sim/trace.h. the header holds
+	# the tick rate, which comes with the first status frame: the records wait for it
+
+	def __init__(self, f):
+		self.f = f
+		self.records = 0
+		self.out = bytearray()
+		self.started = False
+
+	def write(self, frames, tick_rate=None):
+		for seq, typ, records in frames:
+			if typ != TYPE_TRACE:
+				continue
+			for record in records:
+				for v in record:
+					while v >= 0x80:
+						self.out.append(v & 0x7F | 0x80)
+						v >>= 7
+					self.out.append(v)
+			self.records += len(records)
+		if tick_rate and not self.started:
+			self.f.write(b"THTR" + bytes([1, 0, 0, 0]) + tick_rate.to_bytes(4, "little"))
+			self.started = True
+		if self.started:
+			self.f.write(self.out)
+			self.out.clear()
+			self.f.flush()
+
+	def finish(self):
+		self.write([], TICK_RATE)   # no status frame came, assume the default
+
+
+def command(op, index=0, value=0):
+	# a command for the console of params.h: op, index, value (little endian), crc
+	c = bytes([ord(op), index, value & 0xFF, value >> 8])
+	return c + bytes([crc8(c)])
+
+def parameter_index(name):
+	if name.isdigit():
+		return int(name)
+	if name not in PARAMETERS:
+		sys.exit("unknown parameter %s, one of: %s" % (name, ", ".join(PARAMETERS)))
+	return PARAMETERS.index(name)
+
+def commands(args):
+	# the commands of --param, --commit, --defaults and --profile in the order they are given
+	r = []
+	for i, a in enumerate(args):
+		if a == "--param" and i + 1 < len(args):
+			name, _, value = args[i + 1].partition("=")
+			if name == "all":
+				r += [command("g", index) for index in range(len(PARAMETERS))]
+			elif value:
+				r.append(command("s", parameter_index(name), int(value, 0)))
+			else:
+				r.append(command("g", parameter_index(name)))
+		elif a == "--commit":
+			r.append(command("c"))
+		elif a == "--defaults":
+			r.append(command("d"))
+		elif a == "--profile":
+			r.append(command("p"))
+	return r
+
+def answers(cmd, frames):
+	# the answers to cmd among the frames, for a profile both of its frames
+	if cmd[0] == ord("p"):
+		r = [f for f in frames if f[1] in (TYPE_PROFILE, TYPE_HISTOGRAM)]
+		return r if any(f[1] == TYPE_HISTOGRAM for f in r) else []
+	index = PARAM_ALL if cmd[0] in b"cd" else cmd[1]
+	return [f for f in frames if f[1] == TYPE_PARAMETER and f[2][0] == index]
+
+def talk(ser, decoder, cmds, retries=5, timeout=0.5):
+	# send each command until it is answered. a byte that comes in while the firmware
+	# is busy with the measurement may be lost, the command is repeated then
+	for cmd in cmds:
+		for _ in range(retries):
+			ser.write(cmd)
+			end = time.time() + timeout
+			frames = []
+			while time.time() < end and not answers(cmd, frames):
+				frames += decoder.feed(ser.read(ser.in_waiting or 1))
+			if answers(cmd, frames):
+				show(answers(cmd, frames))
+				break
+		else:
+			print("no answer to %s" % cmd.hex(" "))
+
+
+def summary(decoder):
+	print("%u frames, %u samples, %u crc errors, %u lost frames, %u bytes skipped" % (
+		decoder.frames, decoder.samples, decoder.crc_errors, decoder.lost_frames, decoder.skipped))
+
+
+# test vectors from telemetry::Encoder, TraceEncoder, status() (myserial.h) and params::Console: type, samples and the bytes sent for them.
+# make simcheck compares them with what these send in the simulator (sim/telemetry_vectors.cpp)
+TEST_VECTORS = [
+	# one frame of 4 samples: first absolute, then the short form, a channel change and no change in output
+	(TYPE_SAMPLES, [(1000, 990, 0), (1010, 992, 0), (1003, 993, 2), (1005, 993, 2)],
+	 "a5 00 01 04 e8 07 de 07 00 0a 04 46 82 02 02 00 65"),
+	# large jumps take the long form, a channel of 255 is NO_CHANNEL
+	(TYPE_SAMPLES, [(100, 100, 255), (2800, 110, 255), (20, 2700, 0)],
+	 "a5 01 01 03 64 64 ff 80 98 2a 14 c0 b7 2b bc 28 00 6a"),
+	# trace records (dt, echo): two echoes of one ping, no echo, a long pause
+	(TYPE_TRACE, [(7300, 1500), (0, 1510), (7290, 0), (65000, 2815)],
+	 "a5 02 02 04 84 39 dc 0b 00 e6 0b fa 38 00 e8 fb 03 ff 15 39"),
+	# status (pings, period, timeouts, lost), older firmware sends fewer values
+	(TYPE_STATUS, [64, 5200, 3, 0],
+	 "a5 03 03 04 40 d0 28 03 00 df"),
+	# status of the current firmware, the last value is the tick rate (125 ticks per ms: Timer0 /8 at 1 MHz)
+	(TYPE_STATUS, [64, 625, 0, 0, 0, 0, 125],
+	 "a5 04 03 07 40 f1 04 00 00 00 00 7d c2"),
+	# profile of a probe (probe, count, min, mean, max, lost) and its histogram (PROFILING in main.cpp)
+	(TYPE_PROFILE, [3, 255, 40, 52, 300, 0],
+	 "a5 05 04 06 03 ff 01 28 34 ac 02 00 99"),
+	(TYPE_HISTOGRAM, [3, 0, 0, 0, 0, 2, 120, 3, 1],
+	 "a5 06 05 09 03 00 00 00 00 02 78 03 01 22"),
+	# answers of the console (PARAMETERS in main.cpp): a parameter, none, a commit
+	(TYPE_PARAMETER, [0, 400, 2, 1000],
+	 "a5 07 06 04 00 90 03 02 e8 07 c0"),
+	(TYPE_PARAMETER, [99],
+	 "a5 08 06 01 63 f6"),
+	(TYPE_PARAMETER, [PARAM_ALL, 1],
+	 "a5 09 06 02 ff 01 01 38"),
+]
+
+def selftest(vectors=None):
+	ok = True
+
+	def check(name, condition):
+		nonlocal ok
+		print("%-44s %s" % (name, "ok" if condition else "FAILED"))
+		ok = ok and condition
+
+	frames = [(i, typ, samples) for i, (typ, samples, _) in enumerate(TEST_VECTORS)]
+	stream = b"".join(bytes.fromhex(h) for _, _, h in TEST_VECTORS)
+
+	for i, (typ, samples, h) in enumerate(TEST_VECTORS):
+		d = Decoder()
+		check("vector %u" % i, d.feed(bytes.fromhex(h)) == [(i, typ, samples)] and d.skipped == 0)
+
+	if vectors is not None:   # one frame per line, in hex
+		sent = [bytes.fromhex(line) for line in vectors if line.strip()]
+		check("as many frames from the encoders", len(sent) == len(TEST_VECTORS))
+		for i, ((_, _, h), b) in enumerate(zip(TEST_VECTORS, sent)):
+			check("vector %u from the encoders" % i, b == bytes.fromhex(h))
+
+	d = Decoder()
+	got = []
+	for b in stream:   # byte by byte, like from the port
+		got += d.feed(bytes([b]))
+	check("byte by byte", got == frames)
+
+	d = Decoder()
+	check("garbage before and between frames", d.feed(b"\x12\xa5\x00" + bytes.fromhex(TEST_VECTORS[0][2]) + b"\xa5\xa5"
+		+ b"".join(bytes.fromhex(h) for _, _, h in TEST_VECTORS[1:])) == frames)
+	check("tick rate of the status frame", d.tick_rate == 125000)
+
+	# (CRC-8 misses one in 256 random errors, this holds for these vectors)
+	for cut in range(1, len(bytes.fromhex(TEST_VECTORS[0][2]))):
+		broken = bytearray(stream)
+		del broken[cut]
+		d = Decoder()
+		if d.feed(bytes(broken)) != frames[1:]:
+			check("lost byte %u of frame 0" % cut, False)
+	check("a lost byte costs only its frame", True)
+
+	broken = bytearray(stream)
+	broken[6] ^= 0x10
+	d = Decoder()
+	check("flipped bit fails the crc", d.feed(bytes(broken)) == frames[1:] and d.crc_errors == 1)
+
+	later = bytearray.fromhex(TEST_VECTORS[1][2])
+	later[1] = 4                      # seq 1 -> 4: frames 2 and 3 lost
+	later[-1] = crc8(later[1:-1])
+	d = Decoder()
+	d.feed(bytes.fromhex(TEST_VECTORS[1][2]) + later)
+	check("sequence gaps are counted", d.lost_frames == 2)
+
+	import io
+	records = bytes.fromhex(TEST_VECTORS[2][2])[4:-1]
+	f = io.BytesIO()
+	t = TraceWriter(f)
+	t.write(frames)
+	check("trace file waits for the tick rate", f.getvalue() == b"")
+	t.write([], 125000)
+	check("trace file", f.getvalue() == b"THTR\x01\x00\x00\x00\x48\xe8\x01\x00" + records)
+	f = io.BytesIO()
+	t = TraceWriter(f)
+	t.write(frames)
+	t.finish()
+	check("trace file without status frames", f.getvalue() == b"THTR\x01\x00\x00\x00\x40\x42\x0f\x00" + records)
+
+	check("commands", commands(["--param", "guard_us=1500", "--param", "0", "--commit"])
+		== [bytes.fromhex("73 01 dc 05 3e"), bytes.fromhex("67 00 00 00 37"), bytes.fromhex("63 00 00 00 6f")])
+	profile = command("p")
+	check("profile request", commands(["--profile"]) == [profile])
+	check("profile answer", answers(profile, frames[5:6]) == [] and answers(profile, frames) == frames[5:7])
+
+	return ok
+
+
+if __name__ == "__main__":
+	if "--selftest" in sys.argv:
+		vectors = None
+		if "--vectors" in sys.argv:
+			with open(sys.argv[sys.argv.index("--vectors") + 1]) as f:
+				vectors = f.read().splitlines()
+		sys.exit(0 if selftest(vectors) else 1)
+
+	trace = None
+	if "--trace" in sys.argv:
+		trace = TraceWriter(open(sys.argv[sys.argv.index("--trace") + 1], "wb"))
+
+	decoder = Decoder()
+
+	def handle(frames):
+		show(frames, decoder.tick_rate)
+		if trace:
+			trace.write(frames, decoder.tick_rate)
+
+	cmds = commands(sys.argv)
+	if "--encode" in sys.argv:
+		print(" ".join(c.hex() for c in cmds))
+		sys.exit(0)
+
+	if "--file" in sys.argv:
+		with open(sys.argv[sys.argv.index("--file") + 1], "rb") as f:
+			handle(decoder.feed(f.read()))
+		summary(decoder)
+		if trace:
+			trace.finish()
+			print("%u trace records written" % trace.records)
+		sys.exit(1 if "--check" in sys.argv and (decoder.crc_errors or decoder.lost_frames) else 0)
+
+	import serial
+
+	raw = "--raw" in sys.argv
+	blockSize = 3 #number of bytes belonging together
+	if raw and len(sys.argv) > sys.argv.index("--raw") + 1:
+		try:
+			blockSize = int(sys.argv[sys.argv.index("--raw") + 1])
+		except:
+			pass
+
+	# configure serial port:
+	ser = serial.Serial()
+
+	#  insert your port here!!!
+	ser.port = '/dev/serial/by-id/usb-Prolific_Technology_Inc._USB-Serial_Controller_D-if00-port0'
+	ser.baudrate = int(sys.argv[sys.argv.index("--baud") + 1]) if "--baud" in sys.argv else 9600
+	ser.timeout = 1
+
+	# open port
+	ser.open()
+	print("port opened")
+
+	if cmds:
+		talk(ser, decoder, cmds)
+		ser.close()
+		sys.exit(0)
+
+	# read data
 	try:
-		blockSize = int(sys.argv[1])
-	except:
-		pass
-
-# configure serial port:
-ser = serial.Serial()
-
-#  insert your port here!!!
-ser.port = '/dev/serial/by-id/usb-Prolific_Technology_Inc._USB-Serial_Controller_D-if00-port0'
-ser.baudrate = 9600
-ser.timeout = 1
- 
-# open port
-ser.open()
-print("port opened")
- 
-# read data
-try:
-	while 1:
-		# read <blockSize> bytes
-		bytes = ser.read(blockSize)
-		string = ""
-		for byte in bytes:
-			string += hex(byte)
-			string += " "
-
-		print(string)
-		
-		
-# catch keyboard interrupt, to terminate with [CTRL]+[C].
-except(KeyboardInterrupt, SystemExit):
-	print("\nterminating:")
-	ser.close()
-	print("port closed")
-	print("\nEND")
\ No newline at end of file
+		while 1:
+			if raw:
+				# read <blockSize> bytes
+				bytes = ser.read(blockSize)
+				string = ""
+				for byte in bytes:
+					string += hex(byte)
+					string += " "
+
+				print(string)
+			else:
+				handle(decoder.feed(ser.read(ser.in_waiting or 1)))
+
+
+	# catch keyboard interrupt, to terminate with [CTRL]+[C].
+	except(KeyboardInterrupt, SystemExit):
+		print("\nterminating:")
+		ser.close()
+		print("port closed")
+		if not raw:
+			summary(decoder)
+		if trace:
+			trace.finish()
+			print("%u trace records written" % trace.records)
+		print("\nEND")
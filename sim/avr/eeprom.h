@@ -0,0 +1,35 @@
+/* host replacement for <avr/eeprom.h>
+*
+* EEMEM variables go into the section sim_eeprom, the simulator core keeps it
+* as the image of the EEPROM (sim::eeprom(), theremin_sim --eeprom FILE).
+* reading charges the cycles of the EEPROM access, every byte that
+* eeprom_update_block() changes takes the 3.4 ms of erase and write, in which
+* interrupts are served like on the chip.
+*/
+
+#ifndef __sim_avr_eeprom_h__
+#define __sim_avr_eeprom_h__
+
+#include <stdint.h>
+#include <string.h>
+#include "io.h"
+
+#define EEMEM __attribute__((section("sim_eeprom"), used))
+
+void sim_delay_cycles(uint32_t cycles);
+
+inline void eeprom_read_block(void* dst, const void* src, size_t n){ sim_charge(8 + 6*n); memcpy(dst, src, n); }
+
+inline void eeprom_update_block(const void* src, void* dst, size_t n){
+	const uint8_t* s = static_cast<const uint8_t*>(src);
+	uint8_t* d = static_cast<uint8_t*>(dst);
+	for (size_t i = 0; i < n; ++i){
+		sim_charge(12);
+		if (d[i] != s[i]){
+			sim_delay_cycles(static_cast<uint32_t>(3.4e-3 * F_CPU));
+			d[i] = s[i];
+		}
+	}
+}
+
+#endif
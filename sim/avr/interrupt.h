@@ -0,0 +1,24 @@
+/* host replacement for <avr/interrupt.h>
+*
+* ISR(vector) defines a plain extern "C" function with the name of the vector.
+* The simulator core calls it when the corresponding interrupt is pending,
+* enabled and the I bit in SREG is set. ISR(vector, ISR_NOBLOCK) is registered
+* with the core by name: like avr-gcc it sets the I bit again right after the
+* interrupt response, the prologue can be interrupted.
+*/
+
+#ifndef __sim_avr_interrupt_h__
+#define __sim_avr_interrupt_h__
+
+#include "io.h"
+
+bool sim_isr_attributes(const char* vector, const char* attributes);
+
+#define ISR(vector, ...) \
+	static const bool sim_isr_##vector __attribute__((unused)) = sim_isr_attributes(#vector, #__VA_ARGS__); \
+	extern "C" void vector(void)
+
+#define sei() (SREG |= (1<<SREG_I))
+#define cli() (SREG &= static_cast<uint8_t>(~(1<<SREG_I)))
+
+#endif
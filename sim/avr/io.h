@@ -0,0 +1,182 @@
+/* host replacement for <avr/io.h>
+*
+* Every I/O register of the ATtiny25/45/85 that the firmware touches is
+* represented by an IoReg, addressed by its I/O address like in the real
+* header. Each access is forwarded to the simulator core (simcore.cpp),
+* which charges the AVR cycles of the access, advances the simulated time
+* and models the side effects of the register (timer, pins, flags, ...).
+*
+* Only the registers and bits used by this project are defined.
+*/
+
+#ifndef __sim_avr_io_h__
+#define __sim_avr_io_h__
+
+#include <stdint.h>
+#include "avrcost.h"
+
+
+// interface to the simulator core
+uint8_t sim_io_read(uint8_t addr);
+void    sim_io_write(uint8_t addr, uint8_t value);
+void    sim_io_bit(uint8_t addr, uint8_t mask, bool set);   // sbi/cbi: atomic, 2 cycles
+void    sim_charge(uint32_t cycles);   // burn cycles (computation that has no register access)
+void    sim_readout(uint8_t sensor, uint16_t ticks);   // echo measured by the firmware
+
+// cycle cost annotation and readouts of the firmware (see mydefs.h). no-op on target
+#define SIM_CHARGE(cycles) sim_charge(cycles)
+#define SIM_READOUT(sensor, ticks) sim_readout(sensor, ticks)
+
+
+class IoReg {
+public:
+	constexpr explicit IoReg(uint8_t addr) : _addr(addr) {}
+
+	operator uint8_t() const { return sim_io_read(_addr); }
+
+	const IoReg& operator = (uint8_t v) const { sim_io_write(_addr, v); return *this; }
+	const IoReg& operator = (const IoReg& r) const { return *this = uint8_t(r); }
+
+	// read-modify-write. a single bit of the lower 32 registers becomes sbi/cbi
+	// (2 cycles, no interrupt in between), everything else in/op/out (3 cycles,
+	// the read is charged by sim_io_read, the write by sim_io_write, the op here)
+	const IoReg& operator |= (uint8_t v) const {
+		if (sbi_cbi(v)){ sim_io_bit(_addr, v, true); return *this; }
+		uint8_t x = *this; sim_charge(1); return *this = x | v;
+	}
+	const IoReg& operator &= (uint8_t v) const {
+		if (sbi_cbi(static_cast<uint8_t>(~v))){ sim_io_bit(_addr, static_cast<uint8_t>(~v), false); return *this; }
+		uint8_t x = *this; sim_charge(1); return *this = x & v;
+	}
+	const IoReg& operator ^= (uint8_t v) const { uint8_t x = *this; sim_charge(1); return *this = x ^ v; }
+
+private:
+	bool sbi_cbi(uint8_t mask) const { return _addr < 0x20 && mask && !(mask & (mask - 1)); }
+
+	uint8_t _addr;
+};
+
+#define _SFR_IO8(addr) (IoReg(addr))
+
+
+// I/O registers (I/O address space)
+#define SREG    _SFR_IO8(0x3F)
+#define GIMSK   _SFR_IO8(0x3B)
+#define GIFR    _SFR_IO8(0x3A)
+#define TIMSK   _SFR_IO8(0x39)
+#define TIFR    _SFR_IO8(0x38)
+#define MCUCR   _SFR_IO8(0x35)
+#define TCCR0B  _SFR_IO8(0x33)
+#define TCNT0   _SFR_IO8(0x32)
+#define TCCR1   _SFR_IO8(0x30)
+#define TCNT1   _SFR_IO8(0x2F)
+#define OCR1A   _SFR_IO8(0x2E)
+#define OCR1C   _SFR_IO8(0x2D)
+#define GTCCR   _SFR_IO8(0x2C)
+#define OCR1B   _SFR_IO8(0x2B)
+#define TCCR0A  _SFR_IO8(0x2A)
+#define OCR0A   _SFR_IO8(0x29)
+#define OCR0B   _SFR_IO8(0x28)
+#define PLLCSR  _SFR_IO8(0x27)
+#define CLKPR   _SFR_IO8(0x26)
+#define EEARH   _SFR_IO8(0x1F)
+#define EEARL   _SFR_IO8(0x1E)
+#define EEDR    _SFR_IO8(0x1D)
+#define EECR    _SFR_IO8(0x1C)
+#define PORTB   _SFR_IO8(0x18)
+#define DDRB    _SFR_IO8(0x17)
+#define PINB    _SFR_IO8(0x16)
+#define PCMSK   _SFR_IO8(0x15)
+
+
+// bits
+#define SREG_I  7
+
+#define INT0    6
+#define PCIE    5
+#define INTF0   6
+#define PCIF    5
+
+#define OCIE1A  6
+#define OCIE1B  5
+#define OCIE0A  4
+#define OCIE0B  3
+#define TOIE1   2
+#define TOIE0   1
+
+#define OCF1A   6
+#define OCF1B   5
+#define OCF0A   4
+#define OCF0B   3
+#define TOV1    2
+#define TOV0    1
+
+#define SE      5
+#define SM1     4
+#define SM0     3
+
+#define FOC0A   7
+#define FOC0B   6
+#define WGM02   3
+#define CS02    2
+#define CS01    1
+#define CS00    0
+
+#define COM0A1  7
+#define COM0A0  6
+#define COM0B1  5
+#define COM0B0  4
+#define WGM01   1
+#define WGM00   0
+
+#define CTC1    7
+#define PWM1A   6
+#define COM1A1  5
+#define COM1A0  4
+#define CS13    3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+
+#define TSM     7
+#define PWM1B   6
+#define COM1B1  5
+#define COM1B0  4
+#define FOC1B   3
+#define FOC1A   2
+#define PSR1    1
+#define PSR0    0
+
+#define LSM     7
+#define PCKE    2
+#define PLLE    1
+#define PLOCK   0
+
+#define CLKPCE  7
+#define CLKPS3  3
+#define CLKPS2  2
+#define CLKPS1  1
+#define CLKPS0  0
+
+#define EEPM1   5
+#define EEPM0   4
+#define EERIE   3
+#define EEMPE   2
+#define EEPE    1
+#define EERE    0
+
+#define PB5     5
+#define PB4     4
+#define PB3     3
+#define PB2     2
+#define PB1     1
+#define PB0     0
+
+#define PCINT5  5
+#define PCINT4  4
+#define PCINT3  3
+#define PCINT2  2
+#define PCINT1  1
+#define PCINT0  0
+
+#endif
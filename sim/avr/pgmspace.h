@@ -0,0 +1,24 @@
+/* host replacement for <avr/pgmspace.h>
+*
+* there is only one address space on the host. the read macros charge the
+* cycles of the lpm instructions.
+*/
+
+#ifndef __sim_avr_pgmspace_h__
+#define __sim_avr_pgmspace_h__
+
+#include <stdint.h>
+#include <string.h>
+#include "io.h"
+
+#define PROGMEM
+
+inline uint8_t  sim_pgm_read_byte(const void* p){ sim_charge(3); return *static_cast<const uint8_t*>(p); }
+inline uint16_t sim_pgm_read_word(const void* p){ sim_charge(6); return *static_cast<const uint16_t*>(p); }
+
+inline void* memcpy_P(void* dst, const void* src, size_t n){ sim_charge(8 + 5*n); return memcpy(dst, src, n); }
+
+#define pgm_read_byte(addr) sim_pgm_read_byte(addr)
+#define pgm_read_word(addr) sim_pgm_read_word(addr)
+
+#endif
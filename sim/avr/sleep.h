@@ -0,0 +1,25 @@
+/* host replacement for <avr/sleep.h>
+*
+* sleep_cpu() advances the simulated time until an interrupt has been served,
+* the time is counted in sim::sleep_cycles. all sleep modes are treated like
+* idle: the timers keep running.
+*/
+
+#ifndef __sim_avr_sleep_h__
+#define __sim_avr_sleep_h__
+
+#include "io.h"
+
+void sim_sleep();
+
+#define SLEEP_MODE_IDLE        (0)
+#define SLEEP_MODE_ADC         (1<<SM0)
+#define SLEEP_MODE_PWR_DOWN    (1<<SM1)
+
+#define set_sleep_mode(mode) (MCUCR = (MCUCR & static_cast<uint8_t>(~(1<<SM1 | 1<<SM0))) | (mode))
+#define sleep_enable()  (MCUCR |= (1<<SE))
+#define sleep_disable() (MCUCR &= static_cast<uint8_t>(~(1<<SE)))
+#define sleep_cpu()     do { if (MCUCR & (1<<SE)) sim_sleep(); } while (0)
+#define sleep_mode()    do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif
@@ -0,0 +1,72 @@
+/* AVR cycle cost model for the host simulator
+*
+* The host can't execute AVR code, so code without register access is charged
+* with SIM_CHARGE(...) annotations (see mydefs.h) using the figures below.
+* They are estimates for avr-gcc -Os on an ATtiny (avr25 core: no hardware
+* multiplier, no hardware divider, so multiplication and division go through
+* the shift-and-add loops in libgcc):
+*
+*   __udivmodqi4   ~  85 cycles      __mulqi3 ~  40 cycles
+*   __udivmodhi4   ~ 220 cycles      __mulhi3 ~ 120 cycles
+*   __udivmodsi4   ~ 620 cycles      __mulsi3 ~ 300 cycles (early exit on small factors)
+*
+* Absolute numbers are only as good as these estimates; the simulator is meant
+* for comparing variants of the firmware against each other.
+*/
+
+#ifndef __sim_avrcost_h__
+#define __sim_avrcost_h__
+
+#include <stdint.h>
+
+namespace avrcost {
+
+	constexpr uint16_t CALL       { 7 };   // rcall + ret
+	constexpr uint16_t ICALL      { 12 };  // load vtable entry + icall + ret
+	constexpr uint16_t BRANCH     { 2 };   // compare + taken branch
+	constexpr uint16_t LOOP       { 4 };   // counter update, compare, branch back
+
+	constexpr uint16_t ISR_ENTRY  { 18 };  // interrupt response, vector jump, prologue (push r0, r1, SREG, scratch registers)
+	constexpr uint16_t ISR_EXIT   { 16 };  // epilogue, reti
+	constexpr uint16_t ISR_RESPONSE { 7 }; // ISR_NOBLOCK: interrupt response, vector jump and the sei in front of the prologue
+
+	template <typename T> constexpr uint16_t ld()  { return 2 * sizeof(T); }   // lds per byte
+	template <typename T> constexpr uint16_t st()  { return 2 * sizeof(T); }   // sts per byte
+	template <typename T> constexpr uint16_t add() { return sizeof(T); }       // add/adc, sub/sbc, cp/cpc per byte
+	template <typename T> constexpr uint16_t shift(uint8_t bits) {             // whole bytes are moves, the rest lsl/rol chains
+		return (bits / 8) * sizeof(T) + (bits % 8) * sizeof(T);
+	}
+	template <typename T> constexpr uint16_t mul() {
+		return sizeof(T) == 1 ? 40 : sizeof(T) == 2 ? 120 : sizeof(T) == 4 ? 300 : 1200;
+	}
+	template <typename T> constexpr uint16_t div() {
+		return sizeof(T) == 1 ? 85 : sizeof(T) == 2 ? 220 : sizeof(T) == 4 ? 620 : 2400;
+	}
+
+	constexpr uint8_t bits(uint32_t x){ return x ? (x & 1) + bits(x >> 1) : 0; }
+	constexpr uint8_t highest_bit(uint32_t x){ return x > 1 ? 1 + highest_bit(x >> 1) : 0; }
+
+		/* multiplication by a constant: powers of two are shifts, small factors
+		   become shift-and-add sequences, everything else calls libgcc */
+	template <typename T> constexpr uint16_t mul_by(uint32_t c) {
+		return c <= 1 ? 0
+		     : bits(c) == 1 ? shift<T>(highest_bit(c))
+		     : (bits(c) * add<T>() + highest_bit(c) * sizeof(T) < mul<T>()) ? bits(c) * add<T>() + highest_bit(c) * sizeof(T)
+		     : mul<T>();
+	}
+		/* division by a constant: powers of two are shifts, everything else calls
+		   libgcc (no multiply-by-reciprocal without a hardware multiplier) */
+	template <typename T> constexpr uint16_t div_by(uint32_t c) {
+		return c <= 1 ? 0 : bits(c) == 1 ? shift<T>(highest_bit(c)) : div<T>();
+	}
+
+	constexpr uint16_t DIV_U8  { div<uint8_t>() };
+	constexpr uint16_t DIV_U16 { div<uint16_t>() };
+	constexpr uint16_t DIV_U32 { div<uint32_t>() };
+	constexpr uint16_t MUL_U8  { mul<uint8_t>() };
+	constexpr uint16_t MUL_U16 { mul<uint16_t>() };
+	constexpr uint16_t MUL_U32 { mul<uint32_t>() };
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+/* run time vs. compile time configuration of the CMI (cmi.h)
+*
+* feeds the same noisy readouts with multipath spikes into
+*   - ChannellingMeasurementInterpreter with a ConstDeltaConfiguration object
+*   - StaticChannellingMeasurementInterpreter with the same parameters
+*   - StaticChannellingMeasurementInterpreter with power-of-two divisors
+*     on uint32_t (-DCMI_UINT32) and on 16 bit FixedPoint<12, 4> (main.cpp)
+* and reports modelled AVR cycles per sample and the RAM of the channels.
+*/
+
+#include "simcore.h"
+#include "devices.h"
+#include "avr/io.h"
+#include "../cmi.h"
+#include "../fixedpoint.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+	constexpr uint8_t FIXED { 8 };
+	constexpr uint8_t CHANNELS { 4 };
+	constexpr uint32_t DELTA { uint32_t(0xC0) << FIXED };
+
+	using Runtime = analyzer::CMI<uint32_t, CHANNELS>;
+	using StaticSame = analyzer::StaticCMI<uint32_t, CHANNELS, analyzer::ConstDeltaPolicy<uint32_t, DELTA, 80, 20, 40, 9>>;
+	using StaticPow2 = analyzer::StaticCMI<uint32_t, CHANNELS, analyzer::ConstDeltaPolicy<uint32_t, DELTA, 51, 13, 40, 13>>;
+	using Fixed16 = fixedpoint::FixedPoint<12, 4, uint16_t>;
+	using Fixed32 = fixedpoint::FixedPoint<24, FIXED, uint32_t>;   // same resolution as uint32_t << FIXED
+	using StaticFixed16 = analyzer::StaticCMI<Fixed16, CHANNELS, analyzer::ConstDeltaPolicy<Fixed16, 0xC0, 51, 13, 40, 13>>;
+	using StaticFixed32 = analyzer::StaticCMI<Fixed32, CHANNELS, analyzer::ConstDeltaPolicy<Fixed32, 0xC0, 51, 13, 40, 13>>;
+
+	std::vector<uint32_t> readouts(){
+		std::vector<uint32_t> r;
+		sim::Rng rng(3);
+		for (int i = 0; i < 20000; ++i){
+			double d = 1500 + 1000 * ((i / 400) % 2 ? 1 : -1) * ((i % 400) / 400.0);   // slow ramps
+			if (rng.uniform() < 0.05) d *= 1.3 + rng.uniform();                        // spikes
+			d += 15 * rng.gauss();
+			if (d >= 0x0B00) continue;   // main.cpp drops readouts >= MAX_DISTANCE
+			r.push_back(uint32_t(d) << FIXED);
+		}
+		return r;
+	}
+
+	struct Result { double cycles; std::vector<uint32_t> out; };   // out in 1/256 ticks
+
+		/* conversion from and to uint32_t << FIXED */
+	template <typename F> struct Convert {
+		static F to(uint32_t v){ return F::from_raw(v >> (FIXED - F::FRAC_BITS)); }
+		static uint32_t from(const F& v){ return uint32_t(v.raw()) << (FIXED - F::FRAC_BITS); }
+	};
+	template <> struct Convert<uint32_t> {
+		static uint32_t to(uint32_t v){ return v; }
+		static uint32_t from(uint32_t v){ return v; }
+	};
+
+	template <typename Metric, typename Cmi>
+	Result run(Cmi& cmi, const std::vector<uint32_t>& in){
+		Result r;
+		r.out.reserve(in.size());
+		sim::cycles_t start = sim::now;
+		for (uint32_t v : in){
+			cmi.input(Convert<Metric>::to(v));
+			r.out.push_back(Convert<Metric>::from(cmi.output()));
+		}
+		r.cycles = double(sim::now - start) / in.size();
+		return r;
+	}
+	template <typename Cmi>
+	Result run(Cmi& cmi, const std::vector<uint32_t>& in){ return run<uint32_t>(cmi, in); }
+
+	double max_difference(const Result& a, const Result& b){   // in ticks
+		uint32_t worst = 0;
+		for (size_t i = 0; i < a.out.size(); ++i){
+			uint32_t d = a.out[i] > b.out[i] ? a.out[i] - b.out[i] : b.out[i] - a.out[i];
+			if (d > worst) worst = d;
+		}
+		return worst / double(1 << FIXED);
+	}
+
+}
+
+int main(){
+	std::vector<uint32_t> in = readouts();
+
+	Runtime::ConstDeltaConfiguration config(DELTA);
+	config.weight_old = 80;
+	config.weight_new = 20;
+	config.initial_badness = 40;
+	config.badness_reducer = 9;
+	Runtime runtime(config);
+	StaticSame static_same;
+	StaticPow2 static_pow2;
+	StaticFixed16 static_fixed16;
+	StaticFixed32 static_fixed32;
+
+	Result a = run(runtime, in);
+	Result b = run(static_same, in);
+	Result c = run(static_pow2, in);
+	Result d = run<Fixed16>(static_fixed16, in);
+	Result e = run<Fixed32>(static_fixed32, in);
+
+	std::printf("CMI<uint32_t, %u>, %zu samples, modelled AVR cycles per input()+output()\n", CHANNELS, in.size());
+	std::printf("  %-44s %10s %10s\n", "configuration", "cycles", "RAM");
+	std::printf("  %-44s %10.1f %10zu\n", "run time object 80:20, reducer 9", a.cycles, sizeof(runtime));
+	std::printf("  %-44s %10.1f %10zu   %s\n", "static policy  80:20, reducer 9", b.cycles, sizeof(static_same),
+		a.out == b.out ? "(same output)" : "(OUTPUT DIFFERS)");
+	std::printf("  %-44s %10.1f %10zu\n", "static policy  51:13, reducer 13, uint32_t", c.cycles, sizeof(static_pow2));
+	std::printf("  %-44s %10.1f %10zu   %s\n", "same, FixedPoint<24, 8, uint32_t>", e.cycles, sizeof(static_fixed32),
+		c.out == e.out ? "(same output)" : "(OUTPUT DIFFERS)");
+	std::printf("  %-44s %10.1f %10zu   (max %.2f ticks off)\n", "same, FixedPoint<12, 4, uint16_t> (main.cpp)", d.cycles,
+		sizeof(static_fixed16), max_difference(c, d));
+	std::printf("  (RAM as laid out on the host: padded channels and an 8 byte pointer.\n"
+	            "   avr-gcc packs a channel into 5 bytes with uint32_t and 3 bytes with 16 bit, see make cmisize)\n");
+	return a.out == b.out && c.out == e.out ? 0 : 1;
+}
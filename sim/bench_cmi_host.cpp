@@ -0,0 +1,180 @@
+/* host throughput of the CMI (cmi.h), regression baseline for offline runs
+*
+* unlike the other benches this one measures the host, not the AVR: it
+* doesn't include avr/io.h, so SIM_CHARGE is a no-op and cmi.h compiles as
+* plain C++. for 1..16 channels and every kind of configuration it reports
+*   - samples/s of input_batch() over the whole recording
+*   - median and 99th percentile latency of input()+output() calls one by one
+*     (per call, timed in blocks of 16 calls)
+*
+*   sim/bench_cmi_host [readouts.txt]
+*
+* without a file it uses 1M synthetic readouts (ticks, like the echo time
+* in main.cpp). a file holds one readout in ticks per line.
+*/
+
+#include "devices.h"
+#include "../cmi.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+namespace {
+
+	using Clock = std::chrono::steady_clock;
+	using Metric = uint32_t;
+
+	constexpr uint8_t FIXED { 8 };
+	constexpr Metric DELTA { Metric(0xC0) << FIXED };
+	constexpr size_t LATENCY_SAMPLES { 64000 };
+	constexpr size_t LATENCY_BLOCK { 16 };
+
+	std::vector<Metric> synthetic(size_t n){
+		std::vector<Metric> r;
+		r.reserve(n);
+		sim::Rng rng(3);
+		while (r.size() < n){
+			size_t i = r.size();
+			double d = 1500 + 1000 * ((i / 400) % 2 ? 1 : -1) * ((i % 400) / 400.0);   // slow ramps
+			if (rng.uniform() < 0.05) d *= 1.3 + rng.uniform();                        // spikes
+			d += 15 * rng.gauss();
+			if (d >= 0x0B00 || d < 0) continue;
+			r.push_back(Metric(d) << FIXED);
+		}
+		return r;
+	}
+
+	std::vector<Metric> load(const char* name){
+		std::vector<Metric> r;
+		FILE* f = std::fopen(name, "r");
+		if (!f){ std::perror(name); return r; }
+		unsigned long v;
+		while (std::fscanf(f, "%lu", &v) == 1) r.push_back(Metric(v) << FIXED);
+		std::fclose(f);
+		return r;
+	}
+
+	struct Result { double msps; double p50; double p99; bool same; };   // Msamples/s, ns, ns, batch == one by one
+
+	double clock_overhead(){
+		std::vector<double> t(1000);
+		for (double& x : t){
+			auto a = Clock::now();
+			auto b = Clock::now();
+			x = std::chrono::duration<double, std::nano>(b - a).count();
+		}
+		std::sort(t.begin(), t.end());
+		return t[t.size() / 2];
+	}
+
+	template <typename Cmi>
+	Result measure(Cmi& cmi, const std::vector<Metric>& in, double overhead){
+		Result r;
+		std::vector<Metric> out(in.size());
+		std::vector<uint8_t> matched(in.size());
+
+		cmi.invalidate();
+		auto a = Clock::now();
+		cmi.input_batch(in.data(), in.size(), out.data(), matched.data());
+		auto b = Clock::now();
+		r.msps = in.size() / std::chrono::duration<double, std::micro>(b - a).count();
+
+		// a single call is too short for the clock, time blocks of LATENCY_BLOCK calls
+		cmi.invalidate();
+		size_t n = std::min(in.size(), LATENCY_SAMPLES) / LATENCY_BLOCK;
+		std::vector<double> t(n);
+		uint8_t m[LATENCY_BLOCK];
+		Metric o[LATENCY_BLOCK];
+		r.same = true;
+		for (size_t i = 0; i < n; ++i){
+			const size_t first = i * LATENCY_BLOCK;
+			auto c = Clock::now();
+			for (size_t j = 0; j < LATENCY_BLOCK; ++j){
+				m[j] = cmi.input(in[first + j]);
+				o[j] = cmi.output();
+			}
+			auto d = Clock::now();
+			t[i] = (std::chrono::duration<double, std::nano>(d - c).count() - overhead) / LATENCY_BLOCK;
+			r.same = r.same && std::equal(m, m + LATENCY_BLOCK, &matched[first]) && std::equal(o, o + LATENCY_BLOCK, &out[first]);
+		}
+		if (!n){   // fewer readouts than a block: no latency, and nothing compared
+			r.p50 = r.p99 = NAN;
+			return r;
+		}
+		std::sort(t.begin(), t.end());
+		r.p50 = t[n / 2];
+		r.p99 = t[n * 99 / 100];
+		return r;
+	}
+
+	constexpr uint8_t KINDS { 4 };
+	const char* const KIND_NAMES[KINDS] { "ConstDelta", "LinPercDelta", "static CD", "static LPD" };
+
+	template <uint8_t channels>
+	void row(const std::vector<Metric>& in, double overhead, Result (&r)[KINDS]){
+		using Runtime = analyzer::CMI<Metric, channels>;
+		typename Runtime::ConstDeltaConfiguration cd(DELTA);
+		typename Runtime::template LPDC<uint8_t> lpd(8);   // 8% of the average, ~0xC0 ticks in the middle of the range
+		for (typename Runtime::Configuration* c : { static_cast<typename Runtime::Configuration*>(&cd),
+		                                            static_cast<typename Runtime::Configuration*>(&lpd) }){
+			c->weight_old = 80;
+			c->weight_new = 20;
+			c->initial_badness = 40;
+			c->badness_reducer = 9;
+		}
+		Runtime runtime_cd(cd);
+		Runtime runtime_lpd(lpd);
+		analyzer::StaticCMI<Metric, channels, analyzer::ConstDeltaPolicy<Metric, DELTA, 51, 13, 40, 13>> static_cd;
+		analyzer::StaticCMI<Metric, channels, analyzer::LinearPercentageDeltaPolicy<Metric, 8, 51, 13, 40, 13>> static_lpd;
+
+		r[0] = measure(runtime_cd, in, overhead);
+		r[1] = measure(runtime_lpd, in, overhead);
+		r[2] = measure(static_cd, in, overhead);
+		r[3] = measure(static_lpd, in, overhead);
+	}
+
+	template <size_t... i>
+	bool table(const std::vector<Metric>& in, double overhead, std::index_sequence<i...>){
+		Result r[sizeof...(i)][KINDS];
+		(void)std::initializer_list<int>{ (row<i + 1>(in, overhead, r[i]), 0)... };
+
+		std::printf("  %-8s", "channels");
+		for (const char* k : KIND_NAMES) std::printf(" %20s", k);
+		std::printf("\n  %-8s", "");
+		for (uint8_t k = 0; k < KINDS; ++k) std::printf(" %8s %5s %5s", "Msmpl/s", "p50", "p99");
+		std::printf("\n");
+		bool same = true;
+		for (size_t c = 0; c < sizeof...(i); ++c){
+			std::printf("  %8zu", c + 1);
+			for (uint8_t k = 0; k < KINDS; ++k){
+				if (std::isnan(r[c][k].p50)) std::printf(" %8.1f %5s %5s", r[c][k].msps, "n/a", "n/a");
+				else                         std::printf(" %8.1f %5.1f %5.1f", r[c][k].msps, r[c][k].p50, r[c][k].p99);
+				same = same && r[c][k].same;
+			}
+			std::printf("\n");
+		}
+		return same;
+	}
+
+}
+
+int main(int argc, char** argv){
+	std::vector<Metric> in = argc > 1 ? load(argv[1]) : synthetic(1000000);
+	if (in.empty()){
+		std::fprintf(stderr, "no readouts\n");
+		return 1;
+	}
+
+	double overhead = clock_overhead();
+	std::printf("CMI on the host, %zu readouts, input_batch() throughput and input()+output() latency in ns\n", in.size());
+	bool same = table(in, overhead, std::make_index_sequence<16>());
+	std::printf("  (latency without the clock overhead of %.0f ns, runtime 80:20/9, static 51:13/13, LPD 8%%)\n", overhead);
+	if (in.size() < LATENCY_BLOCK) std::printf("  (latency n/a: fewer than %zu readouts)\n", LATENCY_BLOCK);
+	if (!same) std::printf("  input_batch() DIFFERS from input() one by one\n");
+	return same ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+/* modelled AVR cycles per sample of the smoothing filters
+*
+* runs the filters from filters.h on the simulator core (without firmware) and
+* reads the charged cycles. 'resum' is the moving average as it was done in
+* PCINT0_vect before: store, index modulo, sum up the whole window, divide.
+* the second table has the pipelines of the smoothing modes of main.cpp and a
+* few other combinations, fed with noisy readouts and a multipath spike now and
+* then (the lag of the modes is in make replay).
+*/
+
+#include "simcore.h"
+#include "devices.h"
+#include "avr/io.h"
+#include "../filters.h"
+#include "../cmi.h"
+#include "../fixedpoint.h"
+
+#include <cstdio>
+
+namespace {
+
+	constexpr uint16_t MAX_VALUE { 0x0B << 8 };   // MAX_DISTANCE of main.cpp with TIMING_FINE
+
+	template <uint8_t length>
+	class ResumMovingAverage {
+	public:
+		uint16_t input(uint16_t value){
+			_window[_idx++] = value;
+			_idx %= length;
+			uint32_t sum = 0;
+			for (uint8_t i = 0; i < length; ++i) sum += _window[i];
+			SIM_CHARGE(avrcost::st<uint16_t>() + avrcost::DIV_U8
+			           + length*(avrcost::ld<uint16_t>() + avrcost::add<uint32_t>() + avrcost::LOOP)
+			           + avrcost::DIV_U32);
+			return sum / length;
+		}
+	private:
+		uint16_t _window[length] {};
+		uint8_t _idx {0};
+	};
+
+	sim::Rng rng(1);
+
+		/* noisy readout, every 16th a spike */
+	uint16_t readout(bool spikes){
+		uint16_t r = 1000 + rng.next() % 512;
+		return spikes && rng.next() % 16 == 0 ? r + 1024 : r;
+	}
+
+	template <typename Filter>
+	double cycles_per_sample(Filter& f, bool spikes = false){
+		constexpr int SAMPLES { 1000 };
+		sim::cycles_t start = sim::now;
+		uint16_t sink = 0;
+		for (int i = 0; i < SAMPLES; ++i) sink ^= f.input(readout(spikes));
+		(void)sink;
+		return double(sim::now - start) / SAMPLES;
+	}
+
+		/* the smoothing modes with the parameters of main.cpp */
+	using TDistance = fixedpoint::FixedPoint<12, 4, uint16_t>;
+	using TAnalyzer = analyzer::StaticCMI<TDistance, 4, analyzer::ConstDeltaPolicy<TDistance, 0xC0, 51, 13, 40, 13>>;
+
+	using Cmi = filter::CmiStage<TAnalyzer, filter::IntegerPart<TDistance>>;
+	template <uint8_t length>
+	using Median = filter::RunningMedian<length>;
+	template <uint8_t length>
+	using Mean = filter::MovingAverage<length, MAX_VALUE>;
+
+	template <uint8_t alpha_shift, uint8_t beta_shift, uint8_t lead>
+	using Tracker = filter::Tracker<alpha_shift, beta_shift, lead, 0xC0, 3, MAX_VALUE>;
+
+	template <typename Filter>
+	void mode(const char* name){
+		Filter f;
+		std::printf("  %-22s %8.1f\n", name, cycles_per_sample(f, true));
+	}
+
+	template <uint8_t length>
+	void row(){
+		ResumMovingAverage<length> before;
+		filter::MovingAverage<length, MAX_VALUE> after;
+		double b = cycles_per_sample(before);
+		double a = cycles_per_sample(after);
+		std::printf("  %6u %12.1f %12.1f %8.1fx\n", length, b, a, b / a);
+	}
+
+}
+
+int main(){
+	std::printf("moving average, modelled AVR cycles per sample\n");
+	std::printf("  %6s %12s %12s %9s\n", "window", "resum", "running sum", "speedup");
+	row<4>();
+	row<8>();
+	row<16>();
+	row<20>();
+	row<32>();
+	row<64>();
+
+	std::printf("\nsmoothing pipelines, modelled AVR cycles per sample\n");
+	mode<filter::Pipeline<>>("SMOOTH_NONE");
+	mode<filter::Pipeline<filter::WeightedAverage<80>>>("SMOOTH_AVR");
+	mode<filter::Pipeline<Mean<16>>>("SMOOTH_MOVING_AVR");
+	mode<filter::Pipeline<Median<5>>>("median 5");
+	mode<filter::Pipeline<Median<7>>>("median 7");
+	mode<filter::Pipeline<Median<5>, Mean<4>>>("SMOOTH_MEDIAN (5, 4)");
+	mode<filter::Pipeline<Median<9>, Mean<4>>>("median 9, mean 4");
+	mode<filter::Pipeline<Tracker<3, 7, 3>>>("SMOOTH_TRACKER (3, 7)");
+	mode<filter::Pipeline<Tracker<2, 5, 0>>>("tracker 2, 5, no lead");
+	mode<filter::Pipeline<Median<5>, Tracker<3, 7, 3>>>("median 5, tracker");
+	mode<filter::Pipeline<Cmi>>("SMOOTH_CMI");
+	mode<filter::Pipeline<Cmi, Mean<4>>>("CMI, mean 4");
+	mode<filter::Pipeline<Median<5>, Cmi>>("median 5, CMI");
+	return 0;
+}
@@ -0,0 +1,95 @@
+/* musical scales (scale.h): flash, tuning error, cycles and flutter
+*
+* for every scale of main.cpp: size of the note table, largest deviation of
+* the generated tones from equal temperament, modelled cycles per readout of
+* a hand held still at a band border and of a hand that jumps anywhere, and
+* the number of note changes of the still hand with sensor noise, with and
+* without hysteresis.
+*/
+
+#include "simcore.h"
+#include "devices.h"
+#include "avr/io.h"
+#include "../scale.h"
+#include "../timing.h"
+
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+	constexpr double NOISE { us_to_ticks(8000) / 1000.0 };   // 8us rms, the jitter of a readout
+
+	template <uint16_t mask, uint8_t subdivision>
+	struct Scale {
+		using Table = scale::Table<F_CPU, mask, subdivision>;
+		static constexpr uint16_t SIZE { Table::SIZE };
+		Table table;
+		bool in(uint16_t s) const { return scale::in_scale(mask, subdivision, s); }
+	};
+
+	template <uint16_t mask, uint8_t subdivision>
+	void row(const char* name){
+		static const Scale<mask, subdivision> s;
+		double worst = 0;
+		uint16_t n = 0;
+		for (uint16_t step = 0; n < s.SIZE; ++step){
+			if (!s.in(step)) continue;
+			double ideal = scale::note_frequency(72 + double(step) / subdivision);
+			const tone::Entry& e = s.table.note[n++];
+			double f = double(F_CPU) / (1UL << (e.prescale - 1)) / (e.period + 1);
+			double cents = std::fabs(1200 * std::log2(f / ideal));
+			if (cents > worst) worst = cents;
+		}
+
+		scale::Info info = scale::info(s.table, MAX_DISTANCE);
+		scale::Info no_hysteresis = info;
+		no_hysteresis.hysteresis = 0;
+
+		// hand held at the border between two bands in the middle of the range
+		uint16_t border = MAX_DISTANCE - 1 - (s.SIZE / 2) * info.width;
+		unsigned changes[2] {};
+		sim::cycles_t cycles = 0;
+		for (int h = 0; h < 2; ++h){
+			scale::Quantizer q;
+			q.select(h ? &no_hysteresis : &info);
+			sim::Rng rng(7);
+			q.map(border, MAX_DISTANCE);
+			uint16_t last = q.note();
+			sim::cycles_t start = sim::now;
+			for (int i = 0; i < 1000; ++i){
+				q.map(border + int(rng.gauss() * NOISE), MAX_DISTANCE);
+				if (q.note() != last) ++changes[h];
+				last = q.note();
+			}
+			if (!h) cycles = sim::now - start;
+		}
+
+		// a hand that jumps to anywhere in the range from one readout to the next
+		scale::Quantizer q;
+		q.select(&info);
+		sim::Rng rng(11);
+		sim::cycles_t start = sim::now;
+		for (int i = 0; i < 1000; ++i) q.map(uint16_t(rng.uniform() * MAX_DISTANCE), MAX_DISTANCE);
+		sim::cycles_t jumps = sim::now - start;
+
+		std::printf("  %-11s %5u %6zu %9.1f %9u %8.1f %8.1f %12u %10u\n", name, s.SIZE, sizeof(s.table.note), worst,
+			info.width, cycles / 1000.0, jumps / 1000.0, changes[0], changes[1]);
+	}
+
+}
+
+int main(){
+	std::printf("scales at F_CPU=%lu, 3 octaves from C5 over MAX_DISTANCE = %u ticks (Timer0 /%u)\n",
+		(unsigned long)F_CPU, MAX_DISTANCE, TIMER0_PRESCALE);
+	std::printf("  %-11s %5s %6s %9s %9s %8s %8s %12s %10s\n", "scale", "notes", "bytes", "max cents",
+		"band/tick", "cycles", "jumps", "flutter hyst", "flutter no");
+	row<scale::CHROMATIC, 4>("continuous");
+	row<scale::CHROMATIC, 1>("chromatic");
+	row<scale::MAJOR, 1>("major");
+	row<scale::MINOR, 1>("minor");
+	row<scale::PENTATONIC, 1>("pentatonic");
+	std::printf("  (cycles per readout of a still hand at a band border and of one that jumps anywhere, a jump divides)\n");
+	std::printf("  (flutter: note changes in 1000 readouts of a still hand at a band border, %.1f ticks rms noise)\n", NOISE);
+	return 0;
+}
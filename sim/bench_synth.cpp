@@ -0,0 +1,80 @@
+/* cycle budget of the DDS sample ISR (synth.h, SYNTH_DDS in main.cpp)
+*
+* times TIMER1_OVF_vect of main.cpp (the next sample of the oscillator into
+* OCR1A) for every wavetable in modelled AVR cycles, including interrupt
+* response, prologue and epilogue, and sets it against the cycles per sample
+* at 1, 8 and 16 MHz. the sample ISR also delays the echo capture (PCINT0)
+* by up to its length. then the tuning error of the notes of the chromatic
+* scale: Timer1 registers (scale.h) -> tuning word -> frequency.
+* the whole firmware with DDS: make sim F_CPU=8000000UL SYNTH=SYNTH_DDS
+*/
+
+#include "simcore.h"
+#include "avr/io.h"
+#include "../scale.h"
+#include "../synth.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+	constexpr uint32_t SAMPLE_RATE { 64000000 / 8 / 256 };   // DDS_SAMPLE_RATE of main.cpp
+	constexpr uint32_t F_CPUS[] { 1000000, 8000000, 16000000 };
+
+	template <synth::Wave wave>
+	double sample_cycles(){
+		static const synth::Wavetable<wave> table;
+		synth::Oscillator osc;
+		osc.tune(0x1234);
+		constexpr int SAMPLES { 1000 };
+		sim::cycles_t start = sim::now;
+		for (int i = 0; i < SAMPLES; ++i) OCR1A = osc.next(table);
+		return double(sim::now - start) / SAMPLES + avrcost::ISR_ENTRY + avrcost::ISR_EXIT;
+	}
+
+	void budget(double isr, uint32_t f_cpu){
+		double cycles = double(f_cpu) / SAMPLE_RATE;
+		std::printf("  %2lu MHz   %8.0f", (unsigned long)(f_cpu / 1000000), cycles);
+		if (isr >= cycles) std::printf("   doesn't fit\n");
+		else std::printf(" %7.1f%% %8.0f %8.1f us\n", 100 * isr / cycles, cycles - isr, isr * 1e6 / f_cpu);
+	}
+
+	template <uint32_t f_cpu>
+	void tuning(){
+		constexpr scale::Table<f_cpu, scale::CHROMATIC> notes {};
+		double worst = 0, sum = 0;
+		sim::cycles_t start = sim::now;
+		for (uint16_t i = 0; i < notes.SIZE; ++i){
+			tone::Entry e = notes.note[i];
+			uint16_t step = synth::step<f_cpu, SAMPLE_RATE>(tone::Tone{ e.prescale, e.period, 0 });
+			double f = double(step) * SAMPLE_RATE / 65536;
+			double cents = std::fabs(1200 * std::log2(f / scale::note_frequency(72 + i)));   // from C5
+			worst = std::max(worst, cents);
+			sum += cents;
+		}
+		std::printf("  %2lu MHz   %8.1f %8.1f %8.1f\n", (unsigned long)(f_cpu / 1000000), sum / notes.SIZE, worst,
+			double(sim::now - start) / notes.SIZE);
+	}
+
+}
+
+int main(){
+	double sine = sample_cycles<synth::SINE>();
+	double triangle = sample_cycles<synth::TRIANGLE>();
+	double saw = sample_cycles<synth::SOFT_SAW>();
+	std::printf("DDS sample ISR, modelled AVR cycles, %lu samples/s\n", (unsigned long)SAMPLE_RATE);
+	std::printf("  sine %.1f, triangle %.1f, soft saw %.1f cycles, 256 bytes of flash each\n\n", sine, triangle, saw);
+	std::printf("  %-8s %8s %8s %8s %11s\n", "F_CPU", "budget", "cpu", "left", "echo delay");
+	for (uint32_t f_cpu : F_CPUS) budget(std::max(sine, std::max(triangle, saw)), f_cpu);
+	std::printf("  (budget: cycles per sample, left: for the other ISRs and the main loop,\n"
+	            "   echo delay: latency the sample ISR may add to PCINT0)\n");
+
+	std::printf("\ntuning of the chromatic scale (3 octaves from C5), cents off\n");
+	std::printf("  %-8s %8s %8s %8s\n", "F_CPU", "mean", "max", "cycles");
+	tuning<8000000>();
+	tuning<16000000>();
+	std::printf("  (cycles: synth::step() in the main loop, once per readout)\n");
+	return 0;
+}
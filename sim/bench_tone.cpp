@@ -0,0 +1,102 @@
+/* flash size vs. resolution of the tone lookup table (tone.h)
+*
+* for every quantization shift: table size, flash share on the ATtiny25/45/85,
+* resolution and the largest deviation of OCR1C from the exact mapping.
+* also compares the modelled cycles of the table lookup with the former
+* arithmetic mapping (32 bit division and modulo).
+* then the glide (tone::Glide) over an octave boundary: steps until it gets
+* there, cycles per step and the largest jump of the pitch between two steps.
+*/
+
+#include "simcore.h"
+#include "avr/io.h"
+#include "../tone.h"
+#include "../timing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+	tone::Tone exact(uint32_t distance){
+		uint8_t octave = (distance / DIST_OCT + tone::base_prescale(F_CPU)) & 0x0F;
+		uint8_t period = (distance % DIST_OCT) * 128 / DIST_OCT + 128;
+		SIM_CHARGE(2*avrcost::DIV_U32 + avrcost::shift<uint32_t>(7) + 10);
+		return tone::Tone{ octave, period, uint8_t(period / 2) };
+	}
+
+	template <uint8_t shift>
+	void row(){
+		using Table = tone::Table<F_CPU, MAX_DISTANCE, DIST_OCT, shift>;
+		static const Table table;
+		int max_error = 0;
+		sim::cycles_t lookup_cycles = 0;
+		for (uint16_t d = 0; d < MAX_DISTANCE; ++d){
+			tone::Tone e = exact(d);
+			sim::cycles_t start = sim::now;
+			tone::Tone t = table.lookup(d);
+			lookup_cycles += sim::now - start;
+			int err = (t.prescale == e.prescale) ? std::abs(int(t.ocr1c) - int(e.ocr1c)) : 128;
+			if (err > max_error) max_error = err;
+		}
+		unsigned bytes = sizeof(table.entry);
+		std::printf("  %5u %7u %6u %8.1f%% %6.1f%% %6.1f%% %9u %10d %7.1f%s\n", shift, Table::SIZE, bytes,
+			100.0 * bytes / 2048, 100.0 * bytes / 4096, 100.0 * bytes / 8192,
+			DIST_OCT >> shift, max_error, double(lookup_cycles) / MAX_DISTANCE,
+			shift == tone::auto_shift(DIST_OCT) ? "   <- default" : "");
+	}
+
+
+	double frequency(const tone::Tone& t){ return 1e6 / (1 << (t.prescale - 1)) / (t.ocr1c + 1); }   // at 1 MHz
+
+	template <uint8_t shift>
+	void glide(const tone::Tone& from, const tone::Tone& to){
+		tone::Glide<shift> g;
+		g.target(from);
+		g.target(to);
+		tone::Tone t = from;
+		double last = frequency(from), jump = 0;
+		unsigned steps = 0;
+		sim::cycles_t start = sim::now;
+		while (g.step(t)){
+			double f = frequency(t);
+			jump = std::max(jump, std::fabs(1200 * std::log2(f / last)));
+			last = f;
+			++steps;
+		}
+		std::printf("  %5u  %4.0f -> %4.0f Hz %6u %8.1f %10.1f\n", shift, frequency(from), frequency(to), steps,
+			double(sim::now - start) / steps, jump);
+	}
+
+}
+
+int main(){
+	sim::cycles_t start = sim::now;
+	for (uint16_t d = 0; d < MAX_DISTANCE; ++d) exact(d);
+	double exact_cycles = double(sim::now - start) / MAX_DISTANCE;
+
+	std::printf("tone table at F_CPU=%lu for MAX_DISTANCE = %u ticks, DIST_OCT = %u ticks (Timer0 /%u)\n",
+		(unsigned long)F_CPU, MAX_DISTANCE, DIST_OCT, TIMER0_PRESCALE);
+	std::printf("  %5s %7s %6s %9s %7s %7s %9s %10s %7s\n",
+		"shift", "entries", "bytes", "tiny25", "tiny45", "tiny85", "steps/oct", "max error", "cycles");
+	row<0>();
+	row<1>();
+	row<2>();
+	row<3>();
+	row<4>();
+	row<5>();
+	row<6>();
+	std::printf("  (max error in OCR1C steps, cycles of the lookup; the arithmetic mapping takes %.1f cycles)\n", exact_cycles);
+
+	std::printf("\nglide across octaves (1 MHz)\n");
+	std::printf("  %5s  %17s %6s %8s %10s\n", "shift", "", "steps", "cycles", "max cents");
+	const tone::Tone low { 5, 200, 100 }, high { 3, 140, 70 };
+	glide<1>(low, high);
+	glide<2>(low, high);
+	glide<2>(high, low);
+	glide<3>(low, high);
+	std::printf("  (steps: until it is there, cycles: per step, max cents: largest jump of the pitch in one step)\n");
+	return 0;
+}
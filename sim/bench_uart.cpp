@@ -0,0 +1,125 @@
+/* bit timing of the software UART (myserial.h)
+*
+* first the baud rates that F_CPU can reach: cycles per bit, the worst edge or
+* sample point against the ideal one (BitTiming rounds every point to the
+* nearest cycle/tick) and whether the blocking send_byte()/recv_byte() and the
+* send ISR of the firmware (Timer0 /8) fit. then the blocking functions of this
+* build on the simulated pins: send_byte() of every byte, its edges measured by
+* the UartMonitor, and recv_byte() of every byte from a sender that is off by
+* up to MAX_SKEW %: the sample points are in the middle if that works about as
+* far to both sides.
+* another baud rate or clock: make simbench BAUD=115200 F_CPU=8000000UL
+*/
+
+#include "simcore.h"
+#include "devices.h"
+#include "avr/io.h"
+
+#ifndef BAUDRATE
+#define BAUDRATE 9600
+#endif
+#define RxDLatency 3   // the polling loop of receiver(): sbic, rjmp
+#include "../myserial.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+namespace {
+
+	constexpr uint8_t TXD { 4 }, RXD { 3 };             // the default pins of myserial.h
+	constexpr uint16_t SEND_ISR { 66 };                 // mean cycles of TIMER0_COMPA_vect in sim/theremin_sim
+	constexpr uint8_t TIMER0_PRESCALE { 8 };            // TIMING_COARSE
+	constexpr double MAX_SKEW { 10 };                   // % off the baud rate, at most
+
+	template <uint32_t f_cpu, uint32_t baudrate>
+	void rate(){
+		using Cycles = BitTiming<f_cpu, baudrate>;
+		using Ticks = BitTiming<f_cpu / TIMER0_PRESCALE, baudrate>;
+		bool blocking = int32_t(Cycles::shortest()) > SerialIOCycles && Cycles::error_permille() <= 10 * MAXBITERROR;
+		bool background = Ticks::shortest() * TIMER0_PRESCALE >= 80 && Ticks::error_permille() <= 10 * MAXBITERROR;
+		double cycles = double(f_cpu) / baudrate;
+		std::printf("  %2lu MHz %7lu %8.1f %6.1f%%  %-4s %6.1f %6.1f%%  %-4s %5.0f%%\n",
+			(unsigned long)(f_cpu / 1000000), (unsigned long)baudrate, cycles, Cycles::error_permille() / 10.0,
+			blocking ? "yes" : "no", cycles / TIMER0_PRESCALE, Ticks::error_permille() / 10.0, background ? "yes" : "no",
+			100 * SEND_ISR / cycles);
+	}
+
+	template <uint32_t f_cpu>
+	void rates(){
+		rate<f_cpu, 9600>();
+		rate<f_cpu, 19200>();
+		rate<f_cpu, 38400>();
+		rate<f_cpu, 57600>();
+		rate<f_cpu, 115200>();
+	}
+
+
+	void sender(){
+		for (uint16_t b = 0; b < 256; ++b) send_byte(b);
+	}
+
+	std::vector<int> received;
+
+	void receiver(){
+		init_recv();
+		for (;;){
+			while (RxDPort & RxDBit) SIM_CHARGE(2);
+			received.push_back(recv_byte());
+			recv_stop();
+		}
+	}
+
+		/* bytes that recv_byte() got wrong from a sender skew % off */
+	unsigned receive(double skew){
+		static std::deque<sim::UartSender> senders;   // stay attached
+		senders.emplace_back(RXD, static_cast<uint32_t>(BAUDRATE * (1 + skew / 100) + 0.5), PARITY);
+		sim::UartSender& uart = senders.back();
+		sim::attach(&uart);
+		std::vector<uint8_t> bytes;
+		for (uint16_t b = 0; b < 256; ++b) bytes.push_back(b);
+		sim::cycles_t start = sim::now + 100;
+		uart.send(start, bytes);
+		received.clear();
+		sim::run(start + sim::cycles_t((SERIAL_FRAME_BITS + 1.0) * 256 * F_CPU / BAUDRATE), receiver);
+		unsigned wrong = 256 - std::min<size_t>(received.size(), 256);
+		for (size_t i = 0; i < received.size() && i < 256; ++i) wrong += received[i] != int(i);
+		return wrong;
+	}
+
+		/* the largest skew in steps of 0.5 % to one side that loses no byte */
+	double margin(double sign){
+		double skew = 0;
+		while (skew < MAX_SKEW && !receive(sign * (skew + 0.5))) skew += 0.5;
+		return skew;
+	}
+
+}
+
+int main(){
+	std::printf("software UART, blocking and in the background (Timer0 /%u)\n", TIMER0_PRESCALE);
+	std::printf("  %-6s %7s %8s %7s  %-4s %6s %7s  %-4s %6s\n", "F_CPU", "bps", "cycles", "off", "fits", "ticks", "off",
+		"fits", "isr");
+	rates<1000000>();
+	rates<8000000>();
+	rates<16000000>();
+	std::printf("  (off: worst edge or sample point in %% of a bit, fits: at most %u%% off and room for\n"
+	            "   the out/in or the send ISR, isr: its cpu while sending)\n", MAXBITERROR);
+
+	std::printf("\nthis build, %lu bps at %lu MHz\n", (unsigned long)BAUDRATE, (unsigned long)(F_CPU / 1000000));
+	sim::run(sim::NEVER, init_send);   // not the edges of the pin becoming an output
+	sim::UartMonitor monitor(TXD, BAUDRATE, PARITY);
+	sim::attach(&monitor);
+	sim::run(sim::NEVER, sender);
+	unsigned wrong = 0, framing = 0;
+	for (size_t i = 0; i < monitor.bytes().size(); ++i){
+		wrong += monitor.bytes()[i].value != i;
+		framing += monitor.bytes()[i].framing_error;
+	}
+	std::printf("  send_byte()  %zu bytes, %u wrong, %u framing errors, edges up to %.1f%% of a bit off\n",
+		monitor.bytes().size(), wrong, framing, 100 * monitor.max_edge_error());
+	std::printf("  recv_byte()  %u of 256 wrong, the sender may be %.1f%% slower and %.1f%% faster\n", receive(0),
+		margin(-1), margin(1));
+	return 0;
+}
@@ -0,0 +1,247 @@
+#include "devices.h"
+#include "avr/io.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sim {
+
+	uint64_t Rng::next(){
+		_s ^= _s >> 12;
+		_s ^= _s << 25;
+		_s ^= _s >> 27;
+		return _s * 0x2545F4914F6CDD1DULL;
+	}
+
+	double Rng::uniform(){ return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+	double Rng::gauss(){
+		double u = uniform(), v = uniform();
+		return std::sqrt(-2.0 * std::log(1.0 - u)) * std::cos(2 * M_PI * v);
+	}
+
+
+	/********** Hand **********/
+
+	namespace {
+		const char* const profiles[] { "sweep", "glissando", "steps", "hold", "ramps" };
+		constexpr double NEAR_CM { 6 }, FAR_CM { 45 };
+
+		double triangle(double t, double period){
+			double x = std::fmod(t / period, 1.0);
+			return NEAR_CM + (FAR_CM - NEAR_CM) * (x < 0.5 ? 2 * x : 2 - 2 * x);
+		}
+	}
+
+	Hand::Hand(const std::string& profile, bool away, uint64_t seed) : _profile(-1), _away(away) {
+		for (int i = 0; i < 5; ++i) if (profile == profiles[i]) _profile = i;
+		Rng rng(seed ^ 0x5DEECE66DULL);
+		for (int i = 0; i < 256; ++i) _steps.push_back(NEAR_CM + (FAR_CM - NEAR_CM) * rng.uniform());
+	}
+
+	double Hand::distance_cm(double t) const {
+		if (_away && std::fmod(t, 3.0) >= 2.6) return -1;
+		switch (_profile){
+			case 0: return triangle(t, 4.0);
+			case 1: return triangle(t, 0.6);
+			case 2: return _steps[static_cast<size_t>(t / 0.5) % _steps.size()];
+			case 4: {   // per second a jump, a hold for 0.4s and a straight slide to the next point
+				size_t i = 2 * static_cast<size_t>(t);
+				double x = std::fmod(t, 1.0);
+				double from = _steps[i % _steps.size()], to = _steps[(i + 1) % _steps.size()];
+				return x < 0.4 ? from : from + (to - from) * (x - 0.4) / 0.6;
+			}
+			default: return 20;
+		}
+	}
+
+
+	/********** HC-SR04 **********/
+
+	Hcsr04::Hcsr04(uint8_t trigger_bit, uint8_t echo_bit, const Hand& hand, Rng& rng,
+	               double noise_us, double spike_rate)
+		: _trigger(trigger_bit), _echo(echo_bit), _hand(hand), _rng(rng),
+		  _noise_us(noise_us), _spike_rate(spike_rate) {
+		drive_pin(_echo, false);
+	}
+
+	void Hcsr04::pins_changed(uint8_t levels, uint8_t changed){
+		if (!(changed & (1<<_trigger))) return;
+		if (levels & (1<<_trigger)){
+			_trigger_high_since = now;
+			return;
+		}
+		// falling edge of a trigger pulse of at least 10us starts a measurement
+		if (now - _trigger_high_since < cycles_us(10)) return;
+		if (_state != State::IDLE){
+			++_ignored;
+			return;
+		}
+		Echo e;
+		e.trigger = now;
+		double d = _hand.distance_cm(seconds(now));
+		e.true_us = d < 0 ? ROOM_US : d * US_PER_CM;
+		e.echo_us = e.true_us + _noise_us * _rng.gauss();
+		e.spike = _rng.uniform() < _spike_rate;
+		e.crosstalk = false;
+		if (e.spike){   // multipath: the echo took a longer way or a reflection from something else arrived first
+			e.echo_us = _rng.uniform() < 0.7 ? e.true_us * (1.3 + 1.2 * _rng.uniform())
+			                                 : e.true_us * (0.3 + 0.5 * _rng.uniform());
+		}
+		if (e.echo_us < 150) e.echo_us = 150;
+		_echoes.push_back(e);
+		_state = State::BURST;
+		next_event = now + cycles_us(DELAY_US);
+	}
+
+	void Hcsr04::event(){
+		if (_state == State::BURST){
+			drive_pin(_echo, true);
+			_state = State::ECHO;
+			Echo& e = _echoes.back();
+			next_event = now + cycles_us(e.echo_us);
+			for (cycles_t a : _arrivals){   // a burst of another module comes first
+				if (a > now && a < next_event){
+					next_event = a;
+					e.echo_us = seconds(a - now) * 1e6;
+					e.crosstalk = true;
+				}
+			}
+			for (auto& c : _coupled){
+				for (int k = 1; k <= 2; ++k){
+					if (_rng.uniform() < c.second) c.first->hear(now + cycles_us(k * e.true_us));
+				}
+			}
+		} else {
+			drive_pin(_echo, false);
+			_state = State::IDLE;
+			next_event = NEVER;
+		}
+	}
+
+
+	void Hcsr04::couple(Hcsr04& other, double rate){
+		_coupled.push_back({ &other, rate });
+	}
+
+	void Hcsr04::hear(cycles_t arrival){
+		_arrivals.erase(std::remove_if(_arrivals.begin(), _arrivals.end(), [](cycles_t a){ return a <= now; }), _arrivals.end());
+		_arrivals.push_back(arrival);
+		if (_state == State::ECHO && arrival < next_event){
+			Echo& e = _echoes.back();
+			e.echo_us -= seconds(next_event - arrival) * 1e6;
+			e.crosstalk = true;
+			next_event = arrival;
+			reschedule();
+		}
+	}
+
+	uint64_t Hcsr04::crosstalk() const {
+		return std::count_if(_echoes.begin(), _echoes.end(), [](const Echo& e){ return e.crosstalk; });
+	}
+
+
+	/********** UART **********/
+
+	UartMonitor::UartMonitor(uint8_t txd_bit, uint32_t baudrate, uint8_t parity)
+		: _bit(txd_bit), _parity(parity), _bit_cycles(double(F_CPU) / baudrate) {}
+
+	void UartMonitor::pins_changed(uint8_t levels, uint8_t changed){
+		if (!(changed & (1<<_bit))) return;
+		_level = levels & (1<<_bit);
+		if (_pos < 0 && !_level){   // start bit
+			_start = now;
+			_pos = 0;
+			_shift = 0;
+			next_event = _start + cycles_t(1.5 * _bit_cycles);
+		} else if (_pos >= 0){
+			double bits = (now - _start) / _bit_cycles;
+			_max_edge_error = std::max(_max_edge_error, std::fabs(bits - std::round(bits)));
+		}
+	}
+
+	void UartMonitor::event(){
+		int data_bits = _parity ? 9 : 8;
+		if (_pos < data_bits){
+			if (_level) _shift |= 1<<_pos;
+			++_pos;
+			next_event = _start + cycles_t((_pos + 1.5) * _bit_cycles);
+		} else {   // stop bit
+			_bytes.push_back({ _start, uint8_t(_shift), !_level });
+			_pos = -1;
+			next_event = NEVER;
+		}
+	}
+
+
+	UartSender::UartSender(uint8_t rxd_bit, uint32_t baudrate, uint8_t parity)
+		: _bit(rxd_bit), _parity(parity), _bit_cycles(double(F_CPU) / baudrate) {}
+
+	void UartSender::send(cycles_t at, const std::vector<uint8_t>& bytes){
+		std::vector<Level> levels;
+		double t = at;
+		auto bit = [&](bool high){ levels.push_back({ cycles_t(t), high }); t += _bit_cycles; };
+		for (uint8_t b : bytes){
+			bit(false);
+			bool ones = false;
+			for (int i = 0; i < 8; ++i){
+				bit(b & (1<<i));
+				ones ^= (b >> i) & 1;
+			}
+			if (_parity) bit(_parity == 1 ? !ones : ones);   // odd: the number of ones with the parity bit is odd
+			bit(true);
+		}
+		_levels.insert(_levels.end(), levels.begin(), levels.end());
+		std::stable_sort(_levels.begin() + _next, _levels.end(), [](const Level& a, const Level& b){ return a.time < b.time; });
+		_count += bytes.size();
+		next_event = _levels[_next].time;
+		reschedule();
+	}
+
+	void UartSender::event(){
+		while (_next < _levels.size() && _levels[_next].time <= now){
+			drive_pin(_bit, _levels[_next++].high);
+		}
+		next_event = _next < _levels.size() ? _levels[_next].time : NEVER;
+	}
+
+
+	/********** Timer1 tone **********/
+
+	void ToneMonitor::io_written(uint8_t addr, uint8_t value){
+		if (addr == 0x39){   // TIMSK: TOIE1
+			_dac = value & (1<<TOIE1);
+			return;
+		}
+		if (_dac && addr == 0x2E){
+			++_samples;
+			if (_ocr1a < 0x80 && value >= 0x80){
+				if (_rise != NEVER) _periods.push_back({ now, double(F_CPU) / double(now - _rise) });
+				_rise = now;
+			}
+			_ocr1a = value;
+			return;
+		}
+		switch (addr){
+			case 0x30: _tccr1 = value; break;
+			case 0x2D: _ocr1c = value; break;
+			case 0x2E: _ocr1a = value; break;
+			case 0x27: _pllcsr = value; return;
+			default: return;
+		}
+		// the firmware writes TCCR1, OCR1C and OCR1A in a row. merge them into one update
+		if (!_tones.empty() && now - _tones.back().time < 64){
+			_tones.back() = { _tones.back().time, _tccr1, _ocr1c, _ocr1a };
+		} else {
+			_tones.push_back({ now, _tccr1, _ocr1c, _ocr1a });
+		}
+	}
+
+	double ToneMonitor::frequency(const Tone& t) const {
+		uint8_t cs = t.tccr1 & 0x0F;
+		if (!cs) return 0;
+		double clock = (_pllcsr & (1<<PCKE)) ? ((_pllcsr & (1<<LSM)) ? 32e6 : 64e6) : double(F_CPU);
+		return clock / double(1UL << (cs - 1)) / (t.ocr1c + 1);
+	}
+
+}
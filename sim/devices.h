@@ -0,0 +1,166 @@
+/* devices attached to the simulated ATtiny
+*
+* Hand     position of the player's hand over time (synthetic profiles)
+* Hcsr04   HC-SR04 ultrasonic module: TRIGGER input, ECHO output, with noise
+*          and multipath spikes, and the bursts of other modules (cross talk)
+* UartMonitor  decodes the software UART output on the TxD pin
+* UartSender   drives the RxD pin like a serial adapter
+* ToneMonitor  records the Timer1 tone registers written by the firmware, or
+*          with the Timer1 overflow interrupt on (DDS) the pitch of the
+*          samples written to OCR1A
+*/
+
+#ifndef __sim_devices_h__
+#define __sim_devices_h__
+
+#include "simcore.h"
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace sim {
+
+	/* small deterministic PRNG (xorshift64*), identical results on every host */
+	class Rng {
+	public:
+		explicit Rng(uint64_t seed) : _s(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+		uint64_t next();
+		double uniform();          // [0, 1)
+		double gauss();            // standard normal
+	private:
+		uint64_t _s;
+	};
+
+
+	class Hand {
+	public:
+			/* profiles: "sweep", "glissando", "steps", "hold", "ramps" (jumps,
+			   holds and slides of 0.6s in between, for the lag of the filters)
+			   with away: hand is removed for 0.4s every 3s */
+		Hand(const std::string& profile, bool away, uint64_t seed);
+		bool valid() const { return _profile >= 0; }
+			/* distance in cm at time t [s], negative if there is no hand */
+		double distance_cm(double t) const;
+	private:
+		int _profile;
+		bool _away;
+		std::vector<double> _steps;
+	};
+
+
+	class Hcsr04 : public Device {
+	public:
+		struct Echo {
+			cycles_t trigger;      // time of the trigger edge
+			double true_us;        // echo length for the true distance
+			double echo_us;        // echo length produced (noise, spikes, cross talk)
+			bool spike;
+			bool crosstalk;        // ended by the burst of another module
+		};
+
+		static constexpr double US_PER_CM { 58.3 };      // round trip at 343 m/s
+		static constexpr double DELAY_US { 300 };        // trigger -> start of ECHO (burst + processing)
+		static constexpr double ROOM_US { 200 * 58.3 };  // echo from the room when there is no hand
+
+		Hcsr04(uint8_t trigger_bit, uint8_t echo_bit, const Hand& hand, Rng& rng,
+		       double noise_us, double spike_rate);
+
+		void pins_changed(uint8_t levels, uint8_t changed) override;
+		void event() override;
+
+			/* the burst of this module reaches 'other' with probability 'rate',
+			   after the run time to its hand and after twice that (a reflection) */
+		void couple(Hcsr04& other, double rate);
+
+		uint64_t pings() const { return _echoes.size(); }
+		uint64_t crosstalk() const;
+		uint64_t ignored_triggers() const { return _ignored; }
+		const std::vector<Echo>& echoes() const { return _echoes; }
+
+	private:
+		enum class State { IDLE, BURST, ECHO };
+		uint8_t _trigger, _echo;
+		const Hand& _hand;
+		Rng& _rng;
+		double _noise_us, _spike_rate;
+		State _state { State::IDLE };
+		cycles_t _trigger_high_since { 0 };
+		uint64_t _ignored { 0 };
+		std::vector<Echo> _echoes;
+		std::vector<std::pair<Hcsr04*, double>> _coupled;
+		std::vector<cycles_t> _arrivals;   // of bursts of other modules
+
+		void hear(cycles_t arrival);
+	};
+
+
+	class UartMonitor : public Device {
+	public:
+		struct Byte { cycles_t time; uint8_t value; bool framing_error; };
+
+		UartMonitor(uint8_t txd_bit, uint32_t baudrate, uint8_t parity);
+		void pins_changed(uint8_t levels, uint8_t changed) override;
+		void event() override;
+		const std::vector<Byte>& bytes() const { return _bytes; }
+			/* the worst edge inside a frame against the ideal one (from the start bit on), in bits */
+		double max_edge_error() const { return _max_edge_error; }
+
+	private:
+		uint8_t _bit, _parity;
+		double _bit_cycles;
+		double _max_edge_error { 0 };
+		bool _level { true };
+		int _pos { -1 };           // -1 idle, 0..7 data bits, 8 parity (if any), then stop
+		cycles_t _start { 0 };
+		uint16_t _shift { 0 };
+		std::vector<Byte> _bytes;
+	};
+
+
+	class UartSender : public Device {
+	public:
+		UartSender(uint8_t rxd_bit, uint32_t baudrate, uint8_t parity);
+			/* send the bytes back to back from time 'at' on, one stop bit each */
+		void send(cycles_t at, const std::vector<uint8_t>& bytes);
+		void event() override;
+		size_t bytes() const { return _count; }
+
+	private:
+		struct Level { cycles_t time; bool high; };
+		uint8_t _bit, _parity;
+		double _bit_cycles;
+		size_t _count { 0 };
+		std::vector<Level> _levels;   // in time order
+		size_t _next { 0 };
+	};
+
+
+	class ToneMonitor : public Device {
+	public:
+		struct Tone { cycles_t time; uint8_t tccr1, ocr1c, ocr1a; };
+		struct Period { cycles_t time; double hz; };
+
+		void io_written(uint8_t addr, uint8_t value) override;
+		const std::vector<Tone>& tones() const { return _tones; }
+			/* output frequency of a register set (PWM1A mode: clock / prescale / (OCR1C + 1)) */
+		double frequency(const Tone& t) const;
+
+			/* DDS: OCR1A is a sample. one period per rising crossing of the middle */
+		bool dac() const { return _dac; }
+		uint64_t samples() const { return _samples; }
+		const std::vector<Period>& periods() const { return _periods; }
+
+	private:
+		uint8_t _tccr1 { 0 }, _ocr1c { 0 }, _ocr1a { 0 }, _pllcsr { 0 };
+		std::vector<Tone> _tones;
+		bool _dac { false };
+		uint64_t _samples { 0 };
+		cycles_t _rise { NEVER };
+		std::vector<Period> _periods;
+	};
+
+}
+
+#endif
@@ -0,0 +1,317 @@
+/* offline replay of an echo trace (trace.h) through all smoothing modes of main.cpp
+*
+*   sim/replay TRACE
+*
+* runs the readouts of the trace through SMOOTH_NONE, SMOOTH_AVR,
+* SMOOTH_MOVING_AVR, SMOOTH_MEDIAN, SMOOTH_TRACKER and SMOOTH_CMI with the
+* the settings of main.cpp (settings.h) and reports per mode, T being the CMI
+* channel width (CMI_WIDTH_US):
+*   - lag: shift of the output against the reference with the smallest squared
+*     error over the readouts on ramps (the reference moves by more than T around
+*     them without a jump), to a fraction of a readout. negative if the output is
+*     ahead. TRACKER_LEAD takes a readout per lead off the tracker, for the glide
+*     that follows in main.cpp (GLIDE_MS), which isn't replayed. n/a without ramps,
+*     theremin_sim --profile ramps has slides of 0.6 s
+*   - settling: time after a step of the reference until the output stays
+*     within T/2 of it for 8 readouts (mean and max)
+*   - jitter: RMS of the change of the output per readout while the reference
+*     holds still and the output has settled
+*   - outliers: share of the readouts more than T off the reference that
+*     don't move the output by more than T/2
+*   - throughput of the filter on the host
+* the reference is the true distance if the trace has it (theremin_sim --trace),
+* else the median of 9 readouts around each one. then the same for a few gains
+* and leads of the tracker, the trade-off between lag and jitter.
+*
+* the settings are those of a firmware with TRACE_OUTPUT, the one that records
+* traces (PING_RATE, and with it TRACKER_LEAD). the readouts are converted to
+* Timer0 ticks of timing.h, so the filters run like main.cpp built with the same
+* F_CPU and TIMING_MODE (make replay F_CPU=... TIMING=...) whatever the tick
+* rate of the trace (a coarse one keeps its steps). timeouts reach the filters
+* as hold(), like in main.cpp.
+*
+* like bench_cmi_host this one runs on the host only (no avr/io.h). the
+* trace is mmap'ed and decoded in one pass.
+*/
+
+#ifndef TRACE_OUTPUT
+#define TRACE_OUTPUT
+#endif
+
+#include "trace.h"
+#include "../timing.h"
+#include "../settings.h"
+#include "../filters.h"
+#include "../cmi.h"
+#include "../fixedpoint.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+	using Clock = std::chrono::steady_clock;
+
+	// the compile time CMI of main.cpp, times in Timer0 ticks
+	using TDistance = fixedpoint::FixedPoint<12, 4, uint16_t>;
+	using TAnalyzer = analyzer::StaticCMI<TDistance, 4, analyzer::ConstDeltaPolicy<TDistance, CMI_WIDTH,
+		CMI_WEIGHT_OLD, CMI_WEIGHT_NEW, CMI_INITIAL_BADNESS, CMI_BADNESS_REDUCER>>;
+
+	// the pipelines of the SMOOTH_ modes
+	using SmoothNone = filter::Pipeline<>;
+	using SmoothAvr = filter::Pipeline<filter::WeightedAverage<OLD_AVR_PERCENTAGE>>;
+	using SmoothMovingAvr = filter::Pipeline<filter::MovingAverage<NO_AVERAGE, MAX_DISTANCE>>;
+	using SmoothMedian = filter::Pipeline<filter::RunningMedian<MEDIAN_LENGTH>, filter::MovingAverage<MEDIAN_MEAN, MAX_DISTANCE>>;
+	template <uint8_t alpha_shift, uint8_t beta_shift, uint8_t lead>
+	using Tracker = filter::Pipeline<filter::Tracker<alpha_shift, beta_shift, lead, TRACKER_GATE, TRACKER_MISSES, MAX_DISTANCE>>;
+	using SmoothTracker = Tracker<TRACKER_ALPHA, TRACKER_BETA, TRACKER_LEAD>;
+	using SmoothCmi = filter::Pipeline<filter::CmiStage<TAnalyzer, filter::IntegerPart<TDistance>>>;
+
+	constexpr int32_t T { CMI_WIDTH };         // ticks, channel width of the CMI
+	constexpr double TICK_US { 1e6 / TIMER0_HZ };
+	constexpr size_t MEDIAN_RADIUS { 4 };
+	constexpr size_t MAX_LAG { 32 };           // readouts
+	constexpr size_t MAX_LEAD { 8 };           // readouts
+	constexpr size_t STEADY { 8 };             // readouts
+	constexpr size_t SETTLE_LIMIT { 256 };     // readouts, slower is "unsettled"
+
+	struct Readouts {
+		std::vector<double> time;      // s
+		std::vector<uint16_t> echo;    // ticks
+		std::vector<int32_t> ref;      // ticks
+		std::vector<bool> gap;         // timeouts before it
+		uint64_t pings { 0 };
+		uint64_t no_echo { 0 };        // none or >= MAX_DISTANCE
+		double seconds { 0 };
+	};
+
+	struct Metrics {
+		double lag_ms;                 // NAN without ramps
+		size_t ramps;                  // readouts the lag is measured on
+		double settle_mean_ms, settle_max_ms;
+		size_t steps, unsettled;
+		double jitter;
+		size_t outliers, rejected;
+		double msps;
+	};
+
+
+	int32_t median(const std::vector<uint16_t>& x, size_t i){
+		size_t first = i >= MEDIAN_RADIUS ? i - MEDIAN_RADIUS : 0;
+		size_t last = std::min(x.size(), i + MEDIAN_RADIUS + 1);
+		uint16_t w[2 * MEDIAN_RADIUS + 1];
+		std::copy(x.begin() + first, x.begin() + last, w);
+		size_t n = last - first;
+		std::nth_element(w, w + n / 2, w + n);
+		return w[n / 2];
+	}
+
+		/* decodes the whole trace. readouts < MAX_DISTANCE go to the filters like in main.cpp */
+	bool decode(trace::Reader& in, Readouts& r){
+		trace::Record rec;
+		uint64_t ticks = 0;
+		const double scale = double(TIMER0_HZ) / in.tick_rate();
+		std::vector<int32_t> truth;
+		bool gap = false;
+		while (in.next(rec)){
+			ticks += rec.dt;
+			r.pings++;
+			uint32_t echo = uint32_t(rec.echo * scale + 0.5);
+			if (echo == 0 || echo >= MAX_DISTANCE){
+				r.no_echo++;
+				gap = true;
+				continue;
+			}
+			r.time.push_back(double(ticks) / in.tick_rate());
+			r.echo.push_back(uint16_t(echo));
+			r.gap.push_back(gap);
+			gap = false;
+			truth.push_back(int32_t(rec.truth * scale + 0.5));
+		}
+		r.seconds = double(ticks) / in.tick_rate();
+		r.ref.resize(r.echo.size());
+		for (size_t i = 0; i < r.echo.size(); ++i){
+			r.ref[i] = in.has_truth() ? truth[i] : median(r.echo, i);
+		}
+		return !in.truncated();
+	}
+
+	bool steady(const std::vector<int32_t>& r, size_t first, size_t last, int32_t range){   // [first, last)
+		auto mm = std::minmax_element(r.begin() + first, r.begin() + last);
+		return *mm.second - *mm.first < range;
+	}
+
+	Metrics evaluate(const Readouts& r, const std::vector<uint16_t>& f){
+		Metrics m {};
+		const size_t n = f.size();
+		const double period_ms = n > 1 ? 1e3 * (r.time.back() - r.time.front()) / (n - 1) : 0;
+
+		// readouts on a ramp: the reference moves by more than T over the shifts around them, without a jump
+		std::vector<size_t> ramp;
+		for (size_t i = MAX_LAG; i + MAX_LEAD < n; ++i){
+			if (std::abs(r.ref[i + MAX_LEAD] - r.ref[i - MAX_LAG]) <= T) continue;
+			size_t j = i - MAX_LAG + 1;
+			while (j <= i + MAX_LEAD && std::abs(r.ref[j] - r.ref[j - 1]) <= T / 4 && !r.gap[j]) ++j;
+			if (j > i + MAX_LEAD) ramp.push_back(i);
+		}
+		m.ramps = ramp.size();
+		m.lag_ms = NAN;
+		if (!ramp.empty()){
+			double sq[MAX_LEAD + MAX_LAG + 1];   // squared error per shift, a parabola on a ramp
+			size_t best = 0;
+			for (size_t k = 0; k <= MAX_LEAD + MAX_LAG; ++k){
+				long s = long(k) - long(MAX_LEAD);
+				sq[k] = 0;
+				for (size_t i : ramp){
+					double d = int32_t(f[i]) - r.ref[i - s];
+					sq[k] += d * d;
+				}
+				if (sq[k] < sq[best]) best = k;
+			}
+			double between = 0;   // vertex of the parabola through the best shift and its neighbours
+			if (best > 0 && best < MAX_LEAD + MAX_LAG){
+				double curve = sq[best - 1] - 2 * sq[best] + sq[best + 1];
+				if (curve > 0) between = (sq[best - 1] - sq[best + 1]) / (2 * curve);
+			}
+			m.lag_ms = (long(best) - long(MAX_LEAD) + between) * period_ms;
+		}
+
+		for (size_t i = 1; i + STEADY < n; ++i){
+			if (std::abs(r.ref[i] - r.ref[i - 1]) <= T || !steady(r.ref, i, i + STEADY, T / 2)) continue;
+			m.steps++;
+			size_t good = 0, j = i;
+			for (; j < n && j < i + SETTLE_LIMIT && good < STEADY; ++j){
+				good = std::abs(int32_t(f[j]) - r.ref[j]) <= T / 2 ? good + 1 : 0;
+			}
+			if (good < STEADY){
+				m.unsettled++;
+				continue;
+			}
+			double ms = 1e3 * (r.time[j - STEADY] - r.time[i]);
+			m.settle_mean_ms += ms;
+			m.settle_max_ms = std::max(m.settle_max_ms, ms);
+		}
+		if (m.steps > m.unsettled) m.settle_mean_ms /= m.steps - m.unsettled;
+
+		double sq = 0;
+		size_t count = 0;
+		size_t settled = 0;   // readouts within T/2 of the reference in a row
+		for (size_t i = 0; i < n; ++i){
+			settled = std::abs(int32_t(f[i]) - r.ref[i]) <= T / 2 ? settled + 1 : 0;
+			if (settled <= STEADY || !steady(r.ref, i - STEADY, i + 1, T / 4)) continue;
+			double d = int32_t(f[i]) - int32_t(f[i - 1]);
+			sq += d * d;
+			count++;
+		}
+		m.jitter = count ? TICK_US * std::sqrt(sq / count) : 0;
+
+		for (size_t i = 1; i < n; ++i){
+			if (std::abs(int32_t(r.echo[i]) - r.ref[i]) <= T) continue;
+			m.outliers++;
+			if (std::abs(int32_t(f[i]) - int32_t(f[i - 1])) <= T / 2) m.rejected++;
+		}
+		return m;
+	}
+
+	template <typename Smoothing>
+	Metrics replay(const Readouts& r){
+		Smoothing smoothing;
+		std::vector<uint16_t> f(r.echo.size());
+		auto a = Clock::now();
+		for (size_t i = 0; i < r.echo.size(); ++i){
+			if (r.gap[i]) smoothing.hold();
+			f[i] = smoothing.input(r.echo[i]);
+		}
+		auto b = Clock::now();
+		Metrics m = evaluate(r, f);
+		m.msps = r.echo.size() / std::chrono::duration<double, std::micro>(b - a).count();
+		return m;
+	}
+
+	void print(const char* name, const Metrics& m){
+		if (std::isnan(m.lag_ms)) std::printf("  %-18s %7s", name, "n/a");
+		else                      std::printf("  %-18s %7.1f", name, m.lag_ms);
+		std::printf(" %8.1f %8.1f %5zu/%-4zu %8.1f %7.1f%% %9.1f\n", m.settle_mean_ms, m.settle_max_ms,
+			m.steps - m.unsettled, m.steps, m.jitter, m.outliers ? 100.0 * m.rejected / m.outliers : 0.0, m.msps);
+	}
+
+	template <uint8_t alpha_shift, uint8_t beta_shift, uint8_t lead>
+	void tracker(const Readouts& r){
+		char name[20];
+		std::snprintf(name, sizeof(name), "%u/%u, lead %u", alpha_shift, beta_shift, lead);
+		print(name, replay<Tracker<alpha_shift, beta_shift, lead>>(r));
+	}
+
+}
+
+int main(int argc, char** argv){
+	if (argc != 2){
+		std::fprintf(stderr, "usage: replay TRACE\n");
+		return 2;
+	}
+	int fd = open(argv[1], O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0){
+		std::perror(argv[1]);
+		return 1;
+	}
+	size_t size = st.st_size;
+	void* data = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	if (data == MAP_FAILED){
+		std::fprintf(stderr, "%s: can't map\n", argv[1]);
+		return 1;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	trace::Reader in(static_cast<const uint8_t*>(data), size);
+	if (!in.valid()){
+		std::fprintf(stderr, "%s: not a trace\n", argv[1]);
+		return 1;
+	}
+	Readouts r;
+	auto a = Clock::now();
+	bool complete = decode(in, r);
+	auto b = Clock::now();
+	double us = std::chrono::duration<double, std::micro>(b - a).count();
+	munmap(data, size);
+	close(fd);
+	if (!complete) std::fprintf(stderr, "%s: truncated, replaying what is there\n", argv[1]);
+	if (r.echo.size() <= MAX_LAG + MAX_LEAD){
+		std::fprintf(stderr, "%s: too few readouts\n", argv[1]);
+		return 1;
+	}
+
+	std::printf("%s: %.1f s, %llu pings (%.1f /s), %zu readouts, %llu without echo, reference: %s\n", argv[1], r.seconds,
+		(unsigned long long)r.pings, r.pings / r.seconds, r.echo.size(), (unsigned long long)r.no_echo,
+		in.has_truth() ? "true distance" : "median of 9");
+	std::printf("  decoded %.1f MB/s, %.1f Mrecords/s\n\n", size / us, r.pings / us);
+
+	std::printf("  %-18s %7s %8s %8s %10s %8s %8s %9s\n", "mode", "lag", "settling", "max", "steps", "jitter", "outliers", "Msmpl/s");
+	std::printf("  %-18s %7s %8s %8s %10s %8s %8s %9s\n", "", "ms", "ms", "ms", "settled", "us", "rejected", "");
+	Metrics none = replay<SmoothNone>(r);
+	print("SMOOTH_NONE", none);
+	print("SMOOTH_AVR", replay<SmoothAvr>(r));
+	print("SMOOTH_MOVING_AVR", replay<SmoothMovingAvr>(r));
+	print("SMOOTH_MEDIAN", replay<SmoothMedian>(r));
+	print("SMOOTH_TRACKER", replay<SmoothTracker>(r));
+	print("SMOOTH_CMI", replay<SmoothCmi>(r));
+	std::printf("  (T = %u us, lag over the %zu readouts on ramps, settled within T/2 for %zu readouts, outliers more than T off)\n",
+		CMI_WIDTH_US, none.ramps, STEADY);
+
+	std::printf("\n  tracker: gains as shifts, lead in readouts (TRACKER_LEAD = %u at %u pings/s)\n", TRACKER_LEAD, PING_RATE);
+	tracker<1, 3, 0>(r);
+	tracker<2, 5, 0>(r);
+	tracker<3, 7, 0>(r);
+	tracker<1, 3, TRACKER_LEAD>(r);
+	tracker<2, 5, TRACKER_LEAD>(r);
+	tracker<3, 7, TRACKER_LEAD>(r);
+	return 0;
+}
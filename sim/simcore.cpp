@@ -0,0 +1,384 @@
+#include "simcore.h"
+#include "avr/io.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifndef F_CPU
+#error "F_CPU needs to be defined for the simulator core"
+#endif
+
+
+// the ISRs of the firmware. weak, so vectors without handler stay null
+#define SIM_VECTOR(name) extern "C" void name(void) __attribute__((weak));
+SIM_VECTOR(INT0_vect)
+SIM_VECTOR(PCINT0_vect)
+SIM_VECTOR(TIMER1_COMPA_vect)
+SIM_VECTOR(TIMER1_OVF_vect)
+SIM_VECTOR(TIMER0_OVF_vect)
+SIM_VECTOR(EE_RDY_vect)
+SIM_VECTOR(TIMER1_COMPB_vect)
+SIM_VECTOR(TIMER0_COMPA_vect)
+SIM_VECTOR(TIMER0_COMPB_vect)
+SIM_VECTOR(WDT_vect)
+#undef SIM_VECTOR
+
+// bounds of the EEMEM variables (sim/avr/eeprom.h), made by the linker. weak, there might be none
+extern "C" uint8_t __start_sim_eeprom[] __attribute__((weak));
+extern "C" uint8_t __stop_sim_eeprom[] __attribute__((weak));
+
+
+namespace sim {
+
+	cycles_t now { 0 };
+	cycles_t sleep_cycles { 0 };
+	cycles_t main_cycles { 0 };
+	IsrStats isr_stats[NUM_VECTORS];
+	std::vector<Readout> readouts;
+
+	void advance(uint32_t cycles);
+
+	namespace {
+
+		struct Finished {};
+
+		uint8_t io[64];                 // register file
+		uint8_t ext_levels { 0xFF };    // levels driven from outside (input pins)
+		uint8_t levels { 0 };           // resolved pin levels of port B
+		uint16_t presc0 { 0 };          // shared prescaler counter of Timer0
+		uint16_t div0 { 0 };            // prescale factor of Timer0 or 0 if stopped
+		uint64_t clk1 { 0 };            // Timer1: clock (Hz) accumulated per cycle, ticks at F_CPU * div1
+		uint32_t hz1 { F_CPU };         // clock of Timer1: F_CPU (sync mode) or the PLL (async mode)
+		uint16_t div1 { 0 };            // prescale factor of Timer1 or 0 if stopped
+		uint8_t clkps { 3 };            // system clock prescaler, /8 from the CKDIV8 fuse
+		bool clkps_set { false };       // changed by the firmware
+		cycles_t clkpce_until { 0 };    // CLKPR takes a new prescaler up to then (timed sequence)
+
+		uint8_t isr_depth { 0 };        // > 1 if an ISR enabled interrupts again (nested)
+		uint64_t isr_runs { 0 };        // ISRs served so far, wakes up sleep_cpu()
+		bool asleep { false };          // in sleep_cpu()
+		cycles_t end { NEVER };
+		cycles_t next_device_event { NEVER };
+		cycles_t pending_since[NUM_VECTORS];
+
+		std::vector<Device*> devices;
+
+		enum : uint8_t { A_SREG = 0x3F, A_GIMSK = 0x3B, A_GIFR = 0x3A, A_TIMSK = 0x39, A_TIFR = 0x38,
+		                 A_TCCR0B = 0x33, A_TCNT0 = 0x32, A_TCCR1 = 0x30, A_TCNT1 = 0x2F, A_OCR1A = 0x2E,
+		                 A_OCR1C = 0x2D, A_GTCCR = 0x2C, A_TCCR0A = 0x2A,
+		                 A_OCR0A = 0x29, A_OCR0B = 0x28, A_PLLCSR = 0x27, A_CLKPR = 0x26,
+		                 A_PORTB = 0x18, A_DDRB = 0x17, A_PINB = 0x16, A_PCMSK = 0x15 };
+
+		struct Source { uint8_t vect; uint8_t flag_reg; uint8_t flag; uint8_t mask_reg; uint8_t mask; void (*handler)(); bool noblock; };
+		Source sources[] {   // in priority order
+			{ PCINT0_VECT,       A_GIFR, PCIF,  A_GIMSK, PCIE,   PCINT0_vect, false },
+			{ TIMER1_COMPA_VECT, A_TIFR, OCF1A, A_TIMSK, OCIE1A, TIMER1_COMPA_vect, false },
+			{ TIMER1_OVF_VECT,   A_TIFR, TOV1,  A_TIMSK, TOIE1,  TIMER1_OVF_vect, false },
+			{ TIMER0_OVF_VECT,   A_TIFR, TOV0,  A_TIMSK, TOIE0,  TIMER0_OVF_vect, false },
+			{ TIMER1_COMPB_VECT, A_TIFR, OCF1B, A_TIMSK, OCIE1B, TIMER1_COMPB_vect, false },
+			{ TIMER0_COMPA_VECT, A_TIFR, OCF0A, A_TIMSK, OCIE0A, TIMER0_COMPA_vect, false },
+			{ TIMER0_COMPB_VECT, A_TIFR, OCF0B, A_TIMSK, OCIE0B, TIMER0_COMPB_vect, false },
+		};
+
+		void raise_flag(uint8_t reg, uint8_t bit){
+			uint8_t m = 1<<bit;
+			for (auto& s : sources){
+				if (s.flag_reg == reg && s.flag == bit){
+					if (io[reg] & m){
+						if (io[s.mask_reg] & (1<<s.mask)) ++isr_stats[s.vect].lost;
+					}
+					else pending_since[s.vect] = now;
+				}
+			}
+			io[reg] |= m;
+		}
+
+		void update_levels(){
+			uint8_t l = (io[A_PORTB] & io[A_DDRB]) | (ext_levels & ~io[A_DDRB]);
+			uint8_t changed = l ^ levels;
+			if (!changed) return;
+			levels = l;
+			if (changed & io[A_PCMSK]) raise_flag(A_GIFR, PCIF);
+			for (auto d : devices) d->pins_changed(levels, changed);
+			reschedule();
+		}
+
+		void update_timer0_clock(){
+			static const uint16_t prescale[8] { 0, 1, 8, 64, 256, 1024, 0, 0 };   // 6, 7: external clock on T0, not modelled
+			div0 = prescale[io[A_TCCR0B] & 0x07];
+		}
+
+		void timer0_tick(){
+			uint8_t& tcnt = io[A_TCNT0];
+			bool ctc = io[A_TCCR0A] & (1<<WGM01);
+			if (ctc && tcnt == io[A_OCR0A]){
+				tcnt = 0;
+			} else if (++tcnt == 0 && !ctc){
+				raise_flag(A_TIFR, TOV0);
+			}
+			if (tcnt == io[A_OCR0A]) raise_flag(A_TIFR, OCF0A);
+			if (tcnt == io[A_OCR0B]) raise_flag(A_TIFR, OCF0B);
+		}
+
+		void update_timer1_clock(){
+			uint8_t cs = io[A_TCCR1] & 0x0F;
+			div1 = cs ? 1 << (cs - 1) : 0;
+			uint8_t pll = io[A_PLLCSR];
+			hz1 = (pll & (1<<PCKE)) && (pll & (1<<PLOCK)) ? ((pll & (1<<LSM)) ? 32000000 : 64000000) : F_CPU;
+		}
+
+			/* PWM1A or CTC1: counts up to OCR1C, otherwise to 0xFF. TOV1 at the
+			   end of each round, OCF1A at OCR1A. the outputs aren't modelled */
+		void timer1_tick(){
+			uint8_t& tcnt = io[A_TCNT1];
+			bool top = io[A_TCCR1] & (1<<CTC1 | 1<<PWM1A);
+			if (top && tcnt == io[A_OCR1C]){
+				tcnt = 0;
+				if (io[A_TCCR1] & (1<<PWM1A)) raise_flag(A_TIFR, TOV1);
+			} else if (++tcnt == 0){
+				raise_flag(A_TIFR, TOV1);
+			}
+			if (tcnt == io[A_OCR1A]) raise_flag(A_TIFR, OCF1A);
+		}
+
+		void run_devices(){
+			next_device_event = NEVER;
+			for (auto d : devices){
+				if (d->next_event <= now) d->event();
+				if (d->next_event < next_device_event) next_device_event = d->next_event;
+			}
+		}
+
+		void step();
+
+			/* the vectors defined with ISR_NOBLOCK (sim_isr_attributes()), by name */
+		std::vector<std::string>& noblock_vectors(){
+			static std::vector<std::string> names;
+			return names;
+		}
+
+		void run_isr(Source& s){
+			if (!s.handler) throw std::runtime_error(std::string("interrupt without handler: ") + vector_name(s.vect));
+			io[s.flag_reg] &= ~(1<<s.flag);     // hardware clears the flag when the vector is executed
+			io[A_SREG] &= ~(1<<SREG_I);
+			++isr_depth;
+			cycles_t start = now;
+			IsrStats& st = isr_stats[s.vect];
+			uint32_t latency = start - pending_since[s.vect];
+			if (latency > st.max_latency) st.max_latency = latency;
+
+			if (s.noblock){   // sei in front of the prologue, the rest of it can be interrupted
+				for (uint16_t i = 0; i < avrcost::ISR_RESPONSE; ++i) step();
+				io[A_SREG] |= (1<<SREG_I);
+				advance(avrcost::ISR_ENTRY - avrcost::ISR_RESPONSE);
+			} else {
+				for (uint16_t i = 0; i < avrcost::ISR_ENTRY; ++i) step();
+			}
+			s.handler();
+			if (io[A_SREG] & (1<<SREG_I)){   // the handler left interrupts on, so is the epilogue
+				advance(avrcost::ISR_EXIT);
+			} else {
+				for (uint16_t i = 0; i < avrcost::ISR_EXIT; ++i) step();
+			}
+
+			uint32_t c = now - start;
+			++st.calls;
+			st.cycles += c;
+			if (c < st.min) st.min = c;
+			if (c > st.max) st.max = c;
+			io[A_SREG] |= (1<<SREG_I);
+			--isr_depth;
+			++isr_runs;
+		}
+
+		void dispatch(){
+			if (!(io[A_SREG] & (1<<SREG_I))) return;   // cleared in ISRs unless they sei()
+			for (auto& s : sources){
+				if ((io[s.flag_reg] & (1<<s.flag)) && (io[s.mask_reg] & (1<<s.mask))){
+					run_isr(s);
+					return;   // after reti at least one more instruction of the main program is executed
+				}
+			}
+		}
+
+		/* advance the simulated time by one cycle */
+		void step(){
+			++now;
+			if (!isr_depth && !asleep) ++main_cycles;
+			++presc0;
+			if (div0 && (presc0 % div0) == 0) timer0_tick();
+			if (div1){
+				clk1 += hz1;
+				while (clk1 >= uint64_t(F_CPU) * div1){
+					clk1 -= uint64_t(F_CPU) * div1;
+					timer1_tick();
+				}
+			}
+			if (now >= next_device_event) run_devices();
+			if (now >= end) throw Finished();
+		}
+
+	}
+
+
+	double seconds(cycles_t c){ return double(c) / F_CPU; }
+	cycles_t cycles_us(double us){ return cycles_t(us * (F_CPU / 1e6) + 0.5); }
+
+	const char* vector_name(uint8_t v){
+		static const char* names[NUM_VECTORS] { "RESET", "INT0", "PCINT0", "TIMER1_COMPA", "TIMER1_OVF", "TIMER0_OVF",
+			"EE_RDY", "ANA_COMP", "ADC", "TIMER1_COMPB", "TIMER0_COMPA", "TIMER0_COMPB", "WDT", "USI_START", "USI_OVF" };
+		return v < NUM_VECTORS ? names[v] : "?";
+	}
+
+	bool in_isr(){ return isr_depth; }
+	uint16_t timer0_prescale(){ return div0; }
+	uint16_t clock_prescale(){ return 1 << clkps; }
+	bool clock_prescale_set(){ return clkps_set; }
+
+	void attach(Device* d){
+		devices.push_back(d);
+		reschedule();
+	}
+
+	void reschedule(){
+		next_device_event = NEVER;
+		for (auto d : devices) if (d->next_event < next_device_event) next_device_event = d->next_event;
+	}
+
+	void drive_pin(uint8_t bit, bool level){
+		if (level) ext_levels |= 1<<bit;
+		else       ext_levels &= ~(1<<bit);
+		update_levels();
+	}
+
+	uint8_t pin_levels(){ return levels; }
+
+	uint8_t* eeprom(){ return __start_sim_eeprom; }
+	size_t eeprom_size(){ return __start_sim_eeprom ? __stop_sim_eeprom - __start_sim_eeprom : 0; }
+
+	void advance(uint32_t cycles){
+		while (cycles--){
+			step();
+			dispatch();
+		}
+	}
+
+	void run(cycles_t end_time, void (*fn)()){
+		end = end_time;
+		for (auto& s : sources){
+			for (auto& name : noblock_vectors()) s.noblock |= name == std::string(vector_name(s.vect)) + "_vect";
+		}
+		update_levels();
+		try {
+			fn();
+		} catch (Finished&) {}
+	}
+
+}
+
+
+/* interface for the replacement headers */
+
+uint8_t sim_io_read(uint8_t addr){
+	using namespace sim;
+	advance(1);
+	if (addr == A_PINB) return levels;
+	return io[addr & 0x3F];
+}
+
+namespace sim {
+	namespace {
+
+			/* the effect of writing value to the register, without the time */
+		void write_io(uint8_t addr, uint8_t value){
+			switch (addr){
+				case A_TIFR:
+				case A_GIFR:
+					io[addr] &= ~value;   // writing a one clears the flag
+					break;
+				case A_PINB:
+					io[A_PORTB] ^= value; // writing a one toggles PORTB
+					update_levels();
+					break;
+				case A_PORTB:
+				case A_DDRB:
+				case A_PCMSK:
+					io[addr] = value;
+					update_levels();
+					break;
+				case A_TCCR0B:
+					io[addr] = value;
+					update_timer0_clock();
+					break;
+				case A_GTCCR:
+					if (value & (1<<PSR0)) presc0 = 0;
+					io[addr] = (value & (1<<TSM)) ? value : value & ~(1<<PSR0 | 1<<PSR1);
+					break;
+				case A_PLLCSR:
+					io[addr] = (value & (1<<PLLE)) ? (value | 1<<PLOCK) : (value & ~(1<<PLOCK));
+					update_timer1_clock();
+					break;
+				case A_TCCR1:
+					io[addr] = value;
+					update_timer1_clock();
+					break;
+				case A_CLKPR:   // the prescaler only 4 cycles after CLKPCE alone, the time base stays F_CPU
+					if (value == 1<<CLKPCE){
+						clkpce_until = now + 4;
+					} else if (now <= clkpce_until && !(value & 1<<CLKPCE)){
+						clkps = value & 0x0F;
+						clkps_set = true;
+						clkpce_until = 0;
+					}
+					io[addr] = clkps;
+					break;
+				default:
+					io[addr] = value;
+			}
+			for (auto d : devices) d->io_written(addr, io[addr]);
+			reschedule();
+			dispatch();
+		}
+
+	}
+}
+
+void sim_io_write(uint8_t addr, uint8_t value){
+	sim::advance(1);
+	sim::write_io(addr & 0x3F, value);
+}
+
+void sim_io_bit(uint8_t addr, uint8_t mask, bool set){
+	using namespace sim;
+	advance(2);
+	addr &= 0x3F;
+	if (addr == A_PINB){   // sbi toggles that pin only
+		if (set) write_io(addr, mask);
+		return;
+	}
+	write_io(addr, set ? io[addr] | mask : io[addr] & ~mask);
+}
+
+bool sim_isr_attributes(const char* vector, const char* attributes){
+	if (std::strstr(attributes, "ISR_NOBLOCK")) sim::noblock_vectors().push_back(vector);
+	return true;
+}
+
+void sim_charge(uint32_t cycles){ sim::advance(cycles); }
+
+void sim_readout(uint8_t sensor, uint16_t ticks){ sim::readouts.push_back({ sim::now, sensor, ticks }); }
+
+void sim_delay_cycles(uint32_t cycles){ sim::advance(cycles); }
+
+void sim_sleep(){
+	using namespace sim;
+	if (!(io[A_SREG] & (1<<SREG_I))) throw std::runtime_error("sleep with interrupts disabled never wakes up");
+	uint64_t runs = isr_runs;
+	asleep = true;
+	while (isr_runs == runs){
+		advance(1);
+		++sleep_cycles;
+	}
+	asleep = false;
+}
@@ -0,0 +1,100 @@
+/* discrete-event simulator core for the ATtiny25/45/85
+*
+* The firmware is compiled natively against the headers in this directory.
+* All its register accesses, delays and SIM_CHARGE(...) annotations end up in
+* this core, which advances a global cycle counter. While time advances the
+* core
+*   - runs Timer/Counter0 (prescaler, overflow, compare A/B, CTC mode),
+*   - runs Timer/Counter1 from F_CPU or the PLL (overflow, compare A, OCR1C
+*     as top), but not its outputs,
+*   - resolves the pin levels of port B and raises pin change flags,
+*   - calls the attached devices (sensor model, monitors) at their events,
+*   - dispatches pending interrupts in hardware priority order to the ISRs
+*     of the firmware (only with the I bit set, so ISRs can be nested by sei()
+*     or ISR_NOBLOCK, an epilogue with the I bit set can be interrupted too).
+* Every ISR invocation is timed from interrupt response to reti, including the
+* ISRs nested into it.
+*/
+
+#ifndef __sim_simcore_h__
+#define __sim_simcore_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace sim {
+
+	using cycles_t = uint64_t;
+	constexpr cycles_t NEVER { ~cycles_t(0) };
+
+	extern cycles_t now;            // current simulated time in CPU cycles
+	extern cycles_t sleep_cycles;   // cycles the firmware spent in sleep_cpu()
+	extern cycles_t main_cycles;    // cycles of the main program itself: neither asleep nor in an ISR
+	uint16_t timer0_prescale();     // current prescale factor of Timer0, 0 if stopped
+	uint16_t clock_prescale();      // system clock prescaler (CLKPR), /8 after reset (CKDIV8 fuse)
+	bool clock_prescale_set();      // the firmware changed it with the timed sequence
+	double seconds(cycles_t c);     // convert cycles to seconds (F_CPU of this build)
+	cycles_t cycles_us(double us);  // convert microseconds to cycles
+
+	/* interrupt vectors of the ATtiny25/45/85, the number is the priority (lower wins) */
+	enum Vector : uint8_t {
+		INT0_VECT = 1, PCINT0_VECT, TIMER1_COMPA_VECT, TIMER1_OVF_VECT, TIMER0_OVF_VECT,
+		EE_RDY_VECT, ANA_COMP_VECT, ADC_VECT, TIMER1_COMPB_VECT, TIMER0_COMPA_VECT,
+		TIMER0_COMPB_VECT, WDT_VECT, USI_START_VECT, USI_OVF_VECT, NUM_VECTORS
+	};
+	const char* vector_name(uint8_t v);
+
+	struct IsrStats {
+		uint64_t calls  {0};
+		uint64_t cycles {0};        // sum of cycles spent from interrupt response to reti
+		uint32_t min    {~0u};
+		uint32_t max    {0};
+		uint32_t max_latency {0};   // cycles between raising the flag and entering the ISR
+		uint64_t lost   {0};        // flag raised again while still pending -> event lost
+	};
+	extern IsrStats isr_stats[NUM_VECTORS];
+
+	/* echo measured by the firmware (SIM_READOUT in main.cpp) */
+	struct Readout {
+		cycles_t time;
+		uint8_t sensor;             // index of the sensor (SENSORS in main.cpp)
+		uint16_t ticks;             // Timer0 ticks
+	};
+	extern std::vector<Readout> readouts;
+
+	/* something attached to the pins or the register file of the MCU */
+	class Device {
+	public:
+		virtual ~Device() {}
+			/* called when the level of at least one pin of port B changed */
+		virtual void pins_changed(uint8_t /*levels*/, uint8_t /*changed*/) {}
+			/* called after the firmware wrote to an I/O register */
+		virtual void io_written(uint8_t /*addr*/, uint8_t /*value*/) {}
+			/* called once now >= next_event */
+		virtual void event() {}
+
+		cycles_t next_event { NEVER };
+	};
+
+	void attach(Device* d);
+	void reschedule();                     // call after changing next_event of a device outside of event()
+
+	/* external drive of an input pin of port B */
+	void drive_pin(uint8_t bit, bool level);
+	uint8_t pin_levels();                  // current levels of all port B pins
+
+	/* the EEMEM variables of the firmware (sim/avr/eeprom.h) as image of the EEPROM,
+	   eeprom_size() is 0 if there are none. zero when the simulation starts, like the
+	   .eep file avr-objcopy makes */
+	uint8_t* eeprom();
+	size_t eeprom_size();
+
+	/* run fn (the firmware main) until the simulated time reaches end */
+	void run(cycles_t end, void (*fn)());
+
+	bool in_isr();
+
+}
+
+#endif
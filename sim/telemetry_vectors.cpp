@@ -0,0 +1,111 @@
+/* the test vectors of showdata.py from the encoders of the firmware
+*
+*   sim/telemetry_vectors > FILE; showdata.py --selftest --vectors FILE
+*
+* sends the values of TEST_VECTORS in showdata.py in their order (the sequence
+* numbers count on) through telemetry::Encoder, TraceEncoder, status(), values()
+* (myserial.h) and the answers of params::Console (params.h), with the blocking
+* send_byte() on the simulated pin. prints the bytes the UartMonitor receives,
+* one frame per line in hex. make simcheck runs it, the decoder is tested against
+* the frames the firmware really sends
+*/
+
+#include "simcore.h"
+#include "devices.h"
+#include "avr/io.h"
+#include "avr/eeprom.h"
+#include "avr/pgmspace.h"
+
+#ifndef BAUDRATE
+#define BAUDRATE 9600
+#endif
+#include "../myserial.h"
+#include "../params.h"
+
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+	constexpr uint8_t TXD { 4 };   // the default pin of myserial.h
+
+	constexpr params::Info info[] PROGMEM { { 400, 2, 1000 } };   // parameter 0, as in the vectors
+	bool consistent(const uint16_t*){ return true; }
+	using Store = params::Store<1, 1, info, consistent>;
+	Store store;
+	Store::Block block EEMEM;   // never written: the initial values
+
+	std::vector<sim::cycles_t> ends;   // the time after each frame
+
+		/* a command like showdata.py --param sends it, into the console */
+	void command(params::Console& console, uint8_t op, uint8_t index){
+		uint8_t c = 0;
+		for (uint8_t b : { op, index, uint8_t(0), uint8_t(0) }){
+			console.input(b);
+			c = telemetry::crc8_update(c, b);
+		}
+		if (console.input(c)) console.execute(store, &block, 1);
+		ends.push_back(sim::now);
+	}
+
+	void sender(){
+		telemetry::Encoder<4> samples;
+		samples.sample(1000, 990, 0);
+		samples.sample(1010, 992, 0);
+		samples.sample(1003, 993, 2);
+		samples.sample(1005, 993, 2);
+		ends.push_back(sim::now);
+		telemetry::Encoder<3> jumps;
+		jumps.sample(100, 100, telemetry::NO_CHANNEL);
+		jumps.sample(2800, 110, telemetry::NO_CHANNEL);
+		jumps.sample(20, 2700, 0);
+		ends.push_back(sim::now);
+		telemetry::TraceEncoder<4> trace;
+		trace.record(7300, 1500);
+		trace.record(0, 1510);
+		trace.record(7290, 0);
+		trace.record(65000, 2815);
+		ends.push_back(sim::now);
+		const uint16_t old_status[] { 64, 5200, 3, 0 };
+		telemetry::status(old_status, 4);
+		ends.push_back(sim::now);
+		const uint16_t status[] { 64, 625, 0, 0, 0, 0, 125 };
+		telemetry::status(status, 7);
+		ends.push_back(sim::now);
+		const uint16_t profile[] { 3, 255, 40, 52, 300, 0 };   // what profile.h reports
+		telemetry::values(telemetry::TYPE_PROFILE, profile, 6);
+		ends.push_back(sim::now);
+		const uint16_t histogram[] { 3, 0, 0, 0, 0, 2, 120, 3, 1 };
+		telemetry::values(telemetry::TYPE_HISTOGRAM, histogram, 9);
+		ends.push_back(sim::now);
+		store.load(&block);
+		params::Console console;
+		command(console, 'g', 0);
+		command(console, 'g', 99);   // no such parameter
+		command(console, 'c', 0);
+	}
+
+}
+
+int main(){
+	sim::run(sim::NEVER, init_send);   // not the edges of the pin becoming an output
+	sim::UartMonitor monitor(TXD, BAUDRATE, PARITY);
+	sim::attach(&monitor);
+	sim::run(sim::NEVER, sender);
+	size_t frame = 0;
+	const char* separator = "";
+	for (const auto& b : monitor.bytes()){
+		if (b.framing_error){
+			std::fprintf(stderr, "framing error\n");
+			return 1;
+		}
+		for (; frame < ends.size() && b.time >= ends[frame]; ++frame){
+			std::printf("\n");
+			separator = "";
+		}
+		std::printf("%s%02x", separator, b.value);
+		separator = " ";
+	}
+	std::printf("\n");
+	return 0;
+}
@@ -0,0 +1,337 @@
+/* host simulation of the theremin firmware
+*
+* runs main.cpp (compiled natively with the replacement headers in sim/) against
+* a synthetic HC-SR04 and reports the cost of every ISR, the measurement rate of
+* the trigger loop, the error of the readouts against the echoes of the sensor
+* and the tone register values (or the pitch of the samples with SYNTH_DDS).
+* built with SENSORS=2 a second module measures another hand for the volume,
+* the rate and the errors are reported per sensor.
+* built with PARAMETERS the firmware receives commands on NEGOUT (see params.h),
+* with PROFILING the request for the profile,
+* --send plays them in like a serial adapter (showdata.py --encode makes them),
+* the answers are in the output of --uart.
+*
+* usage: theremin_sim [options]
+*   --seconds S      simulated time (default 2)
+*   --profile P      hand movement: sweep, glissando, steps, hold, ramps (default sweep)
+*   --away           remove the hand for 0.4s every 3s
+*   --noise US       gaussian noise of the echo length in us (default 15)
+*   --spikes R       probability of a multipath spike per ping (default 0.03)
+*   --seed N         seed of the noise generator (default 1)
+*   --volume P       hand movement over the volume sensor (SENSORS=2, default steps)
+*   --crosstalk R    probability that a burst reaches the other module (SENSORS=2, default 0.3)
+*   --tones FILE     write all tone register updates (SYNTH_DDS: periods of the samples) as csv
+*   --uart FILE      write the bytes sent via the software UART
+*   --trace FILE     write the echoes of the sensor as trace for sim/replay (see trace.h)
+*   --send S HEX     send these bytes (hex digits) to the firmware at S seconds (PARAMETERS, PROFILING)
+*   --eeprom FILE    load the EEPROM from FILE if it exists, save it there at the end
+*   --check          exit with 1 on framing errors of the serial output or an edge more
+*                    than MAXBITERROR off (make simcheck)
+*/
+
+#include "simcore.h"
+#include "devices.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+int firmware_main();   // main() of main.cpp, renamed at compile time
+
+namespace {
+
+	// wiring, see schema.txt
+	constexpr uint8_t TRIGGER_BIT { 2 };
+	constexpr uint8_t ECHO_BIT    { 3 };
+	constexpr uint8_t TXD_BIT     { 4 };
+	constexpr uint8_t TRIGGER2_BIT { 0 };   // SENSORS 2: NEGOUT
+	constexpr uint8_t ECHO2_BIT    { 4 };   // and TxD
+	constexpr uint8_t RXD_BIT      { 0 };   // PARAMETERS, PROFILING: NEGOUT
+
+	#ifndef SENSORS   // like the default of main.cpp, the same -D flags reach the firmware
+	#define SENSORS 1
+	#endif
+
+	// serial settings of myserial.h (MAXBITERROR of main.cpp), the same -D flags reach the firmware
+	#ifndef PARITY
+	#define PARITY 0
+	#endif
+	#ifndef BAUDRATE
+	#define BAUDRATE 9600
+	#endif
+	#ifndef MAXBITERROR
+	#define MAXBITERROR 30
+	#endif
+
+	const char* smoothing(){
+	#if defined(SMOOTH_CMI)
+		return "SMOOTH_CMI";
+	#elif defined(SMOOTH_AVR)
+		return "SMOOTH_AVR";
+	#elif defined(SMOOTH_MOVING_AVR)
+		return "SMOOTH_MOVING_AVR";
+	#elif defined(SMOOTH_MEDIAN)
+		return "SMOOTH_MEDIAN";
+	#elif defined(SMOOTH_TRACKER)
+		return "SMOOTH_TRACKER";
+	#elif defined(SMOOTH_NONE)
+		return "SMOOTH_NONE";
+	#else
+		return "default of main.cpp";
+	#endif
+	}
+
+	void run_firmware(){ firmware_main(); }
+
+	bool hex_bytes(const char* hex, std::vector<uint8_t>& bytes){
+		std::string digits;
+		for (const char* c = hex; *c; ++c){
+			if (std::isxdigit(static_cast<unsigned char>(*c))) digits += *c;
+			else if (*c != ' ' && *c != ':') return false;
+		}
+		if (digits.size() % 2) return false;
+		for (size_t i = 0; i < digits.size(); i += 2) bytes.push_back(std::stoul(digits.substr(i, 2), nullptr, 16));
+		return true;
+	}
+
+	void usage(){
+		std::fprintf(stderr, "usage: theremin_sim [--seconds S] [--profile sweep|glissando|steps|hold|ramps] [--away]\n"
+		                     "                    [--noise US] [--spikes R] [--seed N] [--tones FILE] [--uart FILE]\n"
+		                     "                    [--trace FILE] [--volume PROFILE] [--crosstalk R] [--send S HEX]...\n"
+		                     "                    [--eeprom FILE] [--check]\n");
+		std::exit(2);
+	}
+
+}
+
+int main(int argc, char** argv){
+	double duration = 2;
+	std::string profile = "sweep";
+	bool away = false;
+	double noise_us = 15, spike_rate = 0.03;
+	uint64_t seed = 1;
+	std::string volume_profile = "steps";
+	double crosstalk = 0.3;
+	const char* tone_file = nullptr;
+	const char* uart_file = nullptr;
+	const char* trace_file = nullptr;
+	const char* eeprom_file = nullptr;
+	bool check = false;
+	struct Send { double at; std::vector<uint8_t> bytes; };
+	std::vector<Send> sends;
+
+	for (int i = 1; i < argc; ++i){
+		std::string a = argv[i];
+		auto value = [&]() -> const char* { if (i + 1 >= argc) usage(); return argv[++i]; };
+		if      (a == "--seconds") duration = std::atof(value());
+		else if (a == "--profile") profile = value();
+		else if (a == "--away")    away = true;
+		else if (a == "--noise")   noise_us = std::atof(value());
+		else if (a == "--spikes")  spike_rate = std::atof(value());
+		else if (a == "--seed")    seed = std::strtoull(value(), nullptr, 0);
+		else if (a == "--tones")   tone_file = value();
+		else if (a == "--uart")    uart_file = value();
+		else if (a == "--trace")   trace_file = value();
+		else if (a == "--volume")  volume_profile = value();
+		else if (a == "--crosstalk") crosstalk = std::atof(value());
+		else if (a == "--send"){
+			Send x { std::atof(value()), {} };
+			if (!hex_bytes(value(), x.bytes)) usage();
+			sends.push_back(x);
+		}
+		else if (a == "--eeprom")  eeprom_file = value();
+		else if (a == "--check")   check = true;
+		else usage();
+	}
+
+	sim::Hand hand(profile, away, seed);
+	if (!hand.valid()) usage();
+	sim::Rng rng(seed);
+	sim::Hcsr04 sensor(TRIGGER_BIT, ECHO_BIT, hand, rng, noise_us, spike_rate);
+	sim::UartMonitor uart(TXD_BIT, BAUDRATE, PARITY);
+	sim::ToneMonitor tone;
+	sim::attach(&sensor);
+	sim::attach(&tone);
+	sim::Hand volume_hand(volume_profile, away, seed + 1);
+	if (!volume_hand.valid()) usage();
+	std::unique_ptr<sim::Hcsr04> volume;
+	std::vector<sim::Hcsr04*> sensors { &sensor };
+	if (SENSORS > 1){   // its ECHO is the TxD pin
+		volume.reset(new sim::Hcsr04(TRIGGER2_BIT, ECHO2_BIT, volume_hand, rng, noise_us, spike_rate));
+		sensors.push_back(volume.get());
+		sim::attach(volume.get());
+		sensor.couple(*volume, crosstalk);
+		volume->couple(sensor, crosstalk);
+	} else {
+		sim::attach(&uart);
+	}
+	sim::UartSender commands(RXD_BIT, BAUDRATE, PARITY);
+	if (!sends.empty()){
+		#if !defined(PARAMETERS) && !defined(PROFILING)
+		std::fprintf(stderr, "--send: the firmware receives only with PARAMETERS or PROFILING\n");
+		return 2;
+		#endif
+		sim::attach(&commands);
+		for (auto& x : sends) commands.send(sim::cycles_us(x.at * 1e6), x.bytes);
+	}
+	if (eeprom_file && sim::eeprom_size()){
+		FILE* f = std::fopen(eeprom_file, "rb");
+		if (f){
+			size_t n = std::fread(sim::eeprom(), 1, sim::eeprom_size(), f);
+			std::fclose(f);
+			std::printf("EEPROM: %zu bytes from %s\n", n, eeprom_file);
+		}
+	}
+
+	sim::run(sim::cycles_us(duration * 1e6), run_firmware);
+
+	double t = sim::seconds(sim::now);
+	std::printf("simulated %.3f s (%llu cycles) at F_CPU=%lu, %s%s, profile %s%s\n",
+		t, (unsigned long long)sim::now, (unsigned long)F_CPU, smoothing(), tone.dac() ? ", SYNTH_DDS" : "", profile.c_str(),
+		away ? " with away phases" : "");
+	if (sim::clock_prescale_set()) std::printf("system clock prescaler /%u, set by the firmware (CLKPR)\n", sim::clock_prescale());
+
+	// readout - echo length. the mean is the difference of the latencies at both edges,
+	// the jitter comes from varying latencies and the resolution of Timer0
+	const uint16_t prescale = sim::timer0_prescale();
+	struct Errors { size_t readouts, crosstalk; double mean, jitter, worst; };
+	std::vector<Errors> errors_of;
+	for (size_t i = 0; i < sensors.size(); ++i){
+		const auto& echoes = sensors[i]->echoes();
+		std::vector<double> errors;   // us
+		size_t e = 0, crosstalk = 0;
+		for (auto& r : sim::readouts){   // a readout belongs to the last trigger of its sensor before it
+			if (r.sensor != i) continue;
+			while (e + 1 < echoes.size() && echoes[e + 1].trigger < r.time) ++e;
+			errors.push_back((double(r.ticks) * prescale - double(sim::cycles_us(echoes[e].echo_us))) * 1e6 / F_CPU);
+			crosstalk += echoes[e].crosstalk;
+		}
+		double mean = 0, jitter = 0, worst = 0;
+		for (double x : errors) mean += x / errors.size();
+		for (double x : errors){
+			jitter += (x - mean) * (x - mean) / errors.size();
+			worst = std::max(worst, std::abs(x - mean));
+		}
+		errors_of.push_back({ errors.size(), crosstalk, mean, std::sqrt(jitter), worst });
+	}
+
+	std::printf("\nmeasurement loop\n");
+	uint64_t pings = 0, ignored = 0;
+	for (auto s : sensors){
+		pings += s->pings();
+		ignored += s->ignored_triggers();
+	}
+	std::printf("  pings             %8llu  %8.1f /s\n", (unsigned long long)pings, pings / t);
+	if (sensors.size() > 1){
+		for (size_t i = 0; i < sensors.size(); ++i){
+			std::printf("    sensor %zu        %8llu  %8.1f /s  (%llu ended by cross talk, %zu of them read out)\n", i,
+				(unsigned long long)sensors[i]->pings(), sensors[i]->pings() / t, (unsigned long long)sensors[i]->crosstalk(),
+				errors_of[i].crosstalk);
+		}
+	}
+	std::printf("  ignored triggers  %8llu\n", (unsigned long long)ignored);
+	std::printf("  tone updates      %8zu  %8.1f /s\n", tone.tones().size(), tone.tones().size() / t);
+	size_t framing_errors = 0;
+	for (auto& b : uart.bytes()) framing_errors += b.framing_error;
+	std::printf("  uart bytes        %8zu  %8.1f /s  (%zu framing errors)\n", uart.bytes().size(), uart.bytes().size() / t, framing_errors);
+	std::printf("  uart edges off    %8.1f %% of a bit at most\n", 100 * uart.max_edge_error());
+	if (commands.bytes()) std::printf("  uart bytes in     %8zu\n", commands.bytes());
+	std::printf("  main loop asleep  %8.1f %%\n", 100.0 * sim::sleep_cycles / sim::now);
+	std::printf("  main loop busy    %8.1f %%  (without the ISRs)\n", 100.0 * sim::main_cycles / sim::now);
+
+	std::printf("\necho timing, Timer0 /%u (%.1f us per tick)\n", prescale, prescale * 1e6 / F_CPU);
+	for (size_t i = 0; i < sensors.size(); ++i){
+		const Errors& x = errors_of[i];
+		if (sensors.size() > 1) std::printf("  sensor %zu\n", i);
+		std::printf("  readouts          %8zu  error: mean %.1f us, jitter %.1f us rms, %.1f us max\n", x.readouts, x.mean, x.jitter, x.worst);
+	}
+	std::printf("  overflow ISRs     %8llu  %8.1f /s\n", (unsigned long long)sim::isr_stats[sim::TIMER0_OVF_VECT].calls,
+		sim::isr_stats[sim::TIMER0_OVF_VECT].calls / t);
+
+	std::printf("\ninterrupts                calls      min     mean      max   cpu%%  max-latency  lost\n");
+	for (uint8_t v = 1; v < sim::NUM_VECTORS; ++v){
+		const sim::IsrStats& s = sim::isr_stats[v];
+		if (!s.calls && !s.lost) continue;
+		std::printf("  %-20s %8llu %8u %8.1f %8u %6.2f %12u %5llu\n", sim::vector_name(v),
+			(unsigned long long)s.calls, s.calls ? s.min : 0, s.calls ? double(s.cycles) / s.calls : 0.0, s.max,
+			100.0 * s.cycles / sim::now, s.max_latency, (unsigned long long)s.lost);
+	}
+
+	if (tone.dac()){
+		double fmin = 1e12, fmax = 0;
+		for (auto& p : tone.periods()){
+			fmin = std::min(fmin, p.hz);
+			fmax = std::max(fmax, p.hz);
+		}
+		std::printf("\ndds   %.1f samples/s", tone.samples() / t);
+		if (!tone.periods().empty())
+			std::printf(", pitch %.1f .. %.1f Hz, last %.1f Hz", fmin, fmax, tone.periods().back().hz);
+		std::printf("\n");
+	} else if (!tone.tones().empty()){
+		double fmin = 1e12, fmax = 0;
+		for (auto& x : tone.tones()){
+			double f = tone.frequency(x);
+			if (f < fmin) fmin = f;
+			if (f > fmax) fmax = f;
+		}
+		auto& last = tone.tones().back();
+		std::printf("\ntone  %.1f .. %.1f Hz, last TCCR1=0x%02X OCR1C=%u OCR1A=%u (%.1f Hz)\n",
+			fmin, fmax, last.tccr1, last.ocr1c, last.ocr1a, tone.frequency(last));
+	}
+
+	if (tone_file){
+		FILE* f = std::fopen(tone_file, "w");
+		if (!f){ std::perror(tone_file); return 1; }
+		if (tone.dac()){
+			std::fprintf(f, "time_us,freq_hz\n");
+			for (auto& p : tone.periods())
+				std::fprintf(f, "%.1f,%.2f\n", sim::seconds(p.time) * 1e6, p.hz);
+		} else {
+			std::fprintf(f, "time_us,tccr1,ocr1c,ocr1a,freq_hz\n");
+			for (auto& x : tone.tones())
+				std::fprintf(f, "%.1f,%u,%u,%u,%.2f\n", sim::seconds(x.time) * 1e6, x.tccr1, x.ocr1c, x.ocr1a, tone.frequency(x));
+		}
+		std::fclose(f);
+	}
+	if (uart_file){
+		FILE* f = std::fopen(uart_file, "wb");
+		if (!f){ std::perror(uart_file); return 1; }
+		for (auto& b : uart.bytes()) std::fputc(b.value, f);
+		std::fclose(f);
+	}
+	if (eeprom_file && sim::eeprom_size()){
+		FILE* f = std::fopen(eeprom_file, "wb");
+		if (!f){ std::perror(eeprom_file); return 1; }
+		std::fwrite(sim::eeprom(), 1, sim::eeprom_size(), f);
+		std::fclose(f);
+	}
+	if (trace_file){
+		// in ticks of Timer0 like the readouts of main.cpp
+		FILE* f = std::fopen(trace_file, "wb");
+		if (!f){ std::perror(trace_file); return 1; }
+		trace::Writer w(f, F_CPU / prescale, trace::TRACE_TRUTH);
+		sim::cycles_t last = 0;
+		for (auto& e : sensor.echoes()){
+			w.record({ uint32_t((e.trigger - last) / prescale), uint32_t(sim::cycles_us(e.echo_us) / prescale),
+			           uint32_t(sim::cycles_us(e.true_us) / prescale) });
+			last = e.trigger;
+		}
+		std::fclose(f);
+	}
+	if (check && framing_errors){
+		std::printf("\ncheck failed: %zu framing errors\n", framing_errors);
+		return 1;
+	}
+	if (check && 100 * uart.max_edge_error() > MAXBITERROR){
+		std::printf("\ncheck failed: uart edges off by more than %d %% of a bit\n", MAXBITERROR);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,121 @@
+/* trace files of raw echo readouts, replayed by sim/replay
+*
+* header, 12 bytes, numbers little endian:
+*   "THTR" | version (1) | flags | 2 bytes reserved (0) | tick rate in Hz (uint32_t)
+* then one record per ping:
+*   varint(ticks since the previous ping) varint(echo in ticks, 0 if there was none)
+*   with TRACE_TRUTH in flags another varint(echo of the true distance in ticks)
+* varints are the ones of the telemetry (myserial.h): 7 bits per byte, lowest
+* first, the high bit is set if another byte follows.
+*
+* showdata.py --trace FILE writes them from the TYPE_TRACE frames of the
+* firmware (TRACE_OUTPUT in main.cpp), theremin_sim --trace FILE from the
+* simulated sensor, with the true distance.
+*/
+
+#ifndef __sim_trace_h__
+#define __sim_trace_h__
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+
+namespace trace {
+
+	constexpr char MAGIC[4] { 'T', 'H', 'T', 'R' };
+	constexpr uint8_t VERSION { 1 };
+	constexpr uint8_t TRACE_TRUTH { 0x01 };
+	constexpr size_t HEADER_SIZE { 12 };
+
+	struct Record {
+		uint32_t dt;      // ticks since the previous ping
+		uint32_t echo;    // ticks, 0 if there was none
+		uint32_t truth;   // ticks, 0 if unknown
+	};
+
+
+	class Writer {
+	public:
+		Writer(FILE* f, uint32_t tick_rate, uint8_t flags) : _f(f), _flags(flags) {
+			uint8_t h[HEADER_SIZE] { 'T', 'H', 'T', 'R', VERSION, flags, 0, 0,
+				uint8_t(tick_rate), uint8_t(tick_rate >> 8), uint8_t(tick_rate >> 16), uint8_t(tick_rate >> 24) };
+			std::fwrite(h, 1, sizeof(h), _f);
+		}
+
+		void record(const Record& r){
+			varint(r.dt);
+			varint(r.echo);
+			if (_flags & TRACE_TRUTH) varint(r.truth);
+		}
+
+	private:
+		void varint(uint32_t v){
+			while (v >= 0x80){
+				std::fputc(int(v & 0x7F) | 0x80, _f);
+				v >>= 7;
+			}
+			std::fputc(int(v), _f);
+		}
+
+		FILE* _f;
+		uint8_t _flags;
+	};
+
+
+		/* reads records from a trace in memory (e.g. mmap'ed) */
+	class Reader {
+	public:
+		Reader(const uint8_t* data, size_t size) : _pos(data + HEADER_SIZE), _end(data + size), _valid(false) {
+			if (size < HEADER_SIZE || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0 || data[4] != VERSION){
+				_pos = _end;
+				return;
+			}
+			_flags = data[5];
+			_tick_rate = uint32_t(data[8]) | uint32_t(data[9]) << 8 | uint32_t(data[10]) << 16 | uint32_t(data[11]) << 24;
+			_valid = _tick_rate != 0;
+		}
+
+		bool valid() const { return _valid; }
+		bool has_truth() const { return _flags & TRACE_TRUTH; }
+		uint32_t tick_rate() const { return _tick_rate; }
+		bool truncated() const { return _truncated; }
+
+			/* false at the end or if the rest is truncated */
+		bool next(Record& r){
+			r.truth = 0;
+			if (!varint(r.dt)) return false;
+			if (!varint(r.echo) || (has_truth() && !varint(r.truth))){
+				_truncated = true;
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		bool varint(uint32_t& v){
+			v = 0;
+			for (uint8_t shift = 0; shift < 35; shift += 7){
+				if (_pos == _end){
+					_truncated = shift != 0;
+					return false;
+				}
+				uint8_t b = *_pos++;
+				v |= uint32_t(b & 0x7F) << shift;
+				if (!(b & 0x80)) return true;
+			}
+			_truncated = true;
+			_pos = _end;
+			return false;
+		}
+
+		const uint8_t* _pos;
+		const uint8_t* _end;
+		bool _valid;
+		bool _truncated { false };
+		uint8_t _flags { 0 };
+		uint32_t _tick_rate { 0 };
+	};
+
+}
+
+#endif
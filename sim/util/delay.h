@@ -0,0 +1,25 @@
+/* host replacement for <util/delay.h>
+*
+* the busy loops of avr-libc are replaced by advancing the simulated time.
+* interrupts that become pending during the delay are served and extend the
+* delay, like they do on the chip.
+*/
+
+#ifndef __sim_util_delay_h__
+#define __sim_util_delay_h__
+
+#ifndef F_CPU
+#error "F_CPU needs to be defined before including util/delay.h"
+#endif
+
+#include <stdint.h>
+
+void sim_delay_cycles(uint32_t cycles);
+
+// the avr-gcc builtin that _delay_us() ends in, exact to the cycle
+inline void __builtin_avr_delay_cycles(uint32_t cycles){ sim_delay_cycles(cycles); }
+
+inline void _delay_us(double us){ sim_delay_cycles(static_cast<uint32_t>(us * (F_CPU / 1e6) + 0.5)); }
+inline void _delay_ms(double ms){ sim_delay_cycles(static_cast<uint32_t>(ms * (F_CPU / 1e3) + 0.5)); }
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * synth.h
+ *
+ * wavetable synthesis (DDS) for Timer1 as 8 bit DAC: Timer1 runs as fast PWM
+ * from the PLL, its overflow ISR is the sample clock and writes the next
+ * sample to OCR1A.
+ *
+ * an Oscillator adds a 16 bit tuning word to its phase on every sample, the
+ * high byte of the phase indexes a wavetable of 256 samples in flash:
+ *   frequency = step * sample_rate / 65536
+ * the tables are computed by the compiler, only the one that is used takes
+ * flash. step() derives the tuning word from the Timer1 registers of a
+ * tone::Tone, so tone.h and scale.h map distances to pitches as before.
+ */
+
+#ifndef __synth_h__
+#define __synth_h__
+
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "tone.h"
+
+#ifndef SIM_CHARGE
+#define SIM_CHARGE(cycles)  // cycle cost annotation for the host simulator, see mydefs.h
+#endif
+
+namespace synth {
+
+	enum Wave : uint8_t {
+		SINE,
+		TRIANGLE,
+		SOFT_SAW,    // the first four harmonics of a saw tooth, less aliasing than the real one
+	};
+
+	/* compile time math */
+
+	constexpr double PI { 3.14159265358979324 };
+
+		/* sin(2 pi i / 256), exact enough for 8 bit samples */
+	constexpr double sine(uint16_t i){
+		double x = 2 * PI * (i & 0xFF) / 256;
+		if (x > PI) x -= 2 * PI;
+		double term = x, sum = x;
+		for (uint8_t n = 1; n < 12; ++n){
+			term *= -x * x / ((2 * n) * (2 * n + 1));
+			sum += term;
+		}
+		return sum;
+	}
+
+		/* sample i of one period, not normalized */
+	constexpr double wave_value(Wave wave, uint16_t i){
+		return wave == SINE     ? sine(i)
+		     : wave == TRIANGLE ? (i < 64 ? i / 64.0 : i < 192 ? (128 - double(i)) / 64 : (double(i) - 256) / 64)
+		     :                    sine(i) + sine(2 * i) / 2 + sine(3 * i) / 3 + sine(4 * i) / 4;
+	}
+
+		/* one period of a wave in 256 unsigned samples around 128, full scale */
+	template <Wave wave>
+	struct Wavetable {
+		uint8_t sample[256];
+
+		constexpr Wavetable() : sample{} {
+			double peak = 0;
+			for (uint16_t i = 0; i < 256; ++i){
+				double v = wave_value(wave, i);
+				if (v > peak) peak = v;
+				if (-v > peak) peak = -v;
+			}
+			for (uint16_t i = 0; i < 256; ++i){
+				double v = wave_value(wave, i) / peak * 127;
+				sample[i] = static_cast<uint8_t>(128 + (v < 0 ? v - 0.5 : v + 0.5));
+			}
+		}
+
+			/* must be called on a table in PROGMEM */
+		uint8_t read(uint8_t phase) const { return pgm_read_byte(&sample[phase]); }
+	};
+
+
+		/* tuning word of the tone that t plays on Timer1 clocked with f_cpu
+		   (f_cpu / 2^(prescale - 1) / (ocr1c + 1)). one division, for the main
+		   loop. tones above half the sample rate are limited to it */
+	template <uint32_t f_cpu, uint32_t sample_rate>
+	uint16_t step(const tone::Tone& t){
+		constexpr uint32_t FULL_STEP { static_cast<uint32_t>((uint64_t(f_cpu) << 16) / sample_rate) };   // step of f_cpu
+		static_assert(FULL_STEP > 0, "sample rate too high for f_cpu");
+		uint32_t s = (FULL_STEP / (t.ocr1c + 1)) >> (t.prescale - 1);
+		SIM_CHARGE(avrcost::DIV_U32 + avrcost::shift<uint32_t>(t.prescale - 1) + avrcost::add<uint32_t>() + avrcost::BRANCH);
+		return s < 0x8000 ? static_cast<uint16_t>(s) : 0x8000;
+	}
+
+
+	class Oscillator {
+	public:
+			/* next sample, once per sample period (ISR) */
+		template <typename Table>
+		uint8_t next(const Table& table){
+			_phase += _step;
+			SIM_CHARGE(2*avrcost::ld<uint16_t>() + avrcost::add<uint16_t>() + avrcost::st<uint16_t>() + 2);
+			return table.read(_phase >> 8);
+		}
+
+			/* new tuning word, from the main loop. atomic, the ISR reads it */
+		void tune(uint16_t step){
+			uint8_t sreg = SREG;
+			cli();
+			_step = step;
+			SREG = sreg;
+			SIM_CHARGE(avrcost::st<uint16_t>());
+		}
+
+	private:
+		uint16_t _phase { 0 };
+		uint16_t _step { 0 };
+	};
+
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * timing.h
+ *
+ * resolution of the echo timing and the playing range in Timer0 ticks, for
+ * F_CPU and TIMING_MODE. main.cpp measures with it, the benches in sim/ take
+ * the same numbers.
+ */
+
+#ifndef __timing_h__
+#define __timing_h__
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#error "F_CPU needs to be defined before include!"
+#endif
+
+// the prescaler of Timer0 (or select one from the command line, e.g. -DTIMING_MODE=TIMING_FINE)
+//   TIMING_FINE      /1, 1 tick per cycle. Timer0 overflows every 256 ticks, several times per ping,
+//                    the overflow ISR counts them for the 16 bit time
+//   TIMING_COARSE    /8. a ping fits into two rounds of Timer0: compare B is never off for a
+//                    whole round and counts the overflows itself, there is no overflow ISR
+//   TIMING_COARSE64  /64, the same for 16MHz: at /8 the readouts wouldn't fit into 12 bit (the
+//                    compile time CMI). a ping takes a few rounds, compare B skips the early ones
+//   TIMING_AUTO      TIMING_COARSE if one tick is still shorter than one step of the tone
+//                    (128 per octave, see tone.h), else TIMING_FINE. TIMING_COARSE64 if the
+//                    readouts need it
+#define TIMING_AUTO     0
+#define TIMING_FINE     1
+#define TIMING_COARSE   8
+#define TIMING_COARSE64 64
+#ifndef TIMING_MODE
+#define TIMING_MODE TIMING_AUTO
+#endif
+#define OCTAVE_US 1280     // echo time per octave of the tone (~22cm)
+#define MAX_ECHO_US 2816   // readouts are below (~48cm)
+#if TIMING_MODE == TIMING_AUTO
+	#if F_CPU / TIMING_COARSE * MAX_ECHO_US / 1000000 > 0x1000
+		#define TIMER0_PRESCALE TIMING_COARSE64
+	#elif F_CPU / TIMING_COARSE * OCTAVE_US / 1000000 >= 128
+		#define TIMER0_PRESCALE TIMING_COARSE
+	#else
+		#define TIMER0_PRESCALE TIMING_FINE
+	#endif
+#elif TIMING_MODE == TIMING_FINE || TIMING_MODE == TIMING_COARSE || TIMING_MODE == TIMING_COARSE64
+	#define TIMER0_PRESCALE TIMING_MODE
+#else
+	#error "TIMING_MODE must be TIMING_AUTO, TIMING_FINE, TIMING_COARSE or TIMING_COARSE64"
+#endif
+
+constexpr uint32_t TIMER0_HZ{ F_CPU / TIMER0_PRESCALE };
+constexpr uint16_t us_to_ticks(uint32_t us){ return us * (TIMER0_HZ / 1000) / 1000; }
+
+constexpr uint16_t DIST_OCT{ us_to_ticks(OCTAVE_US) };          // distance per octave
+constexpr uint16_t MAX_DISTANCE{ us_to_ticks(MAX_ECHO_US) };    // readouts are below
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * tone.h
+ *
+ * distance -> tone mapping as a lookup table in flash.
+ * the table is generated by the compiler (constexpr), so there is no division
+ * left at run time: the distance is quantized by a shift and the entry holds
+ * the prescaler nibble for TCCR1 and the period for OCR1C.
+ *
+ * mapping (as before): every dist_oct timer ticks are one octave (one step of
+ * the Timer1 prescaler, starting at 2 at 1MHz, one more for every doubling of
+ * F_CPU), inside an octave the period sweeps linearly from 128 to 255.
+ * Glide slides from one tone to the next in small steps.
+ */
+
+#ifndef __tone_h__
+#define __tone_h__
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#ifndef SIM_CHARGE
+#define SIM_CHARGE(cycles)  // cycle cost annotation for the host simulator, see mydefs.h
+#endif
+
+namespace tone {
+
+		/* register values of one tone. OCR1A is OCR1C/2 (50% duty cycle) */
+	struct Tone {
+		uint8_t prescale;   // CS13..CS10 of TCCR1
+		uint8_t ocr1c;
+		uint8_t ocr1a;
+	};
+
+	struct Entry {
+		uint8_t prescale;
+		uint8_t period;
+	};
+
+		/* largest quantization shift that keeps one table step below one step of
+		   the period (128 steps per octave) */
+	constexpr uint8_t auto_shift(uint16_t dist_oct, uint8_t shift = 0){
+		return (dist_oct >> (shift + 1)) >= 128 ? auto_shift(dist_oct, shift + 1) : shift;
+	}
+
+		/* Timer1 prescaler of the closest octave: the one that divides f_cpu down
+		   to 500kHz (/2 at 1MHz, /16 at 8MHz), the pitch is the same at every F_CPU */
+	constexpr uint8_t base_prescale(uint32_t f_cpu){
+		return f_cpu > 1000000 ? 1 + base_prescale(f_cpu / 2) : 2;
+	}
+
+		/* f_cpu:        clock of Timer1
+		   max_distance: readouts are < max_distance timer ticks
+		   dist_oct:     timer ticks per octave
+		   shift:        readouts are quantized by >> shift */
+	template <uint32_t f_cpu, uint16_t max_distance, uint16_t dist_oct, uint8_t shift = auto_shift(dist_oct)>
+	struct Table {
+		static constexpr uint16_t SIZE { ((max_distance - 1) >> shift) + 1 };
+		static constexpr uint8_t SHIFT { shift };
+		static constexpr uint8_t BASE { base_prescale(f_cpu) };
+		static_assert((max_distance - 1) / dist_oct + BASE <= 0x0F, "the farthest octave needs a Timer1 prescaler above /16384");
+
+		Entry entry[SIZE];
+
+		constexpr Table() : entry{} {
+			for (uint16_t i = 0; i < SIZE; ++i){
+				uint32_t d = uint32_t(i) << shift;
+				entry[i].prescale = (d / dist_oct + BASE) & 0x0F;   // be shure to get a 4Bit value
+				entry[i].period = (d % dist_oct) * 128 / dist_oct + 128;
+			}
+		}
+
+			/* must be called on a table in PROGMEM */
+		Tone lookup(uint16_t distance) const {
+			uint16_t i = distance >> shift;
+			if (i >= SIZE) i = SIZE - 1;
+			SIM_CHARGE(avrcost::shift<uint16_t>(shift) + avrcost::add<uint16_t>() + avrcost::BRANCH + 4);
+			const Entry* e = &entry[i];
+			uint8_t period = pgm_read_byte(&e->period);
+			return Tone{ pgm_read_byte(&e->prescale), period, static_cast<uint8_t>(period / 2) };
+		}
+	};
+
+
+		/* portamento: slides the pitch towards the target, ~63% of the way in
+		   2^shift steps. it glides on the scale of the tone table: the prescaler
+		   is the octave and OCR1C (128..255) the position in it, so a step is the
+		   same interval up and down and across an octave boundary it just carries
+		   into the prescaler, no jump. 5 fractional bits. OCR1C below 128 (only
+		   with prescaler 1, the highest tones of the scales) goes on linearly */
+	template <uint8_t shift>
+	class Glide {
+		static_assert(shift <= 8, "no more than 256 steps");
+	public:
+			/* where to go. the first one is taken at once: true, the caller sets it */
+		bool target(const Tone& t){
+			_target = position(t);
+			SIM_CHARGE(avrcost::shift<uint16_t>(5) + avrcost::add<uint16_t>() + 2*avrcost::st<uint16_t>() + avrcost::BRANCH + 4);
+			if (_position) return false;
+			_position = _target;
+			return true;
+		}
+
+			/* one step towards the target. false if it is there already */
+		bool step(Tone& t){
+			if (_position == _target) return false;
+			uint16_t d = _position < _target ? _target - _position : _position - _target;
+			uint16_t s = d >> shift;
+			if (s == 0) s = d;   // the last bit of the way
+			_position = _position < _target ? _position + s : _position - s;
+
+			uint16_t p = _position >> 5;
+			uint8_t prescale = p < 256 ? 1 : p >> 7;
+			uint8_t period = p < 256 ? p : (p & 0x7F) | 0x80;
+			t = Tone{ prescale, period, static_cast<uint8_t>(period / 2) };
+			SIM_CHARGE(2*avrcost::ld<uint16_t>() + avrcost::st<uint16_t>() + 3*avrcost::add<uint16_t>()
+			           + avrcost::shift<uint16_t>(shift) + avrcost::shift<uint16_t>(5) + avrcost::shift<uint16_t>(7) + 4*avrcost::BRANCH + 4);
+			return true;
+		}
+
+	private:
+		static uint16_t position(const Tone& t){ return ((t.prescale << 7) + t.ocr1c - 128) << 5; }
+
+		uint16_t _position { 0 };   // 0: no tone yet
+		uint16_t _target { 0 };
+	};
+
+}
+
+#endif